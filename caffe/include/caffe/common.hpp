@@ -152,6 +152,16 @@ class Caffe {
 
   // Sets the random seed of both boost and curand
   static void set_random_seed(const unsigned int seed);
+  // Unlike the rest of this context, libmolgrid's random engine is shared
+  // by all threads; hold this lock while seeding or drawing from it on a
+  // thread that may run alongside others.
+  class MolgridRngLock {
+   public:
+    MolgridRngLock();
+    ~MolgridRngLock();
+   private:
+    DISABLE_COPY_AND_ASSIGN(MolgridRngLock);
+  };
   // Sets the device. Since we have cublas and curand stuff, set device also
   // requires us to reset those values.
   static void SetDevice(const int device_id);
@@ -388,6 +388,18 @@ class BlobProtoFiller : public Filler<Dtype> {
   BlobProto blob_proto_;
 };
 
+/**
+ * @brief Leaves a Blob unfilled, and so unallocated until it is first used,
+ *        for parameters that are shared with another net before they are read.
+ */
+template <typename Dtype>
+class NoneFiller : public Filler<Dtype> {
+ public:
+  explicit NoneFiller(const FillerParameter& param)
+      : Filler<Dtype>(param) {}
+  virtual void Fill(Blob<Dtype>* blob) {}
+};
+
 /**
  * @brief Get a specific filler from the specification given in FillerParameter.
  *
@@ -415,6 +427,8 @@ Filler<Dtype>* GetFiller(const FillerParameter& param) {
     return new BlobProtoFiller<Dtype>(param);
   } else if (type == "radial") {
     return new RadialFiller<Dtype>(param);
+  } else if (type == "none") {
+    return new NoneFiller<Dtype>(param);
   } else {
     CHECK(false) << "Unknown filler name: " << param.type();
   }
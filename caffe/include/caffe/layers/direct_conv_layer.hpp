@@ -0,0 +1,81 @@
+#ifndef CAFFE_DIRECT_CONV_LAYER_HPP_
+#define CAFFE_DIRECT_CONV_LAYER_HPP_
+
+#include <vector>
+
+#include "caffe/blob.hpp"
+#include "caffe/layer.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/grid_tiles.hpp"
+
+#include "caffe/layers/conv_layer.hpp"
+
+namespace caffe {
+
+/*
+ * @brief Direct CPU implementation of 3D ConvolutionLayer.
+ *        Fallback to ConvolutionLayer for GPU mode and for convolutions
+ *        that are not 3D, are grouped or are dilated.
+ *
+ * The im2col engine expands every input into a column buffer of
+ * kernel volume * channels * output volume values before a GEMM, which for
+ * the 3D grids of gnina's models is hundreds of megabytes and dominates CPU
+ * inference time.  This engine instead accumulates a block of output channels
+ * one output row at a time directly from the input rows, so the rows being
+ * accumulated stay in cache, every input row is read once per block and the
+ * innermost loops are unit stride (vectorizable) for stride 1 convolutions.
+ * No column buffer is ever allocated.
+ */
+template <typename Dtype>
+class DirectConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit DirectConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param) {}
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+  // output channels accumulated together
+  static const int kBlock = 8;
+
+  // Skip input rows that lie in empty tiles of tiles (e.g. the output tiles
+  // of a PoolingLayer over molecular grids) in Forward while they are valid,
+  // which is exact.  NULL restores dense convolution.
+  void SetInputTiles(const GridTiles* tiles) { input_tiles_ = tiles; }
+  // Skip the empty input tiles in Backward too.  The weight gradient stays
+  // exact, but the bottom diff of empty tiles is left zero, which is only
+  // right for consumers that read it near the density of the grids (e.g. the
+  // gradients of the atoms that produced them).  Off by default.
+  void SetSparseBackward(bool sparse) { sparse_backward_ = sparse; }
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+  // rows, if not NULL, flags the input rows (channel, depth, height) that
+  // may hold nonzero values, the others are skipped
+  void forward_direct(const Dtype* input, const Dtype* weights,
+      const Dtype* bias, const char* rows, Dtype* output);
+  // either of input_diff and weight_diff may be NULL; input_diff is
+  // overwritten, weight_diff accumulated
+  void backward_direct(const Dtype* output_diff, const Dtype* input,
+      const Dtype* weights, const char* rows, Dtype* input_diff,
+      Dtype* weight_diff);
+  // the row flags of example n from the input tiles, NULL if not usable
+  const char* input_rows(int n);
+
+  // depth, height and width of the input, output and kernel
+  struct geometry {
+    int in[3], out[3], kernel[3], stride[3], pad[3];
+  };
+  geometry geom_;
+  bool direct_;  // geometry is supported by the direct kernels
+  const GridTiles* input_tiles_ = NULL;
+  bool sparse_backward_ = false;
+  vector<char> rows_;
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_DIRECT_CONV_LAYER_HPP_
@@ -19,10 +19,13 @@
 #include "caffe/layer.hpp"
 #include "caffe/layers/base_data_layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/blocking_queue.hpp"
+#include "caffe/util/grid_tiles.hpp"
 #include "caffe/util/rng.hpp"
 
 #include "gninasrc/lib/quaternion.h"
 #include "gninasrc/lib/atom.h"
+#include <libmolgrid/libmolgrid.h>
 #include <libmolgrid/example_provider.h>
 #include <libmolgrid/atom_typer.h>
 #include <libmolgrid/grid_maker.h>
@@ -37,7 +40,7 @@ namespace caffe {
  */
 
 template<typename Dtype>
-class MolGridDataLayer : public BaseDataLayer<Dtype> {
+class MolGridDataLayer : public BaseDataLayer<Dtype>, public InternalThread {
   public:
     typedef qt quaternion;
 
@@ -47,6 +50,8 @@ class MolGridDataLayer : public BaseDataLayer<Dtype> {
     virtual ~MolGridDataLayer();
     virtual void DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
         const vector<Blob<Dtype>*>& top);
+    virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+        const vector<Blob<Dtype>*>& top);
     virtual inline const char* type() const {
       return "MolGridData";
     }
@@ -98,9 +103,36 @@ class MolGridDataLayer : public BaseDataLayer<Dtype> {
     void getMappedLigandRelevance(int batch_idx, std::unordered_map<string, float>& relevance);
 
     virtual void setReceptor(const vector<float3>& coords, const vector<smt>& smtypes, const vec& translate =
-        {}, const qt& rotate = {});
+        {}, const qt& rotate = {}, unsigned mol_idx = 0);
     virtual void setLigand(const vector<float3>& coords, const vector<smt>& smtypes,
-                           bool calcCenter = true);
+                           bool calcCenter = true, unsigned mol_idx = 0);
+
+    //number of in memory examples gridded by each forward pass, the top
+    //blobs are reshaped on the next forward
+    void setBatchSize(unsigned n);
+    unsigned getBatchSize() const {
+      return batch_info.size();
+    }
+
+    //with a source, forward copies the grids of src (the data top of another
+    //layer with the same gridding parameters and in memory examples) instead
+    //of gridding; src must be forwarded first, NULL restores gridding
+    void setGridSource(const Blob<Dtype> *src) {
+      CHECK(inmem) << "Grids can only be shared for structures in memory";
+      grid_source = src;
+    }
+
+    //after each forward of in memory examples on the cpu, track which tiles
+    //of tile^3 grid points of every channel hold any density so that
+    //the layers consuming the grids can skip empty ones; 0 disables
+    void setTileSize(unsigned tile) {
+      tile_size = tile;
+      if(tile == 0) tiles.set_valid(false);
+    }
+    //occupancy of the grids of the last forward, valid only if it was tracked
+    const GridTiles* getTiles() const {
+      return &tiles;
+    }
 
     //set center to use for memory ligand
     void setGridCenter(const vec& center) {
@@ -133,6 +165,19 @@ class MolGridDataLayer : public BaseDataLayer<Dtype> {
       return numchannels;
     }
 
+    unsigned getNumReceptorChannels() const {
+      return numReceptorTypes;
+    }
+
+    //number of in memory examples whose receptor channels were copied from
+    //the receptor grid cache rather than regridded, and of those that weren't
+    unsigned long getReceptorGridHits() const {
+      return receptor_grid_hits;
+    }
+    unsigned long getReceptorGridMisses() const {
+      return receptor_grid_misses;
+    }
+
     virtual void dumpDiffDX(const std::string& prefix, Blob<Dtype>* top,  double scale) const;
     virtual void dumpGridDX(const std::string& prefix, Dtype* top, double scale = 1.0) const;
 
@@ -158,6 +203,7 @@ class MolGridDataLayer : public BaseDataLayer<Dtype> {
       libmolgrid::ManagedGrid<Dtype, 2> rec_gradient; //todo: change to mgrid
       libmolgrid::ManagedGrid<Dtype, 2> lig_gradient;
       gfloat3 grid_center = gfloat3(0,0,0);
+      gfloat3 mem_center = gfloat3(NAN,NAN,NAN); //center set for an in memory example of a batch
 
       //relevance is only used for visualization, so these are not initialized by default
       libmolgrid::ManagedGrid<Dtype, 1> rec_relevance;
@@ -256,6 +302,9 @@ class MolGridDataLayer : public BaseDataLayer<Dtype> {
     vector<int> top_shape;
     gfloat3 grid_center = gfloat3(NAN,NAN,NAN);
     bool inmem = false;
+    const Blob<Dtype> *grid_source = NULL; //grids to copy instead of gridding
+    unsigned tile_size = 0; //of tiles to track, if not zero
+    GridTiles tiles;
 
     //batch labels split into individual vectors
     vector<Dtype> labels;
@@ -292,13 +341,62 @@ class MolGridDataLayer : public BaseDataLayer<Dtype> {
     //need to remember how mols were transformed for backward pass; store gradient as well
     vector<typename MolGridDataLayer<Dtype>::mol_info> batch_info;
 
+    //a batch of examples read from the data sources and gridded, either by
+    //forward or ahead of time by the prefetch thread
+    struct prefetch_batch {
+        Blob<Dtype> data;
+        vector<typename MolGridDataLayer<Dtype>::mol_info> batch_info;
+        vector<Dtype> labels;
+        vector<Dtype> affinities;
+        vector<Dtype> rmsds;
+        vector<Dtype> seqcont;
+        vector<output_transform> perturbations;
+    };
+    prefetch_batch sync_batch; //used when not prefetching
+    vector<shared_ptr<prefetch_batch> > prefetch;
+    BlockingQueue<prefetch_batch*> prefetch_free;
+    BlockingQueue<prefetch_batch*> prefetch_full;
+    prefetch_batch *prefetch_current = NULL; //batch whose data backs the top blob
+    //libmolgrid draws example order and random transformations from one
+    //global engine; a layer prefetching from files keeps its own, seeded at
+    //setup, and swaps it in while loading so that its batches only depend
+    //on the seed and not on when the loaders of other layers run
+    decltype(libmolgrid::random_engine) rng;
+    //transformation of the last frame loaded into each example of a batch,
+    //which the first frame of the next chunk of its group continues; batches
+    //rotate through several infos, so these are kept by the loader
+    vector<libmolgrid::Transform> group_transforms;
+
+    //receptor channels of recently gridded in memory examples; the receptor
+    //is usually the same between calls (poses of a ligand, minimization
+    //steps), so these are reused when neither the receptor atoms nor the
+    //grid center changed and no random transformation is applied
+    struct receptor_grid {
+        libmolgrid::CoordinateSet atoms; //untransformed receptor, on cpu
+        gfloat3 center = gfloat3(0,0,0);
+        bool gpu = false; //where values live
+        libmolgrid::ManagedGrid<Dtype, 1> values; //numReceptorTypes*numgridpoints
+        vector<char> tiles; //occupancy of values, if tracked when they were set
+    };
+    vector<receptor_grid> receptor_grids; //at most one per example of the batch
+    unsigned next_receptor_grid = 0; //entry to replace next when full
+    unsigned long receptor_grid_hits = 0;
+    unsigned long receptor_grid_misses = 0;
+
     ////////////////////   PROTECTED METHODS   //////////////////////
+    virtual void InternalThreadEntry();
+    void load_batch(Dtype *data, prefetch_batch& batch, bool gpu);
     void set_grid_ex(Dtype *grid, const libmolgrid::Example& ex,
         typename MolGridDataLayer<Dtype>::mol_info& minfo,
         int pose, output_transform& pertub, bool gpu, bool keeptransform);
+    //if tiles_index isn't negative, the occupancy of the grid is stored
+    //as that example of tiles
     virtual void set_grid_minfo(Dtype *grid,
         typename MolGridDataLayer<Dtype>::mol_info& minfo,
-        output_transform& peturb, bool gpu, bool keeptransform);
+        output_transform& peturb, bool gpu, bool keeptransform,
+        int tiles_index = -1);
+    receptor_grid& lookup_receptor_grid(const mol_info& minfo, bool gpu, bool& hit);
+    void mark_ligand_tiles(int tiles_index, const mol_info& minfo);
 
     //stuff for outputing dx grids
     std::string getIndexName(const vector<int>& map, unsigned index) const;
@@ -6,6 +6,7 @@
 #include "caffe/blob.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/util/grid_tiles.hpp"
 
 namespace caffe {
 
@@ -43,6 +44,28 @@ class PoolingLayer : public Layer<Dtype> {
 	  this->layer_param_.mutable_pooling_param()->set_pool(p);
   }
 
+  /**
+   * @brief Use the occupancy of the tiles of the bottom grids (e.g. those of
+   *        a MolGridDataLayer) to skip empty tiles on the CPU.
+   *
+   * Applies to 3D MAX and AVE pooling without padding where the kernel
+   * equals the stride and divides the tile size, otherwise, or while the
+   * tiles are not valid, pooling is dense.  Forward is exact.  NULL restores
+   * dense pooling.
+   */
+  void SetInputTiles(const GridTiles* tiles) { input_tiles_ = tiles; }
+  /**
+   * @brief Skip the empty input tiles in Backward too (off by default).
+   *
+   * Backward then only propagates into occupied tiles and leaves the bottom
+   * diff of empty tiles zero, which is all that is needed to get gradients
+   * of the atoms that produced the grids, but not a full grid gradient.
+   */
+  void SetSparseBackward(bool sparse) { sparse_backward_ = sparse; }
+  /// @brief The occupancy of the pooled grids, valid after a forward that
+  ///        used the input tiles.
+  const GridTiles* output_tiles() const { return &output_tiles_; }
+
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
@@ -55,6 +78,27 @@ class PoolingLayer : public Layer<Dtype> {
   virtual void Backward_relevance(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
       
+  // A box of pooled values [lo, hi) of one channel; windows of an empty
+  // region only cover zeros.
+  struct pool_region {
+    int lo[3];
+    int hi[3];
+    bool empty;
+  };
+  // set regions_ to the regions of channel c of example n to pool, one per
+  // tile with the input tiles, otherwise one for the whole channel
+  void pool_regions(int n, int c, bool use_tiles);
+  bool use_input_tiles(const Blob<Dtype>* bottom) const;
+
+  void forward_max_3d(const pool_region& r, const Dtype* bottom_data,
+      Dtype* top_data, int* mask, Dtype* top_mask);
+  void forward_ave_3d(const pool_region& r, const Dtype* bottom_data,
+      Dtype* top_data);
+  void backward_max_3d(const pool_region& r, const Dtype* top_diff,
+      const int* mask, const Dtype* top_mask, Dtype* bottom_diff);
+  void backward_ave_3d(const pool_region& r, const Dtype* top_diff,
+      Dtype* bottom_diff);
+
 
   /// @brief The spatial dimensions of a filter kernel.
   Blob<int> kernel_shape_;
@@ -77,6 +121,11 @@ class PoolingLayer : public Layer<Dtype> {
   bool global_pooling_;
   Blob<Dtype> rand_idx_;
   Blob<int> max_idx_;
+
+  const GridTiles* input_tiles_ = NULL;
+  bool sparse_backward_ = false;
+  GridTiles output_tiles_;
+  vector<pool_region> regions_;
 };
 
 }  // namespace caffe
@@ -0,0 +1,79 @@
+#ifndef CAFFE_UTIL_GRID_TILES_HPP_
+#define CAFFE_UTIL_GRID_TILES_HPP_
+
+#include <vector>
+
+namespace caffe {
+
+/**
+ * @brief Block-sparse occupancy of a batch of multi-channel cubic grids.
+ *
+ * Every channel of a dim^3 grid is split into cubic tiles of tile^3 values
+ * (the last tile along an axis may be smaller) and a tile is occupied if any
+ * of its values is nonzero.  Molecular grids are mostly empty, ligand
+ * channels in particular, so the layers consuming them can skip the values
+ * of unoccupied tiles, which are known to be zero.
+ */
+class GridTiles {
+ public:
+  GridTiles()
+      : num_(0), channels_(0), dim_(0), tile_(0), per_axis_(0),
+        valid_(false) {}
+
+  // Resize for num examples of channels grids of dim^3 values; the
+  // occupancy is undefined until it is scanned or set.
+  void Reshape(int num, int channels, int dim, int tile);
+  // Recompute the occupancy of count channels of example n, starting at
+  // channel first, from grid, which holds the values of these channels.
+  template <typename Dtype>
+  void Scan(int n, int first, int count, const Dtype* grid);
+  // Mark count channels of example n, starting at channel first, as empty.
+  void Clear(int n, int first, int count);
+  // Mark the tiles of channel c of example n holding any of the grid points
+  // lo[i] <= x_i <= hi[i] as occupied; the box is clipped to the grid.
+  // Marking a box around every source of nonzero values (e.g. the density
+  // cutoff of each atom) gives a superset of the occupied tiles without
+  // looking at the values.
+  void MarkBox(int n, int c, const int lo[3], const int hi[3]);
+  // Copy the occupancy of count channels of example n, starting at channel
+  // first, to or from flags, which holds count * tiles() values.
+  void Get(int n, int first, int count, char* flags) const;
+  void Set(int n, int first, int count, const char* flags);
+  // Set to the occupancy of the grids of src downsampled by factor without
+  // overlap (e.g. pooled with kernel == stride == factor) to out_dim values
+  // per axis, so an output tile covers exactly the values of an input tile.
+  // Invalid unless tile is a multiple of factor and the tiles line up.
+  void Downsample(const GridTiles& src, int factor, int out_dim);
+
+  inline bool occupied(int n, int c, int tx, int ty, int tz) const {
+    return flags_[((n * channels_ + c) * per_axis_ + tx) * per_axis_ * per_axis_
+        + ty * per_axis_ + tz];
+  }
+  // whether any tile holding grid points (x, y, *) of channel c is occupied
+  bool row_occupied(int n, int c, int x, int y) const;
+
+  inline int num() const { return num_; }
+  inline int channels() const { return channels_; }
+  inline int dim() const { return dim_; }
+  inline int tile() const { return tile_; }
+  inline int per_axis() const { return per_axis_; }
+  inline int tiles() const { return per_axis_ * per_axis_ * per_axis_; }
+
+  // whether the occupancy describes the current grids; consumers fall back
+  // to dense computation when it doesn't
+  inline bool valid() const { return valid_; }
+  inline void set_valid(bool valid) { valid_ = valid; }
+
+ protected:
+  int num_;
+  int channels_;
+  int dim_;
+  int tile_;
+  int per_axis_;
+  bool valid_;
+  std::vector<char> flags_;  // num * channels * tiles, tz varying fastest
+};
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_GRID_TILES_HPP_
@@ -50,6 +50,16 @@ void GlobalInit(int* pargc, char*** pargv) {
   ::google::InstallFailureSignalHandler();
 }
 
+static boost::mutex molgrid_rng_mutex;
+
+Caffe::MolgridRngLock::MolgridRngLock() {
+  molgrid_rng_mutex.lock();
+}
+
+Caffe::MolgridRngLock::~MolgridRngLock() {
+  molgrid_rng_mutex.unlock();
+}
+
 #ifdef CPU_ONLY  // CPU-only Caffe.
 
 Caffe::Caffe()
@@ -151,6 +161,7 @@ void Caffe::set_random_seed(const unsigned int seed) {
   // RNG seed
   Get().random_generator_.reset(new RNG(seed));
 
+  MolgridRngLock lock;
   libmolgrid::random_engine.seed(seed);
 }
 
@@ -0,0 +1,268 @@
+#include <algorithm>
+#include <vector>
+
+#include "caffe/layers/direct_conv_layer.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// set [lo, hi) to the output columns ow whose input column
+// ow * stride - pad + k lies inside an input row of width n
+static inline void valid_columns(int k, int n, int out, int stride, int pad,
+    int* lo, int* hi) {
+  const int first = pad - k;  // need ow * stride >= first
+  *lo = first <= 0 ? 0 : (first + stride - 1) / stride;
+  const int last = n - 1 + pad - k;  // need ow * stride <= last
+  *hi = last < 0 ? 0 : std::min(out, last / stride + 1);
+}
+
+template <typename Dtype>
+const int DirectConvolutionLayer<Dtype>::kBlock;
+
+template <typename Dtype>
+void DirectConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::Reshape(bottom, top);
+  direct_ = this->num_spatial_axes_ == 3 && this->channel_axis_ == 1 &&
+      this->group_ == 1;
+  if (!direct_) {
+    return;
+  }
+  const int* kernel_data = this->kernel_shape_.cpu_data();
+  const int* stride_data = this->stride_.cpu_data();
+  const int* pad_data = this->pad_.cpu_data();
+  const int* dilation_data = this->dilation_.cpu_data();
+  for (int i = 0; i < 3; ++i) {
+    direct_ = direct_ && dilation_data[i] == 1;
+    geom_.in[i] = bottom[0]->shape(2 + i);
+    geom_.out[i] = this->output_shape_[i];
+    geom_.kernel[i] = kernel_data[i];
+    geom_.stride[i] = stride_data[i];
+    geom_.pad[i] = pad_data[i];
+  }
+}
+
+template <typename Dtype>
+void DirectConvolutionLayer<Dtype>::forward_direct(const Dtype* input,
+    const Dtype* weights, const Dtype* bias, const char* rows,
+    Dtype* output) {
+  const geometry& g = geom_;
+  const int channels = this->channels_;
+  const int kernel_vol = g.kernel[0] * g.kernel[1] * g.kernel[2];
+  const int weight_stride = channels * kernel_vol;  // between output channels
+  const int in_plane = g.in[1] * g.in[2];
+  const int in_vol = g.in[0] * in_plane;
+  const int out_plane = g.out[1] * g.out[2];
+  const int out_vol = g.out[0] * out_plane;
+  const int sw = g.stride[2];
+
+  for (int o0 = 0; o0 < this->num_output_; o0 += kBlock) {
+    const int nb = std::min(kBlock, this->num_output_ - o0);
+    for (int od = 0; od < g.out[0]; ++od) {
+      for (int oh = 0; oh < g.out[1]; ++oh) {
+        // the output rows of the block are accumulated together
+        Dtype* out_rows[kBlock];
+        for (int b = 0; b < nb; ++b) {
+          out_rows[b] = output + (o0 + b) * out_vol + od * out_plane
+              + oh * g.out[2];
+          caffe_set(g.out[2], bias ? bias[o0 + b] : Dtype(0), out_rows[b]);
+        }
+        for (int kd = 0; kd < g.kernel[0]; ++kd) {
+          const int id = od * g.stride[0] - g.pad[0] + kd;
+          if (id < 0 || id >= g.in[0]) {
+            continue;
+          }
+          for (int kh = 0; kh < g.kernel[1]; ++kh) {
+            const int ih = oh * g.stride[1] - g.pad[1] + kh;
+            if (ih < 0 || ih >= g.in[1]) {
+              continue;
+            }
+            for (int kw = 0; kw < g.kernel[2]; ++kw) {
+              int lo, hi;
+              valid_columns(kw, g.in[2], g.out[2], sw, g.pad[2], &lo, &hi);
+              const int shift = kw - g.pad[2];
+              const int k = (kd * g.kernel[1] + kh) * g.kernel[2] + kw;
+              for (int c = 0; c < channels; ++c) {
+                if (rows && !rows[(c * g.in[0] + id) * g.in[1] + ih]) {
+                  continue;
+                }
+                const Dtype* in_row = input + c * in_vol + id * in_plane
+                    + ih * g.in[2];
+                const Dtype* w = weights + o0 * weight_stride
+                    + c * kernel_vol + k;
+                for (int b = 0; b < nb; ++b) {
+                  const Dtype wv = w[b * weight_stride];
+                  Dtype* row = out_rows[b];
+                  if (sw == 1) {
+                    for (int ow = lo; ow < hi; ++ow) {
+                      row[ow] += wv * in_row[ow + shift];
+                    }
+                  } else {
+                    for (int ow = lo; ow < hi; ++ow) {
+                      row[ow] += wv * in_row[ow * sw + shift];
+                    }
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void DirectConvolutionLayer<Dtype>::backward_direct(const Dtype* output_diff,
+    const Dtype* input, const Dtype* weights, const char* rows,
+    Dtype* input_diff, Dtype* weight_diff) {
+  const geometry& g = geom_;
+  const int channels = this->channels_;
+  const int kernel_vol = g.kernel[0] * g.kernel[1] * g.kernel[2];
+  const int weight_stride = channels * kernel_vol;
+  const int in_plane = g.in[1] * g.in[2];
+  const int in_vol = g.in[0] * in_plane;
+  const int out_plane = g.out[1] * g.out[2];
+  const int out_vol = g.out[0] * out_plane;
+  const int sw = g.stride[2];
+
+  if (input_diff) {
+    caffe_set(channels * in_vol, Dtype(0), input_diff);
+  }
+  for (int o0 = 0; o0 < this->num_output_; o0 += kBlock) {
+    const int nb = std::min(kBlock, this->num_output_ - o0);
+    for (int od = 0; od < g.out[0]; ++od) {
+      for (int oh = 0; oh < g.out[1]; ++oh) {
+        const Dtype* out_rows[kBlock];
+        for (int b = 0; b < nb; ++b) {
+          out_rows[b] = output_diff + (o0 + b) * out_vol + od * out_plane
+              + oh * g.out[2];
+        }
+        for (int kd = 0; kd < g.kernel[0]; ++kd) {
+          const int id = od * g.stride[0] - g.pad[0] + kd;
+          if (id < 0 || id >= g.in[0]) {
+            continue;
+          }
+          for (int kh = 0; kh < g.kernel[1]; ++kh) {
+            const int ih = oh * g.stride[1] - g.pad[1] + kh;
+            if (ih < 0 || ih >= g.in[1]) {
+              continue;
+            }
+            for (int kw = 0; kw < g.kernel[2]; ++kw) {
+              int lo, hi;
+              valid_columns(kw, g.in[2], g.out[2], sw, g.pad[2], &lo, &hi);
+              const int shift = kw - g.pad[2];
+              const int k = (kd * g.kernel[1] + kh) * g.kernel[2] + kw;
+              for (int c = 0; c < channels; ++c) {
+                if (rows && !rows[(c * g.in[0] + id) * g.in[1] + ih]) {
+                  continue;
+                }
+                const int in_offset = c * in_vol + id * in_plane
+                    + ih * g.in[2];
+                const int w_offset = o0 * weight_stride + c * kernel_vol + k;
+                for (int b = 0; b < nb; ++b) {
+                  const Dtype* row = out_rows[b];
+                  if (weight_diff) {
+                    const Dtype* in_row = input + in_offset;
+                    Dtype sum = 0;
+                    for (int ow = lo; ow < hi; ++ow) {
+                      sum += row[ow] * in_row[ow * sw + shift];
+                    }
+                    weight_diff[w_offset + b * weight_stride] += sum;
+                  }
+                  if (input_diff) {
+                    Dtype* in_row = input_diff + in_offset;
+                    const Dtype wv = weights[w_offset + b * weight_stride];
+                    for (int ow = lo; ow < hi; ++ow) {
+                      in_row[ow * sw + shift] += wv * row[ow];
+                    }
+                  }
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+const char* DirectConvolutionLayer<Dtype>::input_rows(int n) {
+  const GridTiles* tiles = input_tiles_;
+  const geometry& g = geom_;
+  if (!tiles || !tiles->valid() || tiles->num() != this->num_ ||
+      tiles->channels() != this->channels_ || tiles->dim() != g.in[0] ||
+      tiles->dim() != g.in[1] || tiles->dim() != g.in[2]) {
+    return NULL;
+  }
+  rows_.resize(this->channels_ * g.in[0] * g.in[1]);
+  char* row = &rows_[0];
+  for (int c = 0; c < this->channels_; ++c) {
+    for (int d = 0; d < g.in[0]; ++d) {
+      for (int h = 0; h < g.in[1]; ++h) {
+        *row++ = tiles->row_occupied(n, c, d, h);
+      }
+    }
+  }
+  return &rows_[0];
+}
+
+template <typename Dtype>
+void DirectConvolutionLayer<Dtype>::Forward_cpu(
+      const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  if (!direct_) {
+    ConvolutionLayer<Dtype>::Forward_cpu(bottom, top);
+    return;
+  }
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  for (int i = 0; i < bottom.size(); ++i) {
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* top_data = top[i]->mutable_cpu_data();
+    for (int n = 0; n < this->num_; ++n) {
+      forward_direct(bottom_data + n * this->bottom_dim_, weight, bias,
+          i == 0 ? input_rows(n) : NULL, top_data + n * this->top_dim_);
+    }
+  }
+}
+
+template <typename Dtype>
+void DirectConvolutionLayer<Dtype>::Backward_cpu(
+      const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+      const vector<Blob<Dtype>*>& bottom) {
+  if (!direct_) {
+    ConvolutionLayer<Dtype>::Backward_cpu(top, propagate_down, bottom);
+    return;
+  }
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* weight_diff = this->param_propagate_down_[0] ?
+      this->blobs_[0]->mutable_cpu_diff() : NULL;
+  for (int i = 0; i < top.size(); ++i) {
+    const Dtype* top_diff = top[i]->cpu_diff();
+    const Dtype* bottom_data = bottom[i]->cpu_data();
+    Dtype* bottom_diff = propagate_down[i] ?
+        bottom[i]->mutable_cpu_diff() : NULL;
+    // Bias gradient, if necessary.
+    if (this->bias_term_ && this->param_propagate_down_[1]) {
+      Dtype* bias_diff = this->blobs_[1]->mutable_cpu_diff();
+      for (int n = 0; n < this->num_; ++n) {
+        this->backward_cpu_bias(bias_diff, top_diff + n * this->top_dim_);
+      }
+    }
+    if (weight_diff || bottom_diff) {
+      for (int n = 0; n < this->num_; ++n) {
+        // weight diffs are accumulated, bottom diffs overwritten
+        backward_direct(top_diff + n * this->top_dim_,
+            bottom_data + n * this->bottom_dim_, weight,
+            i == 0 && sparse_backward_ ? input_rows(n) : NULL,
+            bottom_diff ? bottom_diff + n * this->bottom_dim_ : NULL,
+            weight_diff);
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(DirectConvolutionLayer);
+
+}  // namespace caffe
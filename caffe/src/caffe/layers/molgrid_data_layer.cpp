@@ -106,7 +106,7 @@ Dtype MolGridDataLayer<Dtype>::output_transform::convert_to_label(Dtype value, d
 
 template <typename Dtype>
 MolGridDataLayer<Dtype>::~MolGridDataLayer<Dtype>() {
-  //this->StopInternalThread();
+  this->StopInternalThread();
 }
 
 
@@ -419,6 +419,29 @@ Phosphorus
 GenericMetal Boron Manganese Magnesium Zinc Calcium Iron
 )");
 
+//draw from engine, if not NULL, instead of libmolgrid's global random engine
+//while in scope; other threads can't use the global engine meanwhile
+namespace {
+typedef decltype(libmolgrid::random_engine) molgrid_engine;
+struct layer_rng_scope {
+    Caffe::MolgridRngLock lock;
+    molgrid_engine* engine;
+    molgrid_engine saved;
+    layer_rng_scope(molgrid_engine* e): engine(e) {
+      if(engine) {
+        saved = libmolgrid::random_engine;
+        libmolgrid::random_engine = *engine;
+      }
+    }
+    ~layer_rng_scope() {
+      if(engine) {
+        *engine = libmolgrid::random_engine;
+        libmolgrid::random_engine = saved;
+      }
+    }
+};
+}
+
 //read in structure input and atom type maps
 template <typename Dtype>
 void MolGridDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
@@ -482,6 +505,11 @@ void MolGridDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
 
   if(!inmem)
   {
+    //without prefetching batches are loaded in forward, which draws from the
+    //global engine as before
+    bool ownrng = param.prefetch() > 0;
+    if(ownrng) rng.seed(caffe_rng_rand());
+    layer_rng_scope rngscope(ownrng ? &rng : NULL); //shuffling
     const string& source = param.source();
     const string& source2 = param.source2();
     CHECK_GT(source.length(), 0) << "No data source file provided";
@@ -578,6 +606,65 @@ void MolGridDataLayer<Dtype>::DataLayerSetUp(const vector<Blob<Dtype>*>& bottom,
     idx++;
   }
   CHECK_EQ(idx,top.size()) << "Inconsistent top size!";
+
+  if(!inmem && param.prefetch() > 0) {
+    //allocate up front so the prefetch thread doesn't malloc alongside the main thread
+    for(unsigned i = 0, n = param.prefetch(); i < n; i++) {
+      prefetch.push_back(shared_ptr<prefetch_batch>(new prefetch_batch));
+      prefetch_batch *batch = prefetch.back().get();
+      batch->data.Reshape(top_shape);
+      if (Caffe::mode() == Caffe::GPU)
+        batch->data.mutable_gpu_data();
+      else
+        batch->data.mutable_cpu_data();
+      prefetch_free.push(batch);
+    }
+    StartInternalThread();
+  }
+}
+
+//in memory batches may be resized between forward passes
+template <typename Dtype>
+void MolGridDataLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top) {
+  if(!inmem || top[0]->shape(0) == top_shape[0])
+    return;
+
+  const MolGridDataParameter& param = this->layer_param_.molgrid_data_param();
+  vector<int> label_shape(1, top_shape[0]);
+
+  top[0]->Reshape(top_shape);
+  top[1]->Reshape(label_shape);
+  unsigned idx = 2;
+  if (param.has_affinity()) {
+    top[idx]->Reshape(label_shape);
+    idx++;
+  }
+  if (param.has_rmsd()) {
+    top[idx]->Reshape(label_shape);
+    idx++;
+  }
+  if(ligpeturb) {
+    vector<int> peturbshape(2);
+    peturbshape[0] = top_shape[0];
+    peturbshape[1] = output_transform::size();
+    top[idx]->Reshape(peturbshape);
+    idx++;
+  }
+}
+
+//set the number of in memory examples, each must have its receptor and ligand set
+template <typename Dtype>
+void MolGridDataLayer<Dtype>::setBatchSize(unsigned n) {
+  CHECK(inmem) << "Batch size can only be set for structures in memory";
+  CHECK_EQ(group_size, 1) << "Groups not currently supported with structure in memory";
+  CHECK_GT(n, 0) << "Positive batch size required";
+
+  batch_info.resize(n);
+  for (unsigned i = 0; i < n; i++) {
+    batch_info[i].mem_center = gfloat3(NAN,NAN,NAN);
+  }
+  top_shape[0] = n;
 }
 
 
@@ -643,6 +730,69 @@ static void apply_jitter(CoordinateSet& c, float jitter) {
   if(ongpu) c.coords.togpu();
 }
 
+//true if a and b hold exactly the same values
+template <typename G>
+static bool same_values(const G& a, const G& b) {
+  if(a.size() != b.size()) return false;
+  const auto *x = a.cpu().data();
+  return std::equal(x, x+a.size(), b.cpu().data());
+}
+
+//true if a and b have identical coordinates, types and radii
+static bool same_atoms(const CoordinateSet& a, const CoordinateSet& b) {
+  if(a.size() != b.size() || a.has_indexed_types() != b.has_indexed_types())
+    return false;
+  if(!same_values(a.coords, b.coords) || !same_values(a.radii, b.radii))
+    return false;
+  if(a.has_indexed_types())
+    return same_values(a.type_index, b.type_index);
+  return same_values(a.type_vector, b.type_vector);
+}
+
+//copy n values between buffers that are both in gpu or both in cpu memory
+template <typename Dtype>
+static void copy_grid_values(const Dtype *src, Dtype *dst, size_t n, bool gpu) {
+  if(gpu)
+    CUDA_CHECK(cudaMemcpy(dst, src, n*sizeof(Dtype), cudaMemcpyDeviceToDevice));
+  else
+    memcpy(dst, src, n*sizeof(Dtype));
+}
+
+//return the cached receptor channels for minfo's receptor and grid center,
+//setting hit; on a miss, an entry is set up for minfo (evicting the oldest
+//if there is one per batch example already) and its values must be filled
+template <typename Dtype>
+typename MolGridDataLayer<Dtype>::receptor_grid& MolGridDataLayer<Dtype>::lookup_receptor_grid(
+    const mol_info& minfo, bool gpu, bool& hit) {
+  const gfloat3& c = minfo.grid_center;
+  for(unsigned i = 0, n = receptor_grids.size(); i < n; i++) {
+    receptor_grid& r = receptor_grids[i];
+    if(r.gpu == gpu && r.center.x == c.x && r.center.y == c.y && r.center.z == c.z &&
+        same_atoms(r.atoms, minfo.orig_rec_atoms)) {
+      hit = true;
+      receptor_grid_hits++;
+      return r;
+    }
+  }
+
+  hit = false;
+  receptor_grid_misses++;
+  unsigned capacity = max((unsigned)batch_info.size(), 1U);
+  unsigned i = receptor_grids.size();
+  if(i < capacity)
+    receptor_grids.push_back(receptor_grid());
+  else
+    i = next_receptor_grid++ % i;
+  receptor_grid& r = receptor_grids[i];
+  r.atoms = minfo.orig_rec_atoms.clone();
+  r.atoms.tocpu();
+  r.center = c;
+  r.gpu = gpu;
+  size_t n = size_t(numgridpoints)*numReceptorTypes;
+  if(r.values.size() != n) r.values = libmolgrid::ManagedGrid<Dtype, 1>(n);
+  return r;
+}
+
 //take a mol info, which includes receptor and ligand atoms
 //and generate the appropriate grids into data
 //applies jitter, peturbation, transformations as needed
@@ -650,7 +800,7 @@ static void apply_jitter(CoordinateSet& c, float jitter) {
 template <typename Dtype>
 void MolGridDataLayer<Dtype>::set_grid_minfo(Dtype *data,
     typename MolGridDataLayer<Dtype>::mol_info& minfo,
-    output_transform& peturb, bool gpu, bool keeptransform)
+    output_transform& peturb, bool gpu, bool keeptransform, int tiles_index)
 {
   const MolGridDataParameter& param = this->layer_param_.molgrid_data_param();
   bool fixcenter = param.fix_center_to_origin();
@@ -712,6 +862,8 @@ void MolGridDataLayer<Dtype>::set_grid_minfo(Dtype *data,
   //set the grid center
   if(fixcenter) {
     minfo.grid_center = gfloat3(0,0,0);
+  } else if(std::isfinite(minfo.mem_center.x)) {
+    minfo.grid_center = minfo.mem_center;
   } else if(std::isfinite(grid_center.x)) {
     minfo.grid_center = grid_center;
   } else {
@@ -724,10 +876,24 @@ void MolGridDataLayer<Dtype>::set_grid_minfo(Dtype *data,
   //slower (50%) and for flexibility I want to keep them separate
   //if the buffer is preallocated and we mergeInto, it's only 10% slower, but still slower
   unsigned dim = gmaker.get_grid_dims().x;
+  size_t recsize = size_t(numgridpoints)*numReceptorTypes;
+
+  //receptor channels only depend on the untransformed receptor and the center
+  //when there is no random transformation, so in memory receptors can be reused
+  receptor_grid *cached = NULL;
+  bool reuse = false;
+  if(inmem && jitter <= 0 && minfo.transform.is_identity())
+    cached = &lookup_receptor_grid(minfo, gpu, reuse);
+
   if (gpu)
   {
     Grid<Dtype, 4, true> recgrid(data, numReceptorTypes, dim, dim, dim);
-    gmaker.forward(minfo.grid_center, rec_atoms, recgrid);
+    if(reuse) {
+      copy_grid_values(cached->values.gpu().data(), data, recsize, true);
+    } else {
+      gmaker.forward(minfo.grid_center, rec_atoms, recgrid);
+      if(cached) copy_grid_values(data, cached->values.gpu().data(), recsize, true);
+    }
     if(!ignore_ligand) {
       Grid<Dtype, 4, true> liggrid(data+numgridpoints*numReceptorTypes, numchannels-numReceptorTypes, dim, dim, dim);
       gmaker.forward(minfo.grid_center, lig_atoms, liggrid);
@@ -736,13 +902,78 @@ void MolGridDataLayer<Dtype>::set_grid_minfo(Dtype *data,
   else
   {
     Grid<Dtype, 4, false> recgrid(data, numReceptorTypes, dim, dim, dim);
-    gmaker.forward(minfo.grid_center, rec_atoms, recgrid);
+    if(reuse) {
+      copy_grid_values(cached->values.cpu().data(), data, recsize, false);
+    } else {
+      gmaker.forward(minfo.grid_center, rec_atoms, recgrid);
+      if(cached) copy_grid_values(data, cached->values.cpu().data(), recsize, false);
+    }
     if(!ignore_ligand) {
       Grid<Dtype, 4, false> liggrid(data+numgridpoints*numReceptorTypes, numchannels-numReceptorTypes, dim, dim, dim);
       gmaker.forward(minfo.grid_center, lig_atoms, liggrid);
     }
   }
 
+  if(cached && !reuse)
+    cached->tiles.clear(); //values changed
+  if(tiles_index >= 0) {
+    //the receptor occupancy is cached with the receptor channels, so only
+    //the ligand channels have to be marked when the receptor is reused
+    size_t rectiles = size_t(tiles.tiles())*numReceptorTypes;
+    if(reuse && cached->tiles.size() == rectiles) {
+      tiles.Set(tiles_index, 0, numReceptorTypes, &cached->tiles[0]);
+    } else {
+      tiles.Scan(tiles_index, 0, numReceptorTypes, data);
+      if(cached) {
+        cached->tiles.resize(rectiles);
+        tiles.Get(tiles_index, 0, numReceptorTypes, &cached->tiles[0]);
+      }
+    }
+    if(ignore_ligand || !lig_atoms.has_indexed_types())
+      tiles.Scan(tiles_index, numReceptorTypes, numchannels-numReceptorTypes, data+recsize);
+    else
+      mark_ligand_tiles(tiles_index, minfo);
+  }
+
+}
+
+//mark the tiles of the ligand channels within the density cutoff of some
+//ligand atom, which is linear in the atoms instead of in the grid points and
+//a superset of the tiles holding density
+template<typename Dtype>
+void MolGridDataLayer<Dtype>::mark_ligand_tiles(int tiles_index, const mol_info& minfo)
+{
+  const MolGridDataParameter& param = this->layer_param_.molgrid_data_param();
+  //gaussian densities are quadratic past the multiple and reach zero at
+  //(1+2g^2)/2g radii, which is also past g if only the gaussian is used
+  float multiple = 1.0;
+  if(!param.binary_occupancy()) {
+    float g = fabs(param.gaussian_radius_multiple());
+    multiple = (1 + 2*g*g)/(2*g);
+  }
+  multiple *= param.radius_scaling();
+
+  float resolution = gmaker.get_resolution();
+  float half = gmaker.get_dimension()/2.0;
+  float origin[3] = {minfo.grid_center.x - half, minfo.grid_center.y - half, minfo.grid_center.z - half};
+  int numligtypes = numchannels-numReceptorTypes;
+
+  const CoordinateSet& atoms = minfo.transformed_lig_atoms;
+  const float *coords = atoms.coords.cpu().data();
+  const float *types = atoms.type_index.cpu().data();
+  const float *radii = atoms.radii.cpu().data();
+  tiles.Clear(tiles_index, numReceptorTypes, numligtypes);
+  for (unsigned i = 0, n = atoms.size(); i < n; i++) {
+    int t = types[i];
+    if(t < 0 || t >= numligtypes) continue; //not gridded
+    float cutoff = radii[i]*multiple;
+    int lo[3], hi[3];
+    for(unsigned j = 0; j < 3; j++) {
+      lo[j] = floor((coords[3*i+j] - cutoff - origin[j])/resolution);
+      hi[j] = ceil((coords[3*i+j] + cutoff - origin[j])/resolution);
+    }
+    tiles.MarkBox(tiles_index, numReceptorTypes+t, lo, hi);
+  }
 }
 
 
@@ -818,51 +1049,55 @@ void MolGridDataLayer<Dtype>::forward(const vector<Blob<Dtype>*>& bottom, const
   {
     CHECK_GT(batch_info.size(), 0) << "Empty batch info";
     CHECK_EQ(group_size, 1) << "Groups not currently supported with structure in memory";
-    if(batch_info[0].orig_rec_atoms.size() == 0) LOG(WARNING) << "Receptor not set in MolGridDataLayer";
-    if(batch_info[0].orig_lig_atoms.size() == 0) LOG(WARNING) << "Ligand not set in MolGridDataLayer";
-    //memory is now available
-    set_grid_minfo(top_data, batch_info[0], peturb, gpu, false);
-    perturbations.push_back(peturb);
+    CHECK_EQ(batch_info.size(), batch_size) << "Inconsistent batch sizes in forward";
+    //the consumers of the grids of a grid source use the tiles of the source
+    bool track = tile_size > 0 && !gpu && !grid_source;
+    if(track) tiles.Reshape(batch_size, numchannels, dim, tile_size);
+    tiles.set_valid(false);
+    if(grid_source) {
+      //another layer has already gridded these examples
+      CHECK_EQ(grid_source->count(), top[0]->count()) << "Shared grids have a different shape";
+      caffe_copy(top[0]->count(), gpu ? grid_source->gpu_data() : grid_source->cpu_data(), top_data);
+      perturbations.assign(batch_size, peturb);
+    } else {
+      //memory is now available
+      for (unsigned i = 0; i < batch_size; i++) {
+        if(batch_info[i].orig_rec_atoms.size() == 0) LOG(WARNING) << "Receptor not set in MolGridDataLayer";
+        if(batch_info[i].orig_lig_atoms.size() == 0) LOG(WARNING) << "Ligand not set in MolGridDataLayer";
+        set_grid_minfo(top_data+i*example_size, batch_info[i], peturb, gpu, false, track ? i : -1);
+        perturbations.push_back(peturb);
+      }
+    }
+    tiles.set_valid(track);
 
     CHECK_GT(labels.size(),0) << "Did not set labels in memory based molgrid";
+    //examples without their own labels share the last one set
+    labels.resize(batch_size, labels.back());
+    affinities.resize(batch_size, affinities.back());
+    rmsds.resize(batch_size, rmsds.back());
   }
   else
   {
-    clearLabels();
-
-    //percent of batch from first data source
-    unsigned dataswitch = batch_size;
-    if (data2.size())
-      dataswitch = batch_size*data_ratio/(data_ratio+1);
-
-    for (int idx = 0, n = chunk_size*batch_size; idx < n; ++idx)
-    {
-      int batch_idx = idx % batch_size;
-      Example ex;
-      if (batch_idx < dataswitch) {
-        data.next(ex);
-      } else {
-        data2.next(ex);
-      }
-
-      int step = idx / batch_size;
-      int offset = ((batch_size * step) + batch_idx) * example_size;
-
-      if(!duplicate) {
-        updateLabels(ex.labels, hasaffinity, hasrmsd, ex.seqcont);
-        set_grid_ex(top_data+offset, ex, batch_info[batch_idx], numposes > 1 ? -1 : 0, peturb, gpu, ex.seqcont);
-        perturbations.push_back(peturb);
-      }
-      else {
-        for(unsigned p = 0; p < numposes; p++) {
-          updateLabels(ex.labels, hasaffinity, hasrmsd, ex.seqcont);
-          int p_offset = batch_idx*(example_size*numposes)+example_size*p;
-          set_grid_ex(top_data+p_offset, ex, batch_info[batch_idx], p, peturb, gpu, ex.seqcont);
-          perturbations.push_back(peturb);
-        }
-      }
+    prefetch_batch *batch = &sync_batch;
+    if(prefetch.size() > 0) {
+      if(prefetch_current) prefetch_free.push(prefetch_current);
+      batch = prefetch_current = prefetch_full.pop("Waiting for molgrid data");
+      //the top blob uses the prefetched grids until the next forward
+      if(gpu)
+        top[0]->set_gpu_data(batch->data.mutable_gpu_data());
+      else
+        top[0]->set_cpu_data(batch->data.mutable_cpu_data());
+    } else {
+      load_batch(top_data, *batch, gpu);
     }
 
+    //the atoms and transformations of the batch are needed by backward
+    batch_info.swap(batch->batch_info);
+    labels.swap(batch->labels);
+    affinities.swap(batch->affinities);
+    rmsds.swap(batch->rmsds);
+    seqcont.swap(batch->seqcont);
+    perturbations.swap(batch->perturbations);
   }
 
   copyToBlobs(top, hasaffinity, hasrmsd, gpu);
@@ -876,6 +1111,94 @@ void MolGridDataLayer<Dtype>::forward(const vector<Blob<Dtype>*>& bottom, const
   }
 }
 
+//read the next batch of examples from the data sources and grid them into data
+template <typename Dtype>
+void MolGridDataLayer<Dtype>::load_batch(Dtype *data, prefetch_batch& batch, bool gpu)
+{
+  layer_rng_scope rngscope(prefetch.empty() ? NULL : &rng);
+  bool hasaffinity = this->layer_param_.molgrid_data_param().has_affinity();
+  bool hasrmsd = this->layer_param_.molgrid_data_param().has_rmsd();
+  bool duplicate = this->layer_param_.molgrid_data_param().duplicate_poses();
+
+  unsigned batch_size;
+  if (group_size>1) {
+    batch_size = top_shape[1];
+  }
+  else
+    batch_size = top_shape[0];
+  if(numposes > 1 && duplicate) batch_size /= numposes;
+
+  batch.batch_info.resize(batch_size);
+  group_transforms.resize(batch_size);
+  for (unsigned i = 0; i < batch_size; i++)
+    batch.batch_info[i].transform = group_transforms[i];
+  batch.labels.clear();
+  batch.affinities.clear();
+  batch.rmsds.clear();
+  batch.seqcont.clear();
+  batch.perturbations.clear();
+  output_transform peturb;
+  float pose = 0, affinity = 0, rmsd = 0;
+
+  //percent of batch from first data source
+  unsigned dataswitch = batch_size;
+  if (data2.size())
+    dataswitch = batch_size*data_ratio/(data_ratio+1);
+
+  for (int idx = 0, n = chunk_size*batch_size; idx < n; ++idx)
+  {
+    int batch_idx = idx % batch_size;
+    Example ex;
+    if (batch_idx < dataswitch) {
+      data.next(ex);
+    } else {
+      data2.next(ex);
+    }
+
+    int step = idx / batch_size;
+    int offset = ((batch_size * step) + batch_idx) * example_size;
+    split_labels(ex.labels, hasaffinity, hasrmsd, pose, affinity, rmsd);
+
+    unsigned ncopies = duplicate ? numposes : 1;
+    for(unsigned p = 0; p < ncopies; p++) {
+      batch.labels.push_back(pose);
+      batch.affinities.push_back(affinity);
+      batch.rmsds.push_back(rmsd);
+      batch.seqcont.push_back(ex.seqcont); //zero for first member of group
+      if(!duplicate) {
+        set_grid_ex(data+offset, ex, batch.batch_info[batch_idx], numposes > 1 ? -1 : 0, peturb, gpu, ex.seqcont);
+      } else {
+        int p_offset = batch_idx*(example_size*numposes)+example_size*p;
+        set_grid_ex(data+p_offset, ex, batch.batch_info[batch_idx], p, peturb, gpu, ex.seqcont);
+      }
+      batch.perturbations.push_back(peturb);
+    }
+  }
+  for (unsigned i = 0; i < batch_size; i++)
+    group_transforms[i] = batch.batch_info[i].transform;
+}
+
+//fill batches ahead of forward until the layer is destroyed
+template <typename Dtype>
+void MolGridDataLayer<Dtype>::InternalThreadEntry()
+{
+  bool gpu = Caffe::mode() == Caffe::GPU;
+  try {
+    while (!must_stop()) {
+      prefetch_batch *batch = prefetch_free.pop();
+      load_batch(gpu ? batch->data.mutable_gpu_data() : batch->data.mutable_cpu_data(), *batch, gpu);
+#ifndef CPU_ONLY
+      if (gpu) CUDA_CHECK(cudaStreamSynchronize(0)); //grids are complete before forward sees them
+#endif
+      prefetch_full.push(batch);
+    }
+  } catch (boost::thread_interrupted&) {
+    // Interrupted exception is expected on shutdown
+  } catch (std::exception& e) {
+    LOG(FATAL) << "Error prefetching molgrid data: " << e.what();
+  }
+}
+
 template <typename Dtype>
 void MolGridDataLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom)
@@ -984,13 +1307,11 @@ void MolGridDataLayer<Dtype>::clearLabels() {
   seqcont.clear();
 }
 
-template <typename Dtype>
-void MolGridDataLayer<Dtype>::updateLabels(const std::vector<float>& l, bool hasaffinity,
-    bool hasrmsd, bool seq_continued) {
-  float pose = 0, affinity = 0, rmsd = 0;
+//caffe has a cannonical ordering of labels
+static void split_labels(const std::vector<float>& l, bool hasaffinity,
+    bool hasrmsd, float& pose, float& affinity, float& rmsd) {
   unsigned n = l.size();
-
-  //caffe has a cannonical ordering of labels
+  pose = affinity = rmsd = 0;
   if (n > 0) {
     pose = l[0];
     if (n > 1) {
@@ -1003,6 +1324,13 @@ void MolGridDataLayer<Dtype>::updateLabels(const std::vector<float>& l, bool has
       }
     }
   }
+}
+
+template <typename Dtype>
+void MolGridDataLayer<Dtype>::updateLabels(const std::vector<float>& l, bool hasaffinity,
+    bool hasrmsd, bool seq_continued) {
+  float pose = 0, affinity = 0, rmsd = 0;
+  split_labels(l, hasaffinity, hasrmsd, pose, affinity, rmsd);
   labels.push_back(pose);
   affinities.push_back(affinity);
   rmsds.push_back(rmsd);
@@ -1046,8 +1374,8 @@ void MolGridDataLayer<Dtype>::copyToBlobs(const vector<Blob<Dtype>*>& top, bool
 //set in memory buffer
 //will apply translate and rotate iff rotate is valid
 template <typename Dtype>
-void MolGridDataLayer<Dtype>::setReceptor(const vector<float3>& coords, const vector<smt>& smtypes, const vec& translate, const qt& rotate ) {
-  CHECK_GT(batch_info.size(), 0) << "Empty batch info in setReceptor";
+void MolGridDataLayer<Dtype>::setReceptor(const vector<float3>& coords, const vector<smt>& smtypes, const vec& translate, const qt& rotate, unsigned mol_idx) {
+  CHECK_LT(mol_idx, batch_info.size()) << "Incorrect batch index in setReceptor";
 
   vector<float> types; types.reserve(smtypes.size());
   vector<float> radii; radii.reserve(smtypes.size());
@@ -1080,14 +1408,15 @@ void MolGridDataLayer<Dtype>::setReceptor(const vector<float3>& coords, const ve
     rectrans.forward(rec, rec);
   }
 
-  batch_info[0].setReceptor(rec);
+  batch_info[mol_idx].setReceptor(rec);
 }
 
 //set in memory buffer, will set grid_Center if it isn't set, but will only overwrite set grid_center if calcCenter
+//in a batch of several examples, each example remembers the center in effect when its ligand was set
 template <typename Dtype>
-void MolGridDataLayer<Dtype>::setLigand(const vector<float3>& coords, const vector<smt>& smtypes, bool calcCenter)  {
+void MolGridDataLayer<Dtype>::setLigand(const vector<float3>& coords, const vector<smt>& smtypes, bool calcCenter, unsigned mol_idx)  {
 
-  CHECK_GT(batch_info.size(), 0) << "Empty batch info in setLigand";
+  CHECK_LT(mol_idx, batch_info.size()) << "Incorrect batch index in setLigand";
 
   vector<float> types; types.reserve(coords.size());
   vector<float> radii; radii.reserve(coords.size());
@@ -1108,12 +1437,14 @@ void MolGridDataLayer<Dtype>::setLigand(const vector<float3>& coords, const vect
   }
 
   CoordinateSet ligatoms(coords, types, radii, ligTypes->num_types());
-  batch_info[0].setLigand(ligatoms);
+  batch_info[mol_idx].setLigand(ligatoms);
 
   if (calcCenter || !isfinite(grid_center[0])) {
-    gfloat3 c = batch_info[0].orig_lig_atoms.center();
+    gfloat3 c = batch_info[mol_idx].orig_lig_atoms.center();
     setGridCenter(vec(c.x,c.y,c.z));
   }
+  if (batch_info.size() > 1)
+    batch_info[mol_idx].mem_center = grid_center;
 }
 
 INSTANTIATE_CLASS(MolGridDataLayer);
@@ -218,6 +218,227 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+bool PoolingLayer<Dtype>::use_input_tiles(const Blob<Dtype>* bottom) const {
+  if (!input_tiles_ || !input_tiles_->valid() || num_spatial_axes_ != 3 ||
+      channel_axis_ != 1 || num_ != input_tiles_->num() ||
+      channels_ != input_tiles_->channels()) {
+    return false;
+  }
+  const PoolingParameter_PoolMethod method = pool();
+  if (method != PoolingParameter_PoolMethod_MAX &&
+      method != PoolingParameter_PoolMethod_AVE) {
+    return false;
+  }
+  const int* kernel_shape = kernel_shape_.cpu_data();
+  const int* pad_data = pad_.cpu_data();
+  const int* stride_data = stride_.cpu_data();
+  const int* input_shape_data = input_shape_.cpu_data();
+  // windows must not straddle tiles
+  for (int i = 0; i < 3; ++i) {
+    if (kernel_shape[i] != stride_data[0] || stride_data[i] != stride_data[0]
+        || pad_data[i] != 0 || input_shape_data[i + 1] != input_tiles_->dim()) {
+      return false;
+    }
+  }
+  return input_tiles_->tile() % stride_data[0] == 0;
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::pool_regions(int n, int c, bool use_tiles) {
+  const int* output_shape_data = output_shape_.cpu_data();
+  pool_region r;
+  regions_.clear();
+  if (!use_tiles) {
+    for (int i = 0; i < 3; ++i) {
+      r.lo[i] = 0;
+      r.hi[i] = output_shape_data[i];
+    }
+    r.empty = false;
+    regions_.push_back(r);
+    return;
+  }
+  const GridTiles& tiles = *input_tiles_;
+  const int step = tiles.tile() / stride_.cpu_data()[0];  // pooled per tile
+  for (int tx = 0; tx < tiles.per_axis(); ++tx) {
+    for (int ty = 0; ty < tiles.per_axis(); ++ty) {
+      for (int tz = 0; tz < tiles.per_axis(); ++tz) {
+        const int t[3] = {tx, ty, tz};
+        bool nonempty_box = true;
+        for (int i = 0; i < 3; ++i) {
+          r.lo[i] = t[i] * step;
+          r.hi[i] = min(r.lo[i] + step, output_shape_data[i]);
+          nonempty_box = nonempty_box && r.lo[i] < r.hi[i];
+        }
+        if (nonempty_box) {
+          r.empty = !tiles.occupied(n, c, tx, ty, tz);
+          regions_.push_back(r);
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::forward_max_3d(const pool_region& r,
+    const Dtype* bottom_data, Dtype* top_data, int* mask, Dtype* top_mask) {
+  const int* kernel_shape = kernel_shape_.cpu_data();
+  const int* pad_data = this->pad_.cpu_data();
+  const int* stride_data = this->stride_.cpu_data();
+  const int* input_shape_data = this->input_shape_.cpu_data();
+  const int* output_shape_data = this->output_shape_.cpu_data();
+  for (int ph = r.lo[0]; ph < r.hi[0]; ++ph) {
+    for (int pw = r.lo[1]; pw < r.hi[1]; ++pw) {
+      for (int pz = r.lo[2]; pz < r.hi[2]; ++pz) {
+        int hstart = ph * stride_data[0] - pad_data[0];
+        int wstart = pw * stride_data[1] - pad_data[1];
+        int zstart = pz * stride_data[2] - pad_data[2];
+        int hend = min(hstart + kernel_shape[0], input_shape_data[1]);
+        int wend = min(wstart + kernel_shape[1], input_shape_data[2]);
+        int zend = min(zstart + kernel_shape[2], input_shape_data[3]);
+        hstart = max(hstart, 0);
+        wstart = max(wstart, 0);
+        zstart = max(zstart, 0);
+        const int pool_index = (ph * output_shape_data[1] + pw)*
+                                          output_shape_data[2] +pz;
+        if (r.empty) {
+          // the first of equal values is the max
+          const int index = (hstart * input_shape_data[2] + wstart)*
+                                          input_shape_data[3]+zstart;
+          top_data[pool_index] = 0;
+          if (top_mask) {
+            top_mask[pool_index] = static_cast<Dtype>(index);
+          } else {
+            mask[pool_index] = index;
+          }
+          continue;
+        }
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            for (int z = zstart; z < zend; ++z) {
+              const int index = (h * input_shape_data[2] + w)*
+                                            input_shape_data[3]+z;
+              if (bottom_data[index] > top_data[pool_index]) {
+                top_data[pool_index] = bottom_data[index];
+                if (top_mask) {
+                  top_mask[pool_index] = static_cast<Dtype>(index);
+                } else {
+                  mask[pool_index] = index;
+                }
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::forward_ave_3d(const pool_region& r,
+    const Dtype* bottom_data, Dtype* top_data) {
+  const int* kernel_shape = kernel_shape_.cpu_data();
+  const int* pad_data = this->pad_.cpu_data();
+  const int* stride_data = this->stride_.cpu_data();
+  const int* input_shape_data = this->input_shape_.cpu_data();
+  const int* output_shape_data = this->output_shape_.cpu_data();
+  for (int ph = r.lo[0]; ph < r.hi[0]; ++ph) {
+    for (int pw = r.lo[1]; pw < r.hi[1]; ++pw) {
+      for (int pz = r.lo[2]; pz < r.hi[2]; ++pz) {
+        int hstart = ph * stride_data[0] - pad_data[0];
+        int wstart = pw * stride_data[1] - pad_data[1];
+        int zstart = pz * stride_data[2] - pad_data[2];
+        int hend = min(hstart + kernel_shape[0],
+                  input_shape_data[1]+ pad_data[0]);
+        int wend = min(wstart + kernel_shape[1],
+                input_shape_data[2]+ pad_data[1]);
+        int zend = min(zstart + kernel_shape[2],
+                 input_shape_data[3]+ pad_data[2]);
+        int pool_size = (hend - hstart) *
+                        (wend - wstart) *
+                        (zend - zstart);
+        hstart = max(hstart, 0);
+        wstart = max(wstart, 0);
+        zstart = max(zstart, 0);
+        hend = min(hend, input_shape_data[1]);
+        wend = min(wend, input_shape_data[2]);
+        zend = min(zend, input_shape_data[3]);
+
+        const int pool_index = (ph * output_shape_data[1] + pw)*
+                                        output_shape_data[2] +pz;
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            for (int z = zstart; z < zend; ++z) {
+              const int index = (h * input_shape_data[2] + w)*
+                                            input_shape_data[3]+z;
+              top_data[pool_index] += bottom_data[index];
+            }
+          }
+        }
+        top_data[pool_index] /= pool_size;
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::backward_max_3d(const pool_region& r,
+    const Dtype* top_diff, const int* mask, const Dtype* top_mask,
+    Dtype* bottom_diff) {
+  const int* output_shape_data = this->output_shape_.cpu_data();
+  for (int ph = r.lo[0]; ph < r.hi[0]; ++ph) {
+    for (int pw = r.lo[1]; pw < r.hi[1]; ++pw) {
+      for (int pz = r.lo[2]; pz < r.hi[2]; ++pz) {
+        const int index = (ph * output_shape_data[1] + pw)*
+                                    output_shape_data[2] +pz;
+        const int bottom_index =
+            top_mask ? top_mask[index] : mask[index];
+        bottom_diff[bottom_index] += top_diff[index];
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::backward_ave_3d(const pool_region& r,
+    const Dtype* top_diff, Dtype* bottom_diff) {
+  const int* kernel_shape = this->kernel_shape_.cpu_data();
+  const int* pad_data = this->pad_.cpu_data();
+  const int* stride_data = this->stride_.cpu_data();
+  const int* input_shape_data = this->input_shape_.cpu_data();
+  const int* output_shape_data = this->output_shape_.cpu_data();
+  for (int ph = r.lo[0]; ph < r.hi[0]; ++ph) {
+    for (int pw = r.lo[1]; pw < r.hi[1]; ++pw) {
+      for (int pz = r.lo[2]; pz < r.hi[2]; ++pz) {
+        int hstart = ph * stride_data[0] - pad_data[0];
+        int wstart = pw * stride_data[1] - pad_data[1];
+        int zstart = pz * stride_data[2] - pad_data[2];
+        int hend = min(hstart + kernel_shape[0], input_shape_data[1]);
+        int wend = min(wstart + kernel_shape[1], input_shape_data[2]);
+        int zend = min(zstart + kernel_shape[2], input_shape_data[3]);
+        hstart = max(hstart, 0);
+        wstart = max(wstart, 0);
+        zstart = max(zstart, 0);
+        const int pool_index = (ph * output_shape_data[1] + pw)*
+                                          output_shape_data[2] +pz;
+        int pool_size = (hend - hstart) *
+                        (wend - wstart) *
+                        (zend - zstart);
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            for (int z = zstart; z < zend; ++z) {
+              const int index = (h * input_shape_data[2] + w)*
+                                            input_shape_data[3]+z;
+              bottom_diff[index] +=
+                            top_diff[pool_index] / pool_size;
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
 // TODO(Yangqing): Is there a faster way to do pooling in the channel-first
 // case?
 template <typename Dtype>
@@ -240,6 +461,7 @@ void PoolingLayer<Dtype>::Forward_cpu(
   const int* stride_data = this->stride_.cpu_data();
   const int* input_shape_data = this->input_shape_.cpu_data();
   const int* output_shape_data = this->output_shape_.cpu_data();
+  const bool use_tiles = use_input_tiles(bottom[0]);
 
   // Different pooling methods. We explicitly do the switch outside the for
   // loop to save time, although this results in more code.
@@ -284,38 +506,9 @@ void PoolingLayer<Dtype>::Forward_cpu(
             }
           }
         } else if (num_spatial_axes_ == 3) {
-          for (int ph = 0; ph < output_shape_data[0]; ++ph) {
-            for (int pw = 0; pw < output_shape_data[1]; ++pw) {
-              for (int pz = 0; pz< output_shape_data[2]; ++pz) {
-                int hstart = ph * stride_data[0] - pad_data[0];
-                int wstart = pw * stride_data[1] - pad_data[1];
-                int zstart = pz * stride_data[2] - pad_data[2];
-                int hend = min(hstart + kernel_shape[0], input_shape_data[1]);
-                int wend = min(wstart + kernel_shape[1], input_shape_data[2]);
-                int zend = min(zstart + kernel_shape[2], input_shape_data[3]);
-                hstart = max(hstart, 0);
-                wstart = max(wstart, 0);
-                zstart = max(zstart, 0);
-                const int pool_index = (ph * output_shape_data[1] + pw)*
-                                                  output_shape_data[2] +pz;
-                for (int h = hstart; h < hend; ++h) {
-                  for (int w = wstart; w < wend; ++w) {
-                    for (int z = zstart; z < zend; ++z) {
-                      const int index = (h * input_shape_data[2] + w)*
-                                                    input_shape_data[3]+z;
-                      if (bottom_data[index] > top_data[pool_index]) {
-                        top_data[pool_index] = bottom_data[index];
-                        if (use_top_mask) {
-                          top_mask[pool_index] = static_cast<Dtype>(index);
-                        } else {
-                          mask[pool_index] = index;
-                        }
-                      }
-                    }
-                  }
-                }
-              }
-            }
+          pool_regions(n, c, use_tiles);
+          for (int r = 0; r < regions_.size(); ++r) {
+            forward_max_3d(regions_[r], bottom_data, top_data, mask, top_mask);
           }
         } else {
           NOT_IMPLEMENTED;
@@ -366,43 +559,13 @@ void PoolingLayer<Dtype>::Forward_cpu(
               }
             }
         } else if (num_spatial_axes_ == 3) {
-            for (int ph = 0; ph < output_shape_data[0]; ++ph) {
-              for (int pw = 0; pw < output_shape_data[1]; ++pw) {
-                for (int pz = 0; pz< output_shape_data[2]; ++pz) {
-                  int hstart = ph * stride_data[0] - pad_data[0];
-                  int wstart = pw * stride_data[1] - pad_data[1];
-                  int zstart = pz * stride_data[2] - pad_data[2];
-                  int hend = min(hstart + kernel_shape[0],
-                            input_shape_data[1]+ pad_data[0]);
-                  int wend = min(wstart + kernel_shape[1],
-                          input_shape_data[2]+ pad_data[1]);
-                  int zend = min(zstart + kernel_shape[2],
-                           input_shape_data[3]+ pad_data[2]);
-                  int pool_size = (hend - hstart) *
-                                  (wend - wstart) *
-                                  (zend - zstart);
-                  hstart = max(hstart, 0);
-                  wstart = max(wstart, 0);
-                  zstart = max(zstart, 0);
-                  hend = min(hend, input_shape_data[1]);
-                  wend = min(wend, input_shape_data[2]);
-                  zend = min(zend, input_shape_data[3]);
-
-                  const int pool_index = (ph * output_shape_data[1] + pw)*
-                                                  output_shape_data[2] +pz;
-                  for (int h = hstart; h < hend; ++h) {
-                    for (int w = wstart; w < wend; ++w) {
-                      for (int z = zstart; z < zend; ++z) {
-                        const int index = (h * input_shape_data[2] + w)*
-                                                      input_shape_data[3]+z;
-                        top_data[pool_index] += bottom_data[index];
-                      }
-                    }
-                  }
-                  top_data[pool_index] /= pool_size;
-                }
-              }
+          // the pooled values of empty regions are already zero
+          pool_regions(n, c, use_tiles);
+          for (int r = 0; r < regions_.size(); ++r) {
+            if (!regions_[r].empty) {
+              forward_ave_3d(regions_[r], bottom_data, top_data);
             }
+          }
         } else {
           NOT_IMPLEMENTED;
         }
@@ -420,6 +583,12 @@ void PoolingLayer<Dtype>::Forward_cpu(
   default:
     LOG(FATAL) << "Unknown pooling method.";
   }
+  if (use_tiles) {
+    output_tiles_.Downsample(*input_tiles_, stride_data[0],
+        output_shape_data[0]);
+  } else {
+    output_tiles_.set_valid(false);
+  }
 }
 
 template <typename Dtype>
@@ -444,6 +613,7 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   const int* input_shape_data = this->input_shape_.cpu_data();
   const int* output_shape_data = this->output_shape_.cpu_data();
   int top_num = top[0]->count(0, channel_axis_);
+  const bool use_tiles = sparse_backward_ && use_input_tiles(bottom[0]);
   vector<int> offset(2, 0);
   offset[1] = 1;
   switch (this->layer_param_.pooling_param().pool()) {
@@ -466,15 +636,11 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
             }
           }
         } else if (num_spatial_axes_ == 3) {
-            for (int ph = 0; ph < output_shape_data[0]; ++ph) {
-              for (int pw = 0; pw < output_shape_data[1]; ++pw) {
-                for (int pz = 0; pz < output_shape_data[2]; ++pz) {
-                const int index = (ph * output_shape_data[1] + pw)*
-                                            output_shape_data[2] +pz;
-                const int bottom_index =
-                    use_top_mask ? top_mask[index] : mask[index];
-                bottom_diff[bottom_index] += top_diff[index];
-              }
+          pool_regions(n, c, use_tiles);
+          for (int r = 0; r < regions_.size(); ++r) {
+            if (!regions_[r].empty) {
+              backward_max_3d(regions_[r], top_diff, mask, top_mask,
+                  bottom_diff);
             }
           }
         } else {
@@ -524,36 +690,12 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
             }
           }
         } else if (num_spatial_axes_ == 3) {
-            for (int ph = 0; ph < output_shape_data[0]; ++ph) {
-              for (int pw = 0; pw < output_shape_data[1]; ++pw) {
-                for (int pz = 0; pz< output_shape_data[2]; ++pz) {
-                  int hstart = ph * stride_data[0] - pad_data[0];
-                  int wstart = pw * stride_data[1] - pad_data[1];
-                  int zstart = pz * stride_data[2] - pad_data[2];
-                  int hend = min(hstart + kernel_shape[0], input_shape_data[1]);
-                  int wend = min(wstart + kernel_shape[1], input_shape_data[2]);
-                  int zend = min(zstart + kernel_shape[2], input_shape_data[3]);
-                  hstart = max(hstart, 0);
-                  wstart = max(wstart, 0);
-                  zstart = max(zstart, 0);
-                  const int pool_index = (ph * output_shape_data[1] + pw)*
-                                                    output_shape_data[2] +pz;
-                  int pool_size = (hend - hstart) *
-                                  (wend - wstart) *
-                                  (zend - zstart);
-                  for (int h = hstart; h < hend; ++h) {
-                    for (int w = wstart; w < wend; ++w) {
-                      for (int z = zstart; z < zend; ++z) {
-                        const int index = (h * input_shape_data[2] + w)*
-                                                      input_shape_data[3]+z;
-                        bottom_diff[index] +=
-                                      top_diff[pool_index] / pool_size;
-                      }
-                    }
-                  }
-                }
-              }
+          pool_regions(n, c, use_tiles);
+          for (int r = 0; r < regions_.size(); ++r) {
+            if (!regions_[r].empty) {
+              backward_ave_3d(regions_[r], top_diff, bottom_diff);
             }
+          }
         } else {
           NOT_IMPLEMENTED;
         }
@@ -0,0 +1,198 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layer_factory.hpp"
+#include "caffe/layers/conv_layer.hpp"
+#include "caffe/layers/direct_conv_layer.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class DirectConvolutionLayerTest : public CPUDeviceTest<Dtype> {
+ protected:
+  DirectConvolutionLayerTest()
+      : blob_bottom_(new Blob<Dtype>()),
+        blob_top_(new Blob<Dtype>()),
+        ref_blob_bottom_(new Blob<Dtype>()),
+        ref_blob_top_(new Blob<Dtype>()) {
+    Caffe::set_random_seed(1701);
+    vector<int> bottom_shape(5);
+    bottom_shape[0] = 2;
+    bottom_shape[1] = 3;
+    bottom_shape[2] = 6;
+    bottom_shape[3] = 7;
+    bottom_shape[4] = 9;
+    blob_bottom_->Reshape(bottom_shape);
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    ref_blob_bottom_->CopyFrom(*blob_bottom_, false, true);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    ref_blob_bottom_vec_.push_back(ref_blob_bottom_);
+    ref_blob_top_vec_.push_back(ref_blob_top_);
+  }
+  virtual ~DirectConvolutionLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete ref_blob_bottom_;
+    delete ref_blob_top_;
+  }
+
+  // run the direct and the im2col layer with the same weights and compare
+  // outputs and all gradients
+  void CompareWithIm2col(const LayerParameter& layer_param) {
+    DirectConvolutionLayer<Dtype> layer(layer_param);
+    ConvolutionLayer<Dtype> ref_layer(layer_param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    ref_layer.SetUp(ref_blob_bottom_vec_, ref_blob_top_vec_);
+    ASSERT_EQ(layer.blobs().size(), ref_layer.blobs().size());
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      ref_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+    }
+    layer.Forward(blob_bottom_vec_, blob_top_vec_);
+    ref_layer.Forward(ref_blob_bottom_vec_, ref_blob_top_vec_);
+    ASSERT_EQ(blob_top_->count(), ref_blob_top_->count());
+    const Dtype* top_data = blob_top_->cpu_data();
+    const Dtype* ref_top_data = ref_blob_top_->cpu_data();
+    for (int i = 0; i < blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+    }
+
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_top_);
+    caffe_copy(blob_top_->count(), blob_top_->cpu_data(),
+        ref_blob_top_->mutable_cpu_diff());
+    caffe_copy(blob_top_->count(), blob_top_->cpu_data(),
+        blob_top_->mutable_cpu_diff());
+    vector<bool> propagate_down(1, true);
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      caffe_set(layer.blobs()[i]->count(), Dtype(0),
+          layer.blobs()[i]->mutable_cpu_diff());
+      caffe_set(ref_layer.blobs()[i]->count(), Dtype(0),
+          ref_layer.blobs()[i]->mutable_cpu_diff());
+    }
+    layer.Backward(blob_top_vec_, propagate_down, blob_bottom_vec_);
+    ref_layer.Backward(ref_blob_top_vec_, propagate_down,
+        ref_blob_bottom_vec_);
+    const Dtype* bottom_diff = blob_bottom_->cpu_diff();
+    const Dtype* ref_bottom_diff = ref_blob_bottom_->cpu_diff();
+    for (int i = 0; i < blob_bottom_->count(); ++i) {
+      EXPECT_NEAR(bottom_diff[i], ref_bottom_diff[i], 1e-4);
+    }
+    for (int b = 0; b < layer.blobs().size(); ++b) {
+      const Dtype* diff = layer.blobs()[b]->cpu_diff();
+      const Dtype* ref_diff = ref_layer.blobs()[b]->cpu_diff();
+      for (int i = 0; i < layer.blobs()[b]->count(); ++i) {
+        EXPECT_NEAR(diff[i], ref_diff[i], 1e-3);
+      }
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const ref_blob_bottom_;
+  Blob<Dtype>* const ref_blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  vector<Blob<Dtype>*> ref_blob_bottom_vec_;
+  vector<Blob<Dtype>*> ref_blob_top_vec_;
+};
+
+TYPED_TEST_CASE(DirectConvolutionLayerTest, TestDtypes);
+
+TYPED_TEST(DirectConvolutionLayerTest, TestPadded) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  // not a multiple of the output channel block
+  convolution_param->set_num_output(11);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->CompareWithIm2col(layer_param);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestStrided) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->add_pad(2);
+  convolution_param->set_num_output(4);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->CompareWithIm2col(layer_param);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestAnisotropicNoBias) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(2);
+  convolution_param->add_kernel_size(1);
+  convolution_param->add_kernel_size(4);
+  convolution_param->add_stride(1);
+  convolution_param->add_stride(2);
+  convolution_param->add_stride(3);
+  convolution_param->set_num_output(9);
+  convolution_param->set_bias_term(false);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  this->CompareWithIm2col(layer_param);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestGradient) {
+  typedef TypeParam Dtype;
+  // the exhaustive check is quadratic in the blob sizes, so keep them small
+  vector<int> bottom_shape(5);
+  bottom_shape[0] = 1;
+  bottom_shape[1] = 2;
+  bottom_shape[2] = 3;
+  bottom_shape[3] = 4;
+  bottom_shape[4] = 5;
+  this->blob_bottom_->Reshape(bottom_shape);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_stride(2);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  DirectConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(DirectConvolutionLayerTest, TestEngines) {
+  // the direct engine is only used when asked for
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  layer_param.set_type("Convolution");
+  layer_param.mutable_convolution_param()->add_kernel_size(3);
+  layer_param.mutable_convolution_param()->set_num_output(2);
+  shared_ptr<Layer<Dtype> > layer =
+      LayerRegistry<Dtype>::CreateLayer(layer_param);
+  EXPECT_FALSE(dynamic_cast<DirectConvolutionLayer<Dtype>*>(layer.get()));
+  layer_param.mutable_convolution_param()->set_engine(
+      ConvolutionParameter_Engine_DIRECT);
+  layer = LayerRegistry<Dtype>::CreateLayer(layer_param);
+  EXPECT_TRUE(dynamic_cast<DirectConvolutionLayer<Dtype>*>(layer.get()));
+}
+
+}  // namespace caffe
@@ -67,6 +67,25 @@ TYPED_TEST(ConstantFillerTest, TestFill5D) {
 }
 
 
+template <typename Dtype>
+class NoneFillerTest : public ::testing::Test {};
+
+TYPED_TEST_CASE(NoneFillerTest, TestDtypes);
+
+TYPED_TEST(NoneFillerTest, TestFill) {
+  // the blob is only allocated, and zeroed, once it is read
+  FillerParameter filler_param;
+  filler_param.set_type("none");
+  shared_ptr<Filler<TypeParam> > filler(GetFiller<TypeParam>(filler_param));
+  Blob<TypeParam> blob(2, 3, 4, 5);
+  filler->Fill(&blob);
+  EXPECT_EQ(blob.data()->head(), SyncedMemory::UNINITIALIZED);
+  const TypeParam* data = blob.cpu_data();
+  for (int i = 0; i < blob.count(); ++i) {
+    EXPECT_EQ(data[i], 0);
+  }
+}
+
 template <typename Dtype>
 class UniformFillerTest : public ::testing::Test {
  protected:
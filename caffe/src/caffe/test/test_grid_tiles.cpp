@@ -0,0 +1,248 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/layers/direct_conv_layer.hpp"
+#include "caffe/layers/pooling_layer.hpp"
+#include "caffe/util/grid_tiles.hpp"
+#include "caffe/util/math_functions.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename Dtype>
+class GridTilesTest : public CPUDeviceTest<Dtype> {
+ protected:
+  GridTilesTest()
+      : blob_bottom_(new Blob<Dtype>()),
+        blob_top_(new Blob<Dtype>()),
+        ref_blob_bottom_(new Blob<Dtype>()),
+        ref_blob_top_(new Blob<Dtype>()),
+        dim_(16),
+        tile_(4) {
+    Caffe::set_random_seed(1701);
+    vector<int> shape(5);
+    shape[0] = 2;
+    shape[1] = 3;
+    shape[2] = shape[3] = shape[4] = dim_;
+    blob_bottom_->Reshape(shape);
+    // a few occupied boxes in otherwise empty grids, like atom densities
+    FillerParameter filler_param;
+    UniformFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_);
+    Dtype* data = blob_bottom_->mutable_cpu_data();
+    for (int i = 0; i < blob_bottom_->count(); ++i) {
+      const int z = i % dim_, y = i / dim_ % dim_, x = i / dim_ / dim_ % dim_;
+      const int c = i / (dim_ * dim_ * dim_);
+      if (!(x >= c && x < c + 3 && y >= 5 && y < 7 && z >= 2 * c + 1)) {
+        data[i] = 0;
+      }
+    }
+    ref_blob_bottom_->CopyFrom(*blob_bottom_, false, true);
+    tiles_.Reshape(shape[0], shape[1], dim_, tile_);
+    const int example = shape[1] * dim_ * dim_ * dim_;
+    for (int n = 0; n < shape[0]; ++n) {
+      tiles_.Scan(n, 0, shape[1], data + n * example);
+    }
+    tiles_.set_valid(true);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+    ref_blob_bottom_vec_.push_back(ref_blob_bottom_);
+    ref_blob_top_vec_.push_back(ref_blob_top_);
+  }
+  virtual ~GridTilesTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+    delete ref_blob_bottom_;
+    delete ref_blob_top_;
+  }
+
+  bool BottomOccupied(int i) const {
+    const int z = i % dim_, y = i / dim_ % dim_, x = i / dim_ / dim_ % dim_;
+    const int c = i / (dim_ * dim_ * dim_) % blob_bottom_->shape(1);
+    const int n = i / (dim_ * dim_ * dim_ * blob_bottom_->shape(1));
+    return tiles_.occupied(n, c, x / tile_, y / tile_, z / tile_);
+  }
+
+  // pool with and without tiles and compare, the bottom diffs of a sparse
+  // backward only where they are propagated with tiles
+  void TestPooling(PoolingParameter_PoolMethod method) {
+    LayerParameter layer_param;
+    PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+    pooling_param->add_kernel_size(2);
+    pooling_param->add_stride(2);
+    pooling_param->set_pool(method);
+    PoolingLayer<Dtype> layer(layer_param);
+    PoolingLayer<Dtype> ref_layer(layer_param);
+    layer.SetInputTiles(&tiles_);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    ref_layer.SetUp(ref_blob_bottom_vec_, ref_blob_top_vec_);
+    layer.Forward(blob_bottom_vec_, blob_top_vec_);
+    ref_layer.Forward(ref_blob_bottom_vec_, ref_blob_top_vec_);
+    const Dtype* top_data = blob_top_->cpu_data();
+    const Dtype* ref_top_data = ref_blob_top_->cpu_data();
+    for (int i = 0; i < blob_top_->count(); ++i) {
+      EXPECT_EQ(top_data[i], ref_top_data[i]);
+    }
+    EXPECT_TRUE(layer.output_tiles()->valid());
+    EXPECT_EQ(layer.output_tiles()->tile(), tile_ / 2);
+    EXPECT_EQ(layer.output_tiles()->dim(), dim_ / 2);
+
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(ref_blob_top_);
+    caffe_copy(blob_top_->count(), ref_blob_top_->cpu_data(),
+        ref_blob_top_->mutable_cpu_diff());
+    caffe_copy(blob_top_->count(), ref_blob_top_->cpu_data(),
+        blob_top_->mutable_cpu_diff());
+    vector<bool> propagate_down(1, true);
+    ref_layer.Backward(ref_blob_top_vec_, propagate_down, ref_blob_bottom_vec_);
+    const Dtype* ref_bottom_diff = ref_blob_bottom_->cpu_diff();
+    layer.Backward(blob_top_vec_, propagate_down, blob_bottom_vec_);
+    const Dtype* bottom_diff = blob_bottom_->cpu_diff();
+    for (int i = 0; i < blob_bottom_->count(); ++i) {
+      EXPECT_EQ(bottom_diff[i], ref_bottom_diff[i]);
+    }
+    layer.SetSparseBackward(true);
+    layer.Backward(blob_top_vec_, propagate_down, blob_bottom_vec_);
+    bottom_diff = blob_bottom_->cpu_diff();
+    for (int i = 0; i < blob_bottom_->count(); ++i) {
+      if (BottomOccupied(i)) {
+        EXPECT_EQ(bottom_diff[i], ref_bottom_diff[i]);
+      } else {
+        EXPECT_EQ(bottom_diff[i], 0);
+      }
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  Blob<Dtype>* const ref_blob_bottom_;
+  Blob<Dtype>* const ref_blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+  vector<Blob<Dtype>*> ref_blob_bottom_vec_;
+  vector<Blob<Dtype>*> ref_blob_top_vec_;
+  GridTiles tiles_;
+  const int dim_;
+  const int tile_;
+};
+
+TYPED_TEST_CASE(GridTilesTest, TestDtypes);
+
+TYPED_TEST(GridTilesTest, TestScan) {
+  // channel c is nonzero in x [c, c + 3), y [5, 7), z [2c + 1, 16)
+  const GridTiles& tiles = this->tiles_;
+  EXPECT_EQ(tiles.per_axis(), 4);
+  for (int c = 0; c < 3; ++c) {
+    for (int tx = 0; tx < 4; ++tx) {
+      for (int ty = 0; ty < 4; ++ty) {
+        for (int tz = 0; tz < 4; ++tz) {
+          const bool expected = tx * 4 < c + 3 && tx * 4 + 4 > c && ty == 1
+              && tz * 4 + 4 > 2 * c + 1;
+          EXPECT_EQ(tiles.occupied(1, c, tx, ty, tz), expected);
+        }
+      }
+    }
+    EXPECT_TRUE(tiles.row_occupied(0, c, c, 5));
+    EXPECT_FALSE(tiles.row_occupied(0, c, c, 8));
+  }
+}
+
+TYPED_TEST(GridTilesTest, TestMarkBox) {
+  // boxes mark every tile they overlap and are clipped to the grid
+  GridTiles tiles;
+  tiles.Reshape(1, 2, 16, 4);
+  tiles.Clear(0, 0, 2);
+  const int lo[3] = {3, -2, 7}, hi[3] = {4, 1, 20};
+  tiles.MarkBox(0, 1, lo, hi);
+  const int outside_lo[3] = {-5, 0, 0}, outside_hi[3] = {-1, 15, 15};
+  tiles.MarkBox(0, 1, outside_lo, outside_hi);
+  for (int c = 0; c < 2; ++c) {
+    for (int tx = 0; tx < 4; ++tx) {
+      for (int ty = 0; ty < 4; ++ty) {
+        for (int tz = 0; tz < 4; ++tz) {
+          const bool expected = c == 1 && tx <= 1 && ty == 0 && tz >= 1;
+          EXPECT_EQ(tiles.occupied(0, c, tx, ty, tz), expected);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(GridTilesTest, TestMaxPooling) {
+  this->TestPooling(PoolingParameter_PoolMethod_MAX);
+}
+
+TYPED_TEST(GridTilesTest, TestAvePooling) {
+  this->TestPooling(PoolingParameter_PoolMethod_AVE);
+}
+
+TYPED_TEST(GridTilesTest, TestConvolution) {
+  typedef TypeParam Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->add_kernel_size(3);
+  convolution_param->add_pad(1);
+  convolution_param->set_num_output(5);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  DirectConvolutionLayer<Dtype> layer(layer_param);
+  DirectConvolutionLayer<Dtype> ref_layer(layer_param);
+  layer.SetInputTiles(&this->tiles_);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  ref_layer.SetUp(this->ref_blob_bottom_vec_, this->ref_blob_top_vec_);
+  for (int i = 0; i < layer.blobs().size(); ++i) {
+    ref_layer.blobs()[i]->CopyFrom(*layer.blobs()[i]);
+  }
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  ref_layer.Forward(this->ref_blob_bottom_vec_, this->ref_blob_top_vec_);
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-5);
+  }
+
+  caffe_set(this->blob_top_->count(), Dtype(1),
+      this->blob_top_->mutable_cpu_diff());
+  caffe_set(this->blob_top_->count(), Dtype(1),
+      this->ref_blob_top_->mutable_cpu_diff());
+  for (int i = 0; i < ref_layer.blobs().size(); ++i) {
+    caffe_set(ref_layer.blobs()[i]->count(), Dtype(0),
+        ref_layer.blobs()[i]->mutable_cpu_diff());
+  }
+  vector<bool> propagate_down(1, true);
+  ref_layer.Backward(this->ref_blob_top_vec_, propagate_down,
+      this->ref_blob_bottom_vec_);
+  const Dtype* ref_bottom_diff = this->ref_blob_bottom_->cpu_diff();
+  // backward is dense unless sparse backward is enabled
+  for (int sparse = 0; sparse < 2; ++sparse) {
+    layer.SetSparseBackward(sparse);
+    for (int i = 0; i < layer.blobs().size(); ++i) {
+      caffe_set(layer.blobs()[i]->count(), Dtype(0),
+          layer.blobs()[i]->mutable_cpu_diff());
+    }
+    layer.Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+    const Dtype* bottom_diff = this->blob_bottom_->cpu_diff();
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      if (!sparse || this->BottomOccupied(i)) {
+        EXPECT_NEAR(bottom_diff[i], ref_bottom_diff[i], 1e-5);
+      }
+    }
+    for (int b = 0; b < layer.blobs().size(); ++b) {
+      const Dtype* diff = layer.blobs()[b]->cpu_diff();
+      const Dtype* ref_diff = ref_layer.blobs()[b]->cpu_diff();
+      for (int i = 0; i < layer.blobs()[b]->count(); ++i) {
+        EXPECT_NEAR(diff[i], ref_diff[i], 1e-4);
+      }
+    }
+  }
+}
+
+}  // namespace caffe
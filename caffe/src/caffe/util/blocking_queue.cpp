@@ -2,6 +2,7 @@
 #include <string>
 
 #include "caffe/layers/base_data_layer.hpp"
+#include "caffe/layers/molgrid_data_layer.hpp"
 #include "caffe/parallel.hpp"
 #include "caffe/util/blocking_queue.hpp"
 
@@ -87,6 +88,8 @@ size_t BlockingQueue<T>::size() const {
 
 template class BlockingQueue<Batch<float>*>;
 template class BlockingQueue<Batch<double>*>;
+template class BlockingQueue<MolGridDataLayer<float>::prefetch_batch*>;
+template class BlockingQueue<MolGridDataLayer<double>::prefetch_batch*>;
 //template class BlockingQueue<P2PSync<float>*>;
 //template class BlockingQueue<P2PSync<double>*>;
 
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <cstring>
+
+#include "caffe/common.hpp"
+#include "caffe/util/grid_tiles.hpp"
+
+namespace caffe {
+
+void GridTiles::Reshape(int num, int channels, int dim, int tile) {
+  CHECK_GT(tile, 0) << "Tiles need a positive size";
+  num_ = num;
+  channels_ = channels;
+  dim_ = dim;
+  tile_ = tile;
+  per_axis_ = (dim + tile - 1) / tile;
+  flags_.resize(static_cast<size_t>(num) * channels * tiles());
+}
+
+template <typename Dtype>
+void GridTiles::Scan(int n, int first, int count, const Dtype* grid) {
+  const int plane = dim_ * dim_;
+  for (int c = 0; c < count; ++c) {
+    const Dtype* values = grid + static_cast<size_t>(c) * plane * dim_;
+    char* flags = &flags_[(static_cast<size_t>(n) * channels_ + first + c)
+        * tiles()];
+    for (int tx = 0; tx < per_axis_; ++tx) {
+      const int x0 = tx * tile_, x1 = std::min(x0 + tile_, dim_);
+      for (int ty = 0; ty < per_axis_; ++ty) {
+        const int y0 = ty * tile_, y1 = std::min(y0 + tile_, dim_);
+        for (int tz = 0; tz < per_axis_; ++tz) {
+          const int z0 = tz * tile_, z1 = std::min(z0 + tile_, dim_);
+          // occupied tiles are usually recognized by their first values
+          bool occupied = false;
+          for (int x = x0; x < x1 && !occupied; ++x) {
+            for (int y = y0; y < y1 && !occupied; ++y) {
+              const Dtype* row = values + x * plane + y * dim_;
+              for (int z = z0; z < z1; ++z) {
+                if (row[z] != 0) {
+                  occupied = true;
+                  break;
+                }
+              }
+            }
+          }
+          *flags++ = occupied;
+        }
+      }
+    }
+  }
+}
+
+template void GridTiles::Scan<float>(int n, int first, int count,
+    const float* grid);
+template void GridTiles::Scan<double>(int n, int first, int count,
+    const double* grid);
+
+void GridTiles::Clear(int n, int first, int count) {
+  memset(&flags_[(static_cast<size_t>(n) * channels_ + first) * tiles()], 0,
+      static_cast<size_t>(count) * tiles());
+}
+
+void GridTiles::MarkBox(int n, int c, const int lo[3], const int hi[3]) {
+  int t0[3], t1[3];
+  for (int i = 0; i < 3; ++i) {
+    const int x0 = std::max(lo[i], 0), x1 = std::min(hi[i], dim_ - 1);
+    if (x0 > x1) {
+      return;  // outside of the grid
+    }
+    t0[i] = x0 / tile_;
+    t1[i] = x1 / tile_;
+  }
+  char* flags = &flags_[(static_cast<size_t>(n) * channels_ + c) * tiles()];
+  for (int tx = t0[0]; tx <= t1[0]; ++tx) {
+    for (int ty = t0[1]; ty <= t1[1]; ++ty) {
+      char* row = flags + (tx * per_axis_ + ty) * per_axis_;
+      memset(row + t0[2], 1, t1[2] - t0[2] + 1);
+    }
+  }
+}
+
+void GridTiles::Get(int n, int first, int count, char* flags) const {
+  memcpy(flags, &flags_[(static_cast<size_t>(n) * channels_ + first)
+      * tiles()], static_cast<size_t>(count) * tiles());
+}
+
+void GridTiles::Set(int n, int first, int count, const char* flags) {
+  memcpy(&flags_[(static_cast<size_t>(n) * channels_ + first) * tiles()],
+      flags, static_cast<size_t>(count) * tiles());
+}
+
+void GridTiles::Downsample(const GridTiles& src, int factor, int out_dim) {
+  valid_ = false;
+  if (src.tile_ % factor != 0) {
+    return;
+  }
+  num_ = src.num_;
+  channels_ = src.channels_;
+  dim_ = out_dim;
+  tile_ = src.tile_ / factor;
+  per_axis_ = (out_dim + tile_ - 1) / tile_;
+  if (per_axis_ != src.per_axis_) {
+    return;
+  }
+  flags_ = src.flags_;
+  valid_ = src.valid_;
+}
+
+bool GridTiles::row_occupied(int n, int c, int x, int y) const {
+  const char* flags = &flags_[(static_cast<size_t>(n) * channels_ + c)
+      * tiles() + ((x / tile_) * per_axis_ + y / tile_) * per_axis_];
+  for (int tz = 0; tz < per_axis_; ++tz) {
+    if (flags[tz]) {
+      return true;
+    }
+  }
+  return false;
+}
+
+}  // namespace caffe
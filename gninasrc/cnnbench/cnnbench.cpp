@@ -0,0 +1,155 @@
+/*
+ * cnnbench.cpp
+ *
+ * Time CPU inference (forward and backward to the grid) of the built-in
+ * models with the im2col and the direct convolution engines.  Grids are
+ * filled with random values, so only the timings and the agreement of the
+ * two engines are meaningful.
+ */
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <random>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <cmath>
+
+#include "caffe/caffe.hpp"
+#include "caffe/proto/caffe.pb.h"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/upgrade_proto.hpp"
+#include <google/protobuf/io/coded_stream.h>
+#include <google/protobuf/io/zero_copy_stream_impl.h>
+#include <google/protobuf/text_format.h>
+
+#include "cnn_data.h"
+
+using namespace caffe;
+using namespace std;
+
+typedef float Dtype;
+typedef std::chrono::steady_clock bench_clock;
+
+struct bench_result {
+    double forward; //ms per iteration
+    double backward;
+    vector<Dtype> outputs;
+};
+
+static double elapsed_ms(bench_clock::time_point start, unsigned iterations) {
+  return std::chrono::duration<double, std::milli>(bench_clock::now() - start).count()
+      / iterations;
+}
+
+static bench_result run(const NetParameter& model, const NetParameter& weights,
+    ConvolutionParameter_Engine engine, unsigned iterations) {
+  NetParameter param(model);
+  for (int i = 0, n = param.layer_size(); i < n; i++) {
+    if (param.layer(i).type() == "Convolution")
+      param.mutable_layer(i)->mutable_convolution_param()->set_engine(engine);
+  }
+  Net<Dtype> net(param);
+  net.CopyTrainedLayersFrom(weights);
+
+  //same pseudo-random grid for every engine
+  std::mt19937 gen(0);
+  std::uniform_real_distribution<Dtype> dist(0, 1);
+  const vector<Blob<Dtype>*>& tops = net.top_vecs()[0];
+  Dtype *data = tops[0]->mutable_cpu_data();
+  for (int i = 0, n = tops[0]->count(); i < n; i++)
+    data[i] = dist(gen);
+  for (unsigned t = 1; t < tops.size(); t++) //labels
+    caffe_set(tops[t]->count(), Dtype(1), tops[t]->mutable_cpu_data());
+
+  bench_result ret;
+  net.ForwardFrom(1); //warm up, allocates buffers
+  bench_clock::time_point start = bench_clock::now();
+  for (unsigned i = 0; i < iterations; i++)
+    net.ForwardFrom(1);
+  ret.forward = elapsed_ms(start, iterations);
+
+  start = bench_clock::now();
+  for (unsigned i = 0; i < iterations; i++)
+    net.BackwardTo(1);
+  ret.backward = elapsed_ms(start, iterations);
+
+  const vector<Blob<Dtype>*>& outs = net.output_blobs();
+  for (unsigned i = 0; i < outs.size(); i++)
+    ret.outputs.insert(ret.outputs.end(), outs[i]->cpu_data(),
+        outs[i]->cpu_data() + outs[i]->count());
+  return ret;
+}
+
+int main(int argc, char *argv[]) {
+  unsigned iterations = 5;
+  vector<string> names;
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+      iterations = std::max(1, atoi(argv[++i]));
+    else
+      names.push_back(argv[i]);
+  }
+  if (names.size() == 0) { //all of them
+    for (auto kv : cnn_models)
+      names.push_back(kv.first);
+    sort(names.begin(), names.end());
+  }
+
+  google::InitGoogleLogging(argv[0]);
+  google::SetStderrLogging(2);
+  Caffe::set_mode(Caffe::CPU);
+
+  cout << "model\tengine\tforward_ms\tbackward_ms\tmax_diff\n";
+  for (unsigned m = 0; m < names.size(); m++) {
+    const string& name = names[m];
+    if (cnn_models.count(name) == 0) {
+      cerr << name << " is not a valid model name:\n" + builtin_cnn_models() << "\n";
+      return -1;
+    }
+    const cnn_model_def& def = cnn_models[name];
+
+    NetParameter model;
+    google::protobuf::io::ArrayInputStream modeldata(def.model, strlen(def.model));
+    if (!google::protobuf::TextFormat::Parse(&modeldata, &model)) {
+      cerr << "Error with built-in cnn model " << name << "\n";
+      return -1;
+    }
+    UpgradeNetAsNeeded("default", &model);
+    model.mutable_state()->set_phase(TEST);
+    model.set_force_backward(true);
+    MolGridDataParameter *mgrid = model.mutable_layer(0)->mutable_molgrid_data_param();
+    mgrid->set_inmemory(true);
+    mgrid->set_batch_size(1);
+    mgrid->set_mem_recmap(def.recmap);
+    mgrid->set_mem_ligmap(def.ligmap);
+    mgrid->set_random_rotation(false);
+    mgrid->set_random_translate(0);
+
+    NetParameter weights;
+    google::protobuf::io::ArrayInputStream weightdata(def.weights, def.num_bytes);
+    google::protobuf::io::CodedInputStream strm(&weightdata);
+#if GOOGLE_PROTOBUF_VERSION >= 3006000
+    strm.SetTotalBytesLimit(INT_MAX);
+#else
+    strm.SetTotalBytesLimit(INT_MAX, 536870912);
+#endif
+    if (!weights.ParseFromCodedStream(&strm)) {
+      cerr << "Error with weights of " << name << "\n";
+      return -1;
+    }
+
+    bench_result im2col = run(model, weights, ConvolutionParameter_Engine_CAFFE, iterations);
+    bench_result direct = run(model, weights, ConvolutionParameter_Engine_DIRECT, iterations);
+    double maxdiff = 0;
+    for (unsigned i = 0; i < im2col.outputs.size() && i < direct.outputs.size(); i++)
+      maxdiff = std::max(maxdiff, (double)fabs(im2col.outputs[i] - direct.outputs[i]));
+
+    cout << name << "\tim2col\t" << im2col.forward << "\t" << im2col.backward << "\t-\n";
+    cout << name << "\tdirect\t" << direct.forward << "\t" << direct.backward << "\t" << maxdiff << "\n";
+  }
+  return 0;
+}
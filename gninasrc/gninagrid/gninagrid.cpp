@@ -47,7 +47,11 @@ static bool parse_options(int argc, char *argv[], gridoptions& o) {
   ("grid,g", value<std::vector<std::string> >(&o.usergrids)->multitoken(),
       "additional grid(s) in dx format; prepended to receptor grids")
   ("example_grid", value<string>(&o.examplegrid),
-      "example grid for positioning with --separate");
+      "example grid for positioning with --separate")
+  ("recmolcache", value<string>(&o.recmolcache),
+      ".molcache2 archive (from gninatyper) that the receptor is read from by name")
+  ("ligmolcache", value<string>(&o.ligmolcache),
+      ".molcache2 archive (from gninatyper) that the ligand is read from by name");
 
   options_description outputs("Output");
   outputs.add_options()("out,o", value<std::string>(&o.outname)->required(),
@@ -55,7 +59,13 @@ static bool parse_options(int argc, char *argv[], gridoptions& o) {
   ("map", bool_switch(&o.outmap),
       "output AD4 map files (for debugging, out is base name)")
   ("dx", bool_switch(&o.outdx),
-      "output DX map files (for debugging, out is base name)");
+      "output DX map files (for debugging, out is base name)")
+  ("batch", bool_switch(&o.batch),
+      "output the grids of all ligands to a single out.gridbatch file")
+  ("float16", bool_switch(&o.float16),
+      "store --batch values as half precision floats")
+  ("sparse", bool_switch(&o.sparse),
+      "store only the nonzero --batch values and their indices");
 
   options_description options("Options");
   options.add_options()
@@ -71,7 +81,9 @@ static bool parse_options(int argc, char *argv[], gridoptions& o) {
   ("recmap", value<string>(&o.recmap), "Atom type mapping for receptor atoms")
   ("ligmap", value<string>(&o.ligmap), "Atom type mapping for ligand atoms")
   ("separate", bool_switch(&o.separate), "Output separate rec and lig files.")
-  ("gpu", bool_switch(&o.gpu), "Use GPU to compute grids");
+  ("gpu", bool_switch(&o.gpu), "Use GPU to compute grids")
+  ("cpu", value<unsigned>(&o.cpu),
+      "the number of threads computing --batch grids (default is the number of CPUs)");
 
   options_description info("Information (optional)");
   info.add_options()("help", bool_switch(&o.help), "display usage summary")
@@ -130,6 +142,15 @@ int main(int argc, char *argv[]) {
       mgrid.outputBIN(opt.outname, true, false);
     }
 
+    if (opt.batch) {
+      unsigned encoding = 0;
+      if (opt.float16) encoding |= MolGridder::BatchFloat16;
+      if (opt.sparse) encoding |= MolGridder::BatchSparse;
+      mgrid.outputBatch(opt.outname + ".gridbatch", opt.cpu, encoding,
+          !opt.separate, opt.timeit);
+      return 0;
+    }
+
     //for each ligand
     unsigned ligcnt = 0;
     while (mgrid.readMolecule(opt.timeit)) {
@@ -9,6 +9,14 @@
 #include <libmolgrid/cartesian_grid.h>
 #include <boost/timer/timer.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <cstddef>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <map>
 
 
 using namespace std;
@@ -41,15 +49,33 @@ MolGridder::MolGridder(const gridoptions& opt) :
 
   float3 dims = gmaker.get_grid_dims();
   grid = MGrid4f(rectyper->num_types()+ligtyper->num_types()+usergrids.size(), dims.x, dims.y, dims.z);
-  tee log(true);
-  FlexInfo finfo(log); //dummy
-  mols.create_init_model(opt.receptorfile, "", finfo, log);
-  mols.setInputFile(opt.ligandfile);
   N = 1 + round(dimension / resolution);
 
   ex.sets[0].set_num_types(rectyper->num_types());
   ex.sets[1].set_num_types(ligtyper->num_types());
-  setReceptor(mols.getInitModel());
+
+  if (opt.recmolcache.size() > 0) {
+    recarchive = std::make_shared<molcache_reader>(opt.recmolcache);
+    sz n = 0;
+    const gninatypes_atom *atoms = recarchive->get(opt.receptorfile, n);
+    if (atoms == NULL) {
+      cerr << "Receptor " << opt.receptorfile << " not in " << opt.recmolcache << "\n";
+      exit(1);
+    }
+    setFromRecord(atoms, n, *rectyper, ex.sets[0]);
+  } else {
+    tee log(true);
+    FlexInfo finfo(log); //dummy
+    mols.create_init_model(opt.receptorfile, "", finfo, log);
+    setReceptor(mols.getInitModel());
+  }
+
+  if (opt.ligmolcache.size() > 0) {
+    ligarchive = std::make_shared<molcache_reader>(opt.ligmolcache);
+    ligname = opt.ligandfile;
+  } else {
+    mols.setInputFile(opt.ligandfile);
+  }
 
   if(opt.separate) setGrid(gpu);
 
@@ -75,7 +101,7 @@ void MolGridder::setReceptor(const model& m) {
   ex.sets[0] = CoordinateSet(coords, t, r, rectyper->num_types());
 }
 
-void MolGridder::setLigand(const model& m) {
+void MolGridder::setLigand(const model& m, CoordinateSet& lig) {
   const atomv& atoms = m.get_movable_atoms();
   assert(atoms.size() == m.coordinates().size());
 
@@ -93,7 +119,25 @@ void MolGridder::setLigand(const model& m) {
     }
   }
 
-  ex.sets[1] = CoordinateSet(coords, t, r, ligtyper->num_types());
+  lig = CoordinateSet(coords, t, r, ligtyper->num_types());
+}
+
+void MolGridder::setFromRecord(const gninatypes_atom *atoms, sz n,
+    AtomTyper& typer, CoordinateSet& c) {
+  vector<float3> coords; coords.reserve(n);
+  vector<int> t; t.reserve(n);
+  vector<float> r; r.reserve(n);
+
+  for (unsigned i = 0; i < n; i++) {
+    auto t_r = typer.get_int_type(atoms[i].type);
+    if (t_r.first >= 0) {
+      coords.push_back(gfloat3(atoms[i].x, atoms[i].y, atoms[i].z));
+      t.push_back(t_r.first);
+      r.push_back(t_r.second);
+    }
+  }
+
+  c = CoordinateSet(coords, t, r, typer.num_types());
 }
 
 //convert ex to a grid
@@ -110,29 +154,35 @@ void MolGridder::setGrid(bool use_gpu) {
     current_transform.set_rotation_center(center);
   }
 
+  fillGrid(ex, current_transform, grid, use_gpu);
+}
+
+//grid e into g (whose first channels hold the user grids)
+void MolGridder::fillGrid(const Example& e, const Transform& t, MGrid4f& g,
+    bool use_gpu) const {
   if(usergrids.size() > 0) { //not particularly optimized
     //copy into first so many channels
     unsigned n = usergrids.size();
 
     for(unsigned i = 0; i < n; i++) {
-      grid[i].copyFrom(usergrids[i].cpu());
+      g[i].copyFrom(usergrids[i].cpu());
     }
 
-    size_t offset = grid[0].size()*n;
+    size_t offset = g[0].size()*n;
     unsigned channels = rectyper->num_types()+ligtyper->num_types();
     if(use_gpu) {
-      Grid4fCUDA g(grid.gpu().data()+offset, channels, N, N, N);
-      gmaker.forward(ex, current_transform, g);
+      Grid4fCUDA sub(g.gpu().data()+offset, channels, N, N, N);
+      gmaker.forward(e, t, sub);
     } else {
-      Grid4f g(grid.cpu().data()+offset, channels, N, N, N);
-      gmaker.forward(ex, current_transform, g);
+      Grid4f sub(g.cpu().data()+offset, channels, N, N, N);
+      gmaker.forward(e, t, sub);
     }
   }
   else { //no user grids
     if(use_gpu) {
-      gmaker.forward(ex, current_transform, grid.gpu());
+      gmaker.forward(e, t, g.gpu());
     } else {
-      gmaker.forward(ex, current_transform, grid.cpu());
+      gmaker.forward(e, t, g.cpu());
     }
   }
 }
@@ -228,11 +278,29 @@ void MolGridder::set_usergrids(const vector<string>& userfiles) {
 }
 
 
-bool MolGridder::readMolecule(bool timeit) {
+//read the next ligand into lig, return false if there are no more
+bool MolGridder::readLigand(CoordinateSet& lig) {
+  if (ligarchive) {
+    //a single record
+    if (ligname.size() == 0) return false;
+    sz n = 0;
+    const gninatypes_atom *atoms = ligarchive->get(ligname, n);
+    if (atoms == NULL) {
+      cerr << "Ligand " << ligname << " not in archive\n";
+      exit(1);
+    }
+    setFromRecord(atoms, n, *ligtyper, lig);
+    ligname.clear();
+  } else {
+    model m;
+    if (!mols.readMoleculeIntoModel(m)) return false;
+    setLigand(m, lig);
+  }
+  return true;
+}
 
-  model m;
-  if (!mols.readMoleculeIntoModel(m)) return false;
-  setLigand(m);
+bool MolGridder::readMolecule(bool timeit) {
+  if (!readLigand(ex.sets[1])) return false;
 
   boost::timer::cpu_timer t;
   setGrid(gpu);
@@ -346,3 +414,259 @@ void MolGridder::outputBIN(const std::string& base, bool outputrec, bool outputl
     }
   }
 }
+
+//batch files start with a batch_header and hold one chunk per grid: a uint64
+//payload size in bytes, the float x,y,z grid center, then the payload.  A
+//dense payload is channels*points^3 values; a sparse payload is a uint32
+//count of nonzero values followed by their uint32 indices and the values.
+//Values are floats, or IEEE half floats with BatchFloat16.
+struct batch_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t encoding;
+    uint32_t channels;
+    uint32_t points; //per side
+    float resolution;
+    uint32_t count; //number of grids, filled in once all are written
+};
+
+//a ligand waiting to be gridded
+struct batch_job {
+    sz seq = 0; //position in input
+    CoordinateSet lig;
+    Transform transform;
+    gfloat3 center;
+};
+
+//round to nearest even half float
+static uint16_t float_to_half(float f) {
+  uint32_t x;
+  memcpy(&x, &f, sizeof(x));
+  uint32_t sign = (x >> 16) & 0x8000;
+  uint32_t mant = x & 0x7fffff;
+  int exp = (x >> 23) & 0xff;
+  if (exp == 0xff) return sign | 0x7c00 | (mant ? 0x200 : 0); //inf or nan
+  exp += 15 - 127;
+  if (exp >= 0x1f) return sign | 0x7c00; //overflow
+  if (exp <= 0) { //subnormal
+    if (exp < -10) return sign;
+    mant |= 0x800000;
+    unsigned shift = 14 - exp;
+    uint32_t half = mant >> shift;
+    uint32_t rem = mant & ((1u << shift) - 1);
+    uint32_t mid = 1u << (shift - 1);
+    if (rem > mid || (rem == mid && (half & 1))) half++;
+    return sign | half;
+  }
+  uint32_t half = (exp << 10) | (mant >> 13);
+  uint32_t rem = mant & 0x1fff;
+  //a carry out of the mantissa correctly bumps the exponent
+  if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) half++;
+  return sign | half;
+}
+
+template<typename T>
+static void append(string& out, const T& val) {
+  out.append((const char*) &val, sizeof(T));
+}
+
+static void append_value(string& out, float val, bool half) {
+  if (half)
+    append(out, float_to_half(val));
+  else
+    append(out, val);
+}
+
+//encode n values of data as a chunk of a batch file
+static void encode_chunk(const float *data, size_t n, unsigned encoding,
+    const gfloat3& c, string& out) {
+  bool half = encoding & MolGridder::BatchFloat16;
+  out.clear();
+  append(out, uint64_t(0)); //size, set below
+  append(out, c.x);
+  append(out, c.y);
+  append(out, c.z);
+  if (encoding & MolGridder::BatchSparse) {
+    vector<uint32_t> nz;
+    for (size_t i = 0; i < n; i++) {
+      if (data[i] != 0) nz.push_back(i);
+    }
+    append(out, uint32_t(nz.size()));
+    out.append((const char*) nz.data(), nz.size() * sizeof(uint32_t));
+    for (size_t i = 0, nn = nz.size(); i < nn; i++) {
+      append_value(out, data[nz[i]], half);
+    }
+  } else if (half) {
+    out.reserve(out.size() + n * sizeof(uint16_t));
+    for (size_t i = 0; i < n; i++) {
+      append(out, float_to_half(data[i]));
+    }
+  } else {
+    out.append((const char*) data, n * sizeof(float));
+  }
+  uint64_t sz = out.size() - sizeof(uint64_t) - 3 * sizeof(float);
+  memcpy(&out[0], &sz, sizeof(sz));
+}
+
+//read ligands on this thread, grid them on nthreads threads that each own
+//a grid, and write the chunks in input order from a writer thread; at most
+//2*nthreads ligands are in flight at once
+void MolGridder::outputBatch(const std::string& fname, unsigned nthreads,
+    unsigned encoding, bool outputrec, bool timeit) {
+  boost::timer::cpu_timer total;
+  unsigned skip = outputrec ? 0 : usergrids.size() + rectyper->num_types();
+  unsigned channels = usergrids.size() + rectyper->num_types()
+      + ligtyper->num_types() - skip;
+  size_t npoints = size_t(N) * N * N;
+
+  ofstream out(fname.c_str(), ios::binary);
+  if (!out) {
+    throw file_error(fname, false);
+  }
+  batch_header hdr;
+  memcpy(hdr.magic, "GNINAGRD", sizeof(hdr.magic));
+  hdr.version = 1;
+  hdr.encoding = encoding;
+  hdr.channels = channels;
+  hdr.points = N;
+  hdr.resolution = resolution;
+  hdr.count = 0;
+  out.write((const char*) &hdr, sizeof(hdr));
+
+  if (gpu || nthreads < 1) nthreads = 1; //one device, so one gridding thread
+  sz maxpending = 2 * nthreads;
+
+  boost::mutex mtx; //protects everything below
+  boost::condition_variable changed;
+  deque<batch_job> jobs;
+  map<sz, string> chunks; //gridded but not yet written, by seq
+  sz count = 0; //ligands read
+  sz written = 0;
+  bool reading = true;
+  exception_ptr error;
+  double readtime = 0, gridtime = 0, encodetime = 0, writetime = 0; //ns
+
+  auto fail = [&]() {
+    boost::lock_guard<boost::mutex> L(mtx);
+    if (!error) error = current_exception();
+    changed.notify_all();
+  };
+
+  auto gridder = [&]() {
+    try {
+      MGrid4f g(grid.dimension(0), grid.dimension(1), grid.dimension(2),
+          grid.dimension(3));
+      Example e;
+      e.sets.resize(2);
+      e.sets[0] = ex.sets[0];
+      string chunk;
+      for (;;) {
+        batch_job job;
+        {
+          boost::unique_lock<boost::mutex> L(mtx);
+          while (jobs.empty() && reading && !error)
+            changed.wait(L);
+          if (jobs.empty() || error) return;
+          job = jobs.front();
+          jobs.pop_front();
+        }
+        boost::timer::cpu_timer t;
+        e.sets[1] = job.lig;
+        fillGrid(e, job.transform, g, gpu);
+        double gt = t.elapsed().wall;
+        t.start();
+        encode_chunk(g.cpu().data() + skip * npoints, channels * npoints,
+            encoding, job.center, chunk);
+        double et = t.elapsed().wall;
+
+        boost::lock_guard<boost::mutex> L(mtx);
+        gridtime += gt;
+        encodetime += et;
+        chunks[job.seq].swap(chunk);
+        changed.notify_all();
+      }
+    } catch (...) {
+      fail();
+    }
+  };
+
+  auto writer = [&]() {
+    try {
+      string chunk;
+      for (;;) {
+        {
+          boost::unique_lock<boost::mutex> L(mtx);
+          while (!error && chunks.count(written) == 0
+              && (reading || written < count))
+            changed.wait(L);
+          if (error || chunks.count(written) == 0) return;
+          chunk.swap(chunks[written]);
+          chunks.erase(written);
+          written++;
+          changed.notify_all();
+        }
+        boost::timer::cpu_timer t;
+        out.write(chunk.data(), chunk.size());
+        if (!out) throw file_error(fname, false);
+        writetime += t.elapsed().wall; //only touched by this thread
+      }
+    } catch (...) {
+      fail();
+    }
+  };
+
+  boost::thread_group threads;
+  for (unsigned i = 0; i < nthreads; i++) {
+    threads.create_thread(gridder);
+  }
+  boost::thread writethread(writer);
+
+  try {
+    for (;;) {
+      boost::timer::cpu_timer t;
+      batch_job job;
+      if (!readLigand(job.lig)) break;
+      job.center = center_set ? center : job.lig.center();
+      if (random_translate > 0 || random_rotate) {
+        job.transform = Transform(job.center, random_translate, random_rotate);
+      } else {
+        job.transform.set_rotation_center(job.center);
+      }
+      readtime += t.elapsed().wall;
+
+      boost::unique_lock<boost::mutex> L(mtx);
+      while (!error && jobs.size() + chunks.size() >= maxpending)
+        changed.wait(L);
+      if (error) break;
+      job.seq = count++;
+      jobs.push_back(job);
+      changed.notify_all();
+    }
+  } catch (...) {
+    fail();
+  }
+
+  {
+    boost::lock_guard<boost::mutex> L(mtx);
+    reading = false;
+    changed.notify_all();
+  }
+  threads.join_all();
+  writethread.join();
+  if (error) rethrow_exception(error);
+
+  uint32_t n = count;
+  out.seekp(offsetof(batch_header, count));
+  out.write((const char*) &n, sizeof(n));
+  out.close();
+  if (!out) throw file_error(fname, false);
+
+  if (timeit) {
+    double secs = total.elapsed().wall / 1e9;
+    cout << "Read " << readtime / 1e9 << "s Grid " << gridtime / 1e9
+        << "s Encode " << encodetime / 1e9 << "s Write " << writetime / 1e9
+        << "s\n";
+    cout << count << " grids in " << secs << "s (" << count / secs
+        << " grids/s)\n";
+  }
+}
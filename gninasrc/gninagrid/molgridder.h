@@ -14,6 +14,7 @@
 #include <libmolgrid/grid_maker.h>
 #include <vector>
 #include "molgetter.h"
+#include "molcache.h"
 #include "gridoptions.h"
 
 /** Store molecular model and apply gridermaker as needed to write out grids.
@@ -32,6 +33,9 @@ class MolGridder {
 
     //next read in receptor
     MolGetter mols; //use gnina routines for reading molecule
+    //archives that molecules are read from instead, if provided
+    std::shared_ptr<molcache_reader> recarchive, ligarchive;
+    std::string ligname; //record of ligarchive not read yet
     libmolgrid::MGrid4f grid;
     libmolgrid::GridMaker gmaker;
     libmolgrid::Transform current_transform;
@@ -43,10 +47,19 @@ class MolGridder {
     libmolgrid::Example ex; //coordinate/type data
     //set receptor from model into example
     void setReceptor(const model& m);
-    //set ligand into ex from model (overwrite current)
-    void setLigand(const model& m);
+    //set ligand coordinates from model
+    void setLigand(const model& m, libmolgrid::CoordinateSet& lig);
+    //read the next ligand, return false if there are no more
+    bool readLigand(libmolgrid::CoordinateSet& lig);
+    //set a coordinate set from archived atoms
+    static void setFromRecord(const gninatypes_atom *atoms, sz n,
+        libmolgrid::AtomTyper& typer, libmolgrid::CoordinateSet& c);
     //set grid from example
     void setGrid(bool use_gpu);
+    //grid e with transform t into g, which is shaped like grid
+    void fillGrid(const libmolgrid::Example& e,
+        const libmolgrid::Transform& t, libmolgrid::MGrid4f& g,
+        bool use_gpu) const;
 
     //sets grid on cpu and compares to current
     void cpuSetGridCheck();
@@ -78,6 +91,18 @@ class MolGridder {
     //read a molecule (return false if unsuccessful)
     //set the ligand grid appropriately
     bool readMolecule(bool timeit);
+
+    //grid every remaining molecule into a single file, see outputBatch
+    //in molgridder.cpp for the layout; ligands are read by the calling
+    //thread, gridded by nthreads threads and written in input order
+    void outputBatch(const std::string& fname, unsigned nthreads,
+        unsigned encoding, bool outputrec, bool timeit);
+
+    //encoding flags of outputBatch
+    enum BatchEncoding {
+      BatchFloat16 = 1, //half precision values
+      BatchSparse = 2 //only nonzero values, with their indices
+    };
 };
 
 
@@ -6,13 +6,19 @@
  */
 
 #include <sstream>
+#include <climits>
 
 #include "MinimizationQuery.h"
 #include "conf.h"
 #include "non_cache.h"
 #include "quasi_newton.h"
+#include "work_scheduler.h"
 #include <boost/archive/binary_iarchive.hpp>
 #include <boost/unordered_set.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/ranked_index.hpp>
+#include <boost/multi_index/identity.hpp>
 #include <boost/timer/timer.hpp>
 
 using namespace boost;
@@ -44,54 +50,145 @@ MinimizationParameters::~MinimizationParameters() {
   if (nnc) delete nnc;
 }
 
+//order statistics of the results by one sort key, also restricted to the
+//best result of each name in either direction (for unique), so that any
+//page of the sorted results can be found in O(log n + page)
+class MinimizationQuery::SortedResults {
+    struct Entry {
+        double key;
+        unsigned position; //breaks ties, so order is deterministic
+        Result *res;
+
+        Entry(double k, unsigned pos, Result *r)
+            : key(k), position(pos), res(r) {
+        }
+
+        bool operator<(const Entry& rhs) const {
+          if (key != rhs.key) return key < rhs.key;
+          return position < rhs.position;
+        }
+    };
+
+    typedef boost::multi_index_container<Entry,
+        boost::multi_index::indexed_by<
+            boost::multi_index::ranked_unique<
+                boost::multi_index::identity<Entry> > > > Ranked;
+    typedef boost::unordered_map<string, Entry> BestMap;
+
+    MinimizationFilters::SortType sort;
+    Ranked all;
+    Ranked lowest, highest; //best of each name when sorting up or down
+    BestMap lowestByName, highestByName;
+
+    double value(const Result *r) const {
+      switch (sort) {
+      case MinimizationFilters::Score:
+        return r->score;
+      case MinimizationFilters::RMSD:
+        return r->rmsd;
+      case MinimizationFilters::OrigPos:
+        return r->orig_position;
+      }
+      return 0;
+    }
+
+    //replace the best of e's name if e is better
+    static void update(Ranked& best, BestMap& byname, const Entry& e,
+        bool low) {
+      BestMap::iterator pos = byname.find(e.res->name);
+      if (pos == byname.end()) {
+        byname.insert(BestMap::value_type(e.res->name, e));
+        best.insert(e);
+      } else if (low ? e < pos->second : pos->second < e) {
+        best.erase(pos->second);
+        pos->second = e;
+        best.insert(e);
+      }
+    }
+
+  public:
+    SortedResults(MinimizationFilters::SortType s)
+        : sort(s) {
+    }
+
+    void insert(Result *r) {
+      Entry e(value(r), r->position, r);
+      all.insert(e);
+      update(lowest, lowestByName, e, true);
+      update(highest, highestByName, e, false);
+    }
+
+    //largest key, HUGE_VAL if there are no results
+    double max() const {
+      if (all.empty()) return HUGE_VAL;
+      return all.rbegin()->key;
+    }
+
+    //fill results with the page of filter; only the filter on this key is
+    //applied, and for unique descending pages that filter must not exclude
+    //anything; returns the number of results passing the filter
+    unsigned page(const MinimizationFilters& filter, double limit,
+        vector<Result*>& results) const {
+      const Ranked& idx =
+          !filter.unique ? all : filter.reverseSort ? highest : lowest;
+
+      //results within limit are a prefix
+      unsigned n = idx.size();
+      if (limit != HUGE_VAL)
+        n = idx.rank(idx.upper_bound(Entry(limit, UINT_MAX, NULL)));
+
+      unsigned end = filter.start + filter.num;
+      if (end > n || filter.num == 0) end = n;
+      results.clear();
+      if (filter.start >= end) return n;
+      results.reserve(end - filter.start);
+
+      if (filter.reverseSort) {
+        Ranked::iterator itr = idx.nth(n - 1 - filter.start);
+        for (unsigned i = filter.start; i < end; i++, --itr)
+          results.push_back(itr->res);
+      } else {
+        Ranked::iterator itr = idx.nth(filter.start);
+        for (unsigned i = filter.start; i < end; i++, ++itr)
+          results.push_back(itr->res);
+      }
+      return n;
+    }
+};
+
+void MinimizationQuery::createIndexes() {
+  for (unsigned k = 0; k < 3; k++)
+    sorted[k] = boost::shared_ptr<SortedResults>(
+        new SortedResults((MinimizationFilters::SortType) k));
+}
+
 MinimizationQuery::~MinimizationQuery() {
-  checkThread();
-  assert(minimizationSpawner == NULL); //should not be deleted while minimization is running
+  assert(chunkJobs == 0); //should not be deleted while minimization is running
+  if (reader.joinable()) reader.join(); //done reading, may still be exiting
   for (unsigned i = 0, n = allResults.size(); i < n; i++) {
     delete allResults[i];
   }
   allResults.clear();
 }
 
-void MinimizationQuery::checkThread() {
-  //clean up minimizer threads
-  if (minimizationSpawner != NULL) {
-    if (minimizationSpawner->timed_join(posix_time::time_duration(0, 0, 0))) {
-      delete minimizationSpawner;
-      minimizationSpawner = NULL; // thread is done
-    }
-  }
-}
-
 //return true if down minimizing
 bool MinimizationQuery::finished() {
-  checkThread();
   return isFinished; //do not want to return true before minimization even starts
 }
 
-//execute the query - set up the minimization threads and communication queue
-void MinimizationQuery::execute(bool block/*=false*/) {
-  assert(minimizationSpawner == NULL);
-  minimizationSpawner = new boost::thread(thread_startMinimization, this);
-
-  if (block) minimizationSpawner->join();
+//execute the query - start the reader, which queues up to nthreads
+//minimization jobs as ligands arrive; jobs of all queries share the thread
+//pool and take turns chunk by chunk
+void MinimizationQuery::execute() {
+  assert(chunkJobs == 0);
+  minTimer.start();
+  reader = boost::thread(&MinimizationQuery::readLigands, this);
 }
 
-//launch and wait for the minimization threads
-void MinimizationQuery::thread_startMinimization(MinimizationQuery *query) {
-  //generate a thread for each set of databases
-  thread_group minthreads;
-
-  timer::cpu_timer mintime;
-
-  for (unsigned t = 0; t < query->minparm.nthreads; t++) {
-    minthreads.add_thread(new boost::thread(thread_minimize, query));
-  }
-  minthreads.join_all(); //block till all done
-
-  query->minTime = mintime.elapsed().wall / 1e9;
-  query->io->close();
-  query->isFinished = true;
+void MinimizationQuery::cancel() {
+  boost::lock_guard<boost::mutex> lock(chunk_mutex);
+  stopQuery = true;
+  chunk_space.notify_all(); //the reader may be waiting to buffer a chunk
 }
 
 //thread safe minimization of m
@@ -109,8 +206,7 @@ MinimizationQuery::Result* MinimizationQuery::minimize(model& m) {
 
   //do minimization
   grid_dims gd = m.movable_atoms_box(autobox_add, granularity);
-  szv_grid_cache gridcache(m, minparm.prec->cutoff_sqr());
-  non_cache nc(gridcache, gd, minparm.prec);
+  non_cache nc(receptor->gridcache, gd, minparm.prec);
   conf c = m.get_initial_conf(nc.move_receptor());
   output_type out(c, e);
   change g(m.get_size(), nc.move_receptor());
@@ -173,10 +269,8 @@ MinimizationQuery::Result* MinimizationQuery::minimize(model& m) {
 
 //read a chunk of ligands at a time
 //return false if there's definitely nothing else to read
-bool MinimizationQuery::thread_safe_read(vector<LigandData>& ligands) {
+bool MinimizationQuery::read_chunk(vector<LigandData>& ligands) {
   ligands.clear();
-  boost::unique_lock<boost::mutex> lock(io_mutex);
-
   if (!io_strm) return false;
 
   boost::archive::binary_iarchive serialin(io_strm,
@@ -203,62 +297,125 @@ bool MinimizationQuery::thread_safe_read(vector<LigandData>& ligands) {
   return !!io_strm;
 }
 
-//read chunks of ligands, minimize them, and store the result
-void MinimizationQuery::thread_minimize(MinimizationQuery* q) {
-  unsigned cnt = 0;
-  try {
+//minimize ligands and store the results
+void MinimizationQuery::minimizeLigands(vector<LigandData>& ligands) {
+  vector<Result*> results;
+  for (unsigned i = 0, n = ligands.size(); i < n; i++) {
+    //construct model
+    LigandData& l = ligands[i];
+    model m = receptor->m;
+
+    if (hasReorient) l.reorient.reorient(l.p);
+
+    non_rigid_parsed nr;
+    pdbqt_initializer tmp;
+
+    if (isFrag) {
+      //treat as residue
+      postprocess_residue(nr, l.p, l.c);
+    } else {
+      postprocess_ligand(nr, l.p, l.c, l.numtors);
+    }
+
+    tmp.initialize_from_nrp(nr, l.c, !isFrag);
+    tmp.initialize(nr.mobility_matrix());
+    m.set_name(l.c.sdftext.name);
+
+    m.append(tmp.m);
+
+    Result *result = minimize(m);
+    result->orig_position = l.origpos;
+    if (result != NULL) results.push_back(result);
+  }
+
+  //add computed results
+  boost::lock_guard<shared_mutex> lock(results_mutex);
+  for (unsigned i = 0, n = results.size(); i < n; i++) {
+    results[i]->position = allResults.size();
+    allResults.push_back(results[i]);
+    for (unsigned k = 0; k < 3; k++)
+      sorted[k]->insert(results[i]);
+  }
+}
+
+//body of the reader thread: read chunks of ligands from the client and
+//queue a minimization job for them unless nthreads jobs are already
+//running; only a couple of chunks per job are buffered, so ligands are read
+//about as fast as they are minimized and a fast client is held back by the
+//socket
+void MinimizationQuery::readLigands() {
+  unsigned maxJobs = max(1U, minparm.nthreads);
+  bool more = true;
+  while (more) {
     vector<LigandData> ligands;
-    while (q->thread_safe_read(ligands)) {
-      if (q->stopQuery) //cancelled
-        return;
-      else
-        if (ligands.size() == 0) //nothing to do yet
-          usleep(10);
-        else //let's minimize!
-        {
-          vector<Result*> results;
-          for (unsigned i = 0, n = ligands.size(); i < n; i++) {
-            //construct model
-            cnt++;
-            LigandData& l = ligands[i];
-            model m = q->initm;
-
-            if (q->hasReorient) l.reorient.reorient(l.p);
-
-            non_rigid_parsed nr;
-            pdbqt_initializer tmp;
-
-            if (q->isFrag) {
-              //treat as residue
-              postprocess_residue(nr, l.p, l.c);
-            } else {
-              postprocess_ligand(nr, l.p, l.c, l.numtors);
-            }
-
-            tmp.initialize_from_nrp(nr, l.c, !q->isFrag);
-            tmp.initialize(nr.mobility_matrix());
-            m.set_name(l.c.sdftext.name);
-
-            m.append(tmp.m);
-
-            Result *result = q->minimize(m);
-            result->orig_position = l.origpos;
-            if (result != NULL) results.push_back(result);
-          }
-
-          //add computed results
-          boost::lock_guard<shared_mutex> lock(q->results_mutex);
-          for (unsigned i = 0, n = results.size(); i < n; i++) {
-            results[i]->position = q->allResults.size();
-            q->allResults.push_back(results[i]);
-          }
+    more = read_chunk(ligands);
+
+    bool submit = false, done = false;
+    {
+      boost::unique_lock<boost::mutex> lock(chunk_mutex);
+      while (!stopQuery && ligands.size() > 0 && chunks.size() >= 2 * maxJobs)
+        chunk_space.wait(lock);
+      if (stopQuery) {
+        more = false;
+      } else if (ligands.size() > 0) {
+        chunks.push_back(vector<LigandData>());
+        chunks.back().swap(ligands);
+        if (chunkJobs < maxJobs) {
+          chunkJobs++;
+          submit = true;
         }
+      }
+      if (!more) {
+        readerDone = true;
+        done = chunkJobs == 0;
+      }
+    }
 
+    if (submit)
+      work_scheduler::global().submit(boost::bind(minimizeChunk, this));
+    else if (done)
+      finish();
+  }
+}
+
+//minimize a chunk that has been read, then go to the back of the line if
+//there are more
+void MinimizationQuery::minimizeChunk(MinimizationQuery* q) {
+  vector<LigandData> ligands;
+  {
+    boost::lock_guard<boost::mutex> lock(q->chunk_mutex);
+    if (!q->stopQuery && q->chunks.size() > 0) {
+      ligands.swap(q->chunks.front());
+      q->chunks.pop_front();
+      q->chunk_space.notify_one();
     }
+  }
+
+  try {
+    if (ligands.size() > 0) q->minimizeLigands(ligands);
   } catch (...) //don't die
   {
     q->cancel();
   }
+
+  bool more = false, done = false;
+  {
+    boost::lock_guard<boost::mutex> lock(q->chunk_mutex);
+    if (q->stopQuery) q->chunks.clear(); //cancelled
+    more = q->chunks.size() > 0;
+    if (!more) done = --q->chunkJobs == 0 && q->readerDone; //last one out
+  }
+
+  if (more)
+    work_scheduler::global().submit(boost::bind(minimizeChunk, q));
+  else if (done)
+    q->finish();
+}
+
+void MinimizationQuery::finish() {
+  minTime = minTimer.elapsed().wall / 1e9;
+  io->close();
+  isFinished = true; //may be purged from here on
 }
 
 //output the mol at position pos
@@ -304,17 +461,42 @@ class MinimizationQuery::ResultsSorter {
     }
 
 };
+//true if the page of filter can be read off the sorted indexes: filters on
+//keys other than the sort key must not exclude anything (a limit at or above
+//the largest value is as good as none); must hold results_mutex
+bool MinimizationQuery::indexed(const MinimizationFilters& filter) {
+  if (filter.sort > MinimizationFilters::OrigPos) return false;
+  double limits[2] = { filter.maxScore, filter.maxRMSD }; //by SortType
+  for (unsigned k = 0; k < 2; k++) {
+    bool own = k == (unsigned) filter.sort;
+    if (own && !(filter.unique && filter.reverseSort)) continue;
+    if (limits[k] != HUGE_VAL && limits[k] < sorted[k]->max()) return false;
+  }
+  return true;
+}
+
 //copies allResults (safely) into results which is then sorted and filter according
-//to filter; returns the total number of results _before_filtering
-//does not truncate results by start/num of filter
+//to filter; sets filtered to the number of results passing the filter and
+//returns the total number of results _before_filtering; results is
+//truncated to the start/num page of filter
 unsigned MinimizationQuery::loadResults(const MinimizationFilters& filter,
-    vector<Result*>& results) {
+    vector<Result*>& results, unsigned& filtered) {
   results_mutex.lock_shared();
+  unsigned total = allResults.size();
+  if (indexed(filter)) {
+    double limit = HUGE_VAL;
+    if (filter.sort == MinimizationFilters::Score)
+      limit = filter.maxScore;
+    else if (filter.sort == MinimizationFilters::RMSD)
+      limit = filter.maxRMSD;
+    filtered = sorted[filter.sort]->page(filter, limit, results);
+    results_mutex.unlock_shared();
+    return total;
+  }
   results = allResults;
   results_mutex.unlock_shared();
 
   //filter
-  unsigned total = results.size();
   unsigned i = 0;
   while (i < results.size()) {
     Result *res = results[i];
@@ -349,22 +531,30 @@ unsigned MinimizationQuery::loadResults(const MinimizationFilters& filter,
     swap(results, tmpres);
 
   }
+
+  filtered = results.size();
+  unsigned end = filter.start + filter.num;
+  if (end > results.size() || filter.num == 0) end = results.size();
+  if (filter.start >= end)
+    results.clear();
+  else {
+    results.erase(results.begin() + end, results.end());
+    results.erase(results.begin(), results.begin() + filter.start);
+  }
   return total;
 }
 
 //output text formated data
 void MinimizationQuery::outputData(const MinimizationFilters& f, ostream& out) {
-  checkThread();
   vector<Result*> results;
-  unsigned total = loadResults(f, results);
+  unsigned filtered = 0;
+  unsigned total = loadResults(f, results, filtered);
 
   //first line is status header with doneness and number done and filtered number
-  out << finished() << " " << total << " " << results.size() << " " << minTime
+  out << finished() << " " << total << " " << filtered << " " << minTime
       << "\n";
 
-  unsigned end = f.start + f.num;
-  if (end > results.size() || f.num == 0) end = results.size();
-  for (unsigned i = f.start; i < end; i++) {
+  for (unsigned i = 0, n = results.size(); i < n; i++) {
     Result *res = results[i];
     out << res->position << "," << res->orig_position << "," << res->name << ","
         << res->score << "," << res->rmsd << "\n";
@@ -374,26 +564,24 @@ void MinimizationQuery::outputData(const MinimizationFilters& f, ostream& out) {
 //output json formated data, based off of datatables, does not include opening/closing brackets
 void MinimizationQuery::outputJSONData(const MinimizationFilters& f, int draw,
     ostream& out) {
-  checkThread();
   vector<Result*> results;
-  unsigned total = loadResults(f, results);
+  unsigned filtered = 0;
+  unsigned total = loadResults(f, results, filtered);
 
   //first line is status header with doneness and number done and filtered number
   out << "{\n";
   out << "\"finished\": " << finished() << ",\n";
   out << "\"recordsTotal\": " << total << ",\n";
-  out << "\"recordsFiltered\": " << results.size() << ",\n";
+  out << "\"recordsFiltered\": " << filtered << ",\n";
   out << "\"time\": " << minTime << ",\n";
   out << "\"draw\": " << draw << ",\n";
   out << "\"data\": [\n";
 
-  unsigned end = f.start + f.num;
-  if (end > results.size() || f.num == 0) end = results.size();
-  for (unsigned i = f.start; i < end; i++) {
+  for (unsigned i = 0, n = results.size(); i < n; i++) {
     Result *res = results[i];
     out << "[" << res->position << "," << res->orig_position << ",\""
         << res->name << "\"," << res->score << "," << res->rmsd << "]";
-    if (i != end - 1) out << ",";
+    if (i != n - 1) out << ",";
     out << "\n";
   }
   out << "]}\n";
@@ -401,8 +589,11 @@ void MinimizationQuery::outputJSONData(const MinimizationFilters& f, int draw,
 
 //write out all results in sdf.gz format
 void MinimizationQuery::outputMols(const MinimizationFilters& f, ostream& out) {
+  MinimizationFilters all(f); //every result, not just a page
+  all.start = all.num = 0;
   vector<Result*> results;
-  loadResults(f, results);
+  unsigned filtered = 0;
+  loadResults(all, results, filtered);
 
   //gzip output
   boost::iostreams::filtering_stream<boost::iostreams::output> strm;
@@ -9,6 +9,11 @@
 #define MINIMIZATIONQUERY_H_
 
 #include <vector>
+#include <deque>
+#include <atomic>
+#include <boost/timer/timer.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 #include "Reorienter.h"
 #include "server_common.h"
@@ -19,6 +24,7 @@
 #include "weighted_terms.h"
 #include "precalculate.h"
 #include "naive_non_cache.h"
+#include "ReceptorCache.h"
 
 //store various things that only have to be initialized once for any minimization
 struct MinimizationParameters {
@@ -81,9 +87,10 @@ class MinimizationQuery {
 
   private:
     class ResultsSorter;
+    class SortedResults;
 
     const MinimizationParameters& minparm;
-    bool isFinished;
+    std::atomic<bool> isFinished;
     double minTime; //time minimization took
     bool stopQuery; //cancelled
     time_t lastAccessed; //last time accessed
@@ -93,13 +100,12 @@ class MinimizationQuery {
     bool hasReorient; //try if ligand data is prefaced by rotation/translation
     bool isFrag; //treat as residue
     unsigned numProteinAtoms; //if nonzero, indicates how many atoms in the receptor belong to the protein as opposed to the "unfrag" - it is assumed these atoms come first
-    model initm;
+    ReceptorPtr receptor; //shared with other queries
 
     stream_ptr io;
     boost::iostreams::filtering_stream<boost::iostreams::input> io_strm; //uncompressed
 
-    unsigned io_position; //guarded by io_mutex as well
-    boost::mutex io_mutex; //protects io
+    unsigned io_position; //only used by the reader
 
     //holds the result of minimization
     struct Result {
@@ -119,14 +125,11 @@ class MinimizationQuery {
 
     vector<Result*> allResults; //order doesn't change, minimizers add to this
 
-    boost::shared_mutex results_mutex; //protects allResults
+    //allResults ordered by each MinimizationFilters::SortType, updated as
+    //results are added so that pages can be served without sorting
+    boost::shared_ptr<SortedResults> sorted[3];
 
-    boost::thread *minimizationSpawner; //manages thread_group of minimization threads
-
-    static void thread_startMinimization(MinimizationQuery* q);
-    static void thread_minimize(MinimizationQuery* q);
-
-    void checkThread();
+    boost::shared_mutex results_mutex; //protects allResults and sorted
 
     //this is what is read from the user
     struct LigandData {
@@ -137,24 +140,42 @@ class MinimizationQuery {
         unsigned origpos;
     };
 
+    //ligands are read from the client by a reader thread of the query, so
+    //a slow client never holds up the shared thread pool; minimization runs
+    //as chunk sized jobs on the pool that only take chunks already read,
+    //each requeueing itself after the chunks of the other queries
+    boost::thread reader;
+    boost::mutex chunk_mutex; //protects chunks, chunkJobs and readerDone
+    boost::condition_variable chunk_space; //chunks were taken or cancelled
+    std::deque<vector<LigandData> > chunks; //read, waiting to be minimized
+    unsigned chunkJobs; //queued or running, at most nthreads
+    bool readerDone;
+    boost::timer::cpu_timer minTimer;
+
+    void readLigands();
+    static void minimizeChunk(MinimizationQuery* q);
+    void minimizeLigands(vector<LigandData>& ligands);
+    void finish(); //once all ligands are read and minimized
+
     //reads into ligands
     //returns false iff there is no more data to read
-    bool thread_safe_read(vector<LigandData>& ligands);
+    bool read_chunk(vector<LigandData>& ligands);
 
+    void createIndexes();
+    bool indexed(const MinimizationFilters& filter);
     unsigned loadResults(const MinimizationFilters& filter,
-        vector<Result*>& results);
+        vector<Result*>& results, unsigned& filtered);
   public:
 
-    MinimizationQuery(const MinimizationParameters& minp, const string& recstr,
+    MinimizationQuery(const MinimizationParameters& minp, ReceptorPtr rec,
         stream_ptr data, bool hasR, bool isF, unsigned numR, unsigned chunks =
             10)
         : minparm(minp), isFinished(false), minTime(0), stopQuery(false),
             lastAccessed(time(NULL)), chunk_size(chunks), readAllData(false),
-            hasReorient(hasR), isFrag(isF), numProteinAtoms(numR), io(data),
-            io_position(0), minimizationSpawner(NULL) {
-      //create the initial model
-      stringstream rec(recstr);
-      initm = parse_receptor_pdbqt("rigid.pdbqt", rec);
+            hasReorient(hasR), isFrag(isF), numProteinAtoms(numR),
+            receptor(rec), io(data), io_position(0), chunkJobs(0),
+            readerDone(false) {
+      createIndexes();
 
       //set up ligand decompression stream
       io_strm.push(boost::iostreams::gzip_decompressor());
@@ -163,7 +184,8 @@ class MinimizationQuery {
 
     ~MinimizationQuery();
 
-    void execute(bool block = false);
+    //start minimizing, returns immediately
+    void execute();
 
     //all of the result/output functions can be called while an asynchronous
     //query is running
@@ -178,9 +200,7 @@ class MinimizationQuery {
     void outputMol(unsigned pos, ostream& out);
 
     //attempt to cancel,
-    void cancel() {
-      stopQuery = true;
-    }
+    void cancel();
     bool finished(); //done minimizing
     bool cancelled() {
       return stopQuery;
@@ -9,11 +9,8 @@
 #include "Reorienter.h"
 #include "MinimizationQuery.h"
 #include <boost/algorithm/string.hpp>
-#include <openbabel/obconversion.h>
-#include <openbabel/mol.h>
 
 using namespace boost;
-using namespace OpenBabel;
 
 //add a query, return zero if unsuccessful
 unsigned QueryManager::add(unsigned oldqid, stream_ptr io) {
@@ -52,26 +49,6 @@ unsigned QueryManager::add(unsigned oldqid, stream_ptr io) {
   string recstr(rsize, '\0'); //note that c++ strings are built with null at the end
   io->read(&recstr[0], rsize);
 
-  if (!ispdbqt) {
-    //have to convert from vanilla pdb to get pdbqt w/correct atom types and
-    //partial charges
-    OBConversion conv;
-    conv.SetInFormat("PDB");
-    conv.SetOutFormat("PDBQT");
-    conv.AddOption("r", OBConversion::OUTOPTIONS); //rigid molecule, otherwise really slow and useless analysis is triggered
-    conv.AddOption("c", OBConversion::OUTOPTIONS); //single combined molecule
-
-    OBMol rec;
-    if (conv.ReadString(&rec, recstr)) {
-      rec.AddHydrogens(true);
-      //force partial charge calculation
-      FOR_ATOMS_OF_MOL(a, rec){
-      a->GetPartialCharge();
-    }
-      recstr = conv.WriteString(&rec);
-    }
-  }
-
   //next line is used for parameters
   getline(*io, str);
   stringstream params(str);
@@ -90,8 +67,9 @@ unsigned QueryManager::add(unsigned oldqid, stream_ptr io) {
   //attempt to create query
   QueryPtr q;
   try {
+    ReceptorPtr rec = receptors.get(recstr, ispdbqt);
     q = QueryPtr(
-        new MinimizationQuery(minparm, recstr, io, hasR, isFrag, numrec));
+        new MinimizationQuery(minparm, rec, io, hasR, isFrag, numrec));
   } catch (parse_error& pe) //couldn't read receptor
   {
     cerr << "couldn't read receptor\n";
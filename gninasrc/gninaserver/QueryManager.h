@@ -13,6 +13,7 @@
 #include <boost/thread.hpp>
 #include <boost/shared_ptr.hpp>
 #include "MinimizationQuery.h"
+#include "ReceptorCache.h"
 
 using namespace boost;
 using namespace std;
@@ -33,10 +34,12 @@ class QueryManager {
     unsigned timeout; //seconds until purgeable
 
     MinimizationParameters minparm;
+    ReceptorCache receptors;
   public:
 
-    QueryManager(unsigned numt, unsigned tout = 60 * 30)
-        : nextID(1), timeout(tout) {
+    QueryManager(unsigned numt, unsigned tout = 60 * 30, unsigned nrec = 16)
+        : nextID(1), timeout(tout),
+            receptors(minparm.prec->cutoff_sqr(), nrec) {
       minparm.nthreads = numt;
     }
 
@@ -50,6 +53,10 @@ class QueryManager {
     unsigned purgeOldQueries();
 
     void getCounts(unsigned& active, unsigned& inactive, unsigned& defunct);
+    //cached receptors and how often a query found its receptor there
+    void getReceptorCounts(unsigned& size, unsigned& hits, unsigned& misses) {
+      receptors.getCounts(size, hits, misses);
+    }
     unsigned processedQueries() const {
       return nextID - 1;
     }
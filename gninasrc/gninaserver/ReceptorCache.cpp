@@ -0,0 +1,103 @@
+/*
+ * ReceptorCache.cpp
+ *
+ *  Keeps recently used receptors ready for minimization.
+ */
+
+#include "ReceptorCache.h"
+#include "file.h"
+#include "parse_pdbqt.h"
+#include <sstream>
+#include <openbabel/obconversion.h>
+#include <openbabel/mol.h>
+
+using namespace OpenBabel;
+
+string ReceptorCache::key(const string& recstr, bool ispdbqt) {
+  key_hash hash;
+  hash.add(ispdbqt);
+  hash.add(recstr.data(), recstr.size());
+  return hash.str();
+}
+
+//convert and parse recstr, this is the slow part of setting up a query
+ReceptorPtr ReceptorCache::prepare(const string& recstr, bool ispdbqt,
+    fl cutoff_sqr) {
+  string pdbqt = recstr;
+  if (!ispdbqt) {
+    //have to convert from vanilla pdb to get pdbqt w/correct atom types and
+    //partial charges
+    OBConversion conv;
+    conv.SetInFormat("PDB");
+    conv.SetOutFormat("PDBQT");
+    conv.AddOption("r", OBConversion::OUTOPTIONS); //rigid molecule, otherwise really slow and useless analysis is triggered
+    conv.AddOption("c", OBConversion::OUTOPTIONS); //single combined molecule
+
+    OBMol rec;
+    if (conv.ReadString(&rec, recstr)) {
+      rec.AddHydrogens(true);
+      //force partial charge calculation
+      FOR_ATOMS_OF_MOL(a, rec) {
+        a->GetPartialCharge();
+      }
+      pdbqt = conv.WriteString(&rec);
+    }
+  }
+
+  stringstream rec(pdbqt);
+  return ReceptorPtr(
+      new PreparedReceptor(parse_receptor_pdbqt("rigid.pdbqt", rec),
+          cutoff_sqr));
+}
+
+ReceptorPtr ReceptorCache::get(const string& recstr, bool ispdbqt) {
+  string k = key(recstr, ispdbqt);
+  {
+    boost::lock_guard<boost::mutex> L(mu);
+    std::unordered_map<string, EntryList::iterator>::iterator pos = index.find(k);
+    if (pos != index.end() && pos->second->text == recstr) {
+      entries.splice(entries.begin(), entries, pos->second);
+      hits++;
+      return entries.front().rec;
+    }
+    misses++;
+  }
+
+  //prepare without the lock so other receptors aren't held up; if two
+  //queries race on a new receptor, the first to finish is kept
+  ReceptorPtr rec = prepare(recstr, ispdbqt, cutoff_sqr);
+  if (capacity == 0) return rec;
+
+  boost::lock_guard<boost::mutex> L(mu);
+  std::unordered_map<string, EntryList::iterator>::iterator pos = index.find(k);
+  if (pos != index.end()) {
+    if (pos->second->text == recstr) {
+      entries.splice(entries.begin(), entries, pos->second);
+      return entries.front().rec;
+    }
+    entries.erase(pos->second); //collision, replace
+    index.erase(pos);
+  }
+
+  Entry e;
+  e.key = k;
+  e.text = recstr;
+  e.rec = rec;
+  entries.push_front(e);
+  index[k] = entries.begin();
+
+  while (entries.size() > capacity) {
+    //queries still using an evicted receptor keep it alive
+    index.erase(entries.back().key);
+    entries.pop_back();
+  }
+  return rec;
+}
+
+void ReceptorCache::getCounts(unsigned& size, unsigned& nhits,
+    unsigned& nmisses) {
+  boost::lock_guard<boost::mutex> L(mu);
+  size = entries.size();
+  nhits = hits;
+  nmisses = misses;
+}
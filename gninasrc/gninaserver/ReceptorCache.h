@@ -0,0 +1,68 @@
+/*
+ * ReceptorCache.h
+ *
+ *  Keeps recently used receptors ready for minimization so that repeated
+ *  queries against the same receptor skip conversion and parsing.
+ */
+
+#ifndef RECEPTORCACHE_H_
+#define RECEPTORCACHE_H_
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <boost/thread.hpp>
+#include <boost/shared_ptr.hpp>
+#include "model.h"
+#include "szv_grid.h"
+
+using namespace std;
+
+//a parsed receptor along with the receptor atoms near each region of space,
+//which accumulate as queries minimize against it
+struct PreparedReceptor {
+    model m;
+    szv_grid_cache gridcache;
+
+    PreparedReceptor(const model& m_, fl cutoff_sqr)
+        : m(m_), gridcache(m, cutoff_sqr, true) {
+    }
+};
+
+typedef boost::shared_ptr<PreparedReceptor> ReceptorPtr;
+
+//bounded LRU of prepared receptors keyed by a hash of the receptor text
+//and the preparation it needs
+class ReceptorCache {
+    struct Entry {
+        string key;
+        string text; //to rule out hash collisions
+        ReceptorPtr rec;
+    };
+    typedef std::list<Entry> EntryList; //most recently used first
+    EntryList entries;
+    std::unordered_map<string, EntryList::iterator> index;
+
+    boost::mutex mu; //protects everything above
+    unsigned capacity;
+    fl cutoff_sqr;
+    unsigned hits;
+    unsigned misses;
+
+    static string key(const string& recstr, bool ispdbqt);
+    static ReceptorPtr prepare(const string& recstr, bool ispdbqt,
+        fl cutoff_sqr);
+  public:
+    ReceptorCache(fl cut, unsigned cap = 16)
+        : capacity(cap), cutoff_sqr(cut), hits(0), misses(0) {
+    }
+
+    //return the receptor described by recstr, which is in pdbqt format if
+    //ispdbqt and otherwise pdb that still has to be protonated and charged;
+    //throws parse_error if it can't be read
+    ReceptorPtr get(const string& recstr, bool ispdbqt);
+
+    void getCounts(unsigned& size, unsigned& nhits, unsigned& nmisses);
+};
+
+#endif /* RECEPTORCACHE_H_ */
@@ -11,6 +11,7 @@
 #include "Logger.h"
 #include "QueryManager.h"
 #include "servercmds.h"
+#include "work_scheduler.h"
 
 using namespace std;
 using namespace boost;
@@ -20,14 +21,20 @@ using namespace boost::asio::ip;
 cl::opt<unsigned> port("port", cl::desc("port used by server"), cl::Required);
 cl::opt<unsigned> maxConcurrent("max-concurrent-requests",
     cl::desc(
-        "block further incoming requests after this amount of concurrency"),
+        "number of requests read and answered at once; further incoming requests are blocked"),
     cl::init(16));
+cl::opt<unsigned> ioThreads("io-threads",
+    cl::desc("number of threads accepting connections"),
+    cl::init(1));
 cl::opt<unsigned> minimizationThreads("threads",
     cl::desc("number of threads to use for minimization"),
     cl::init(max(1U, boost::thread::hardware_concurrency() / 2)));
+cl::opt<unsigned> receptorCache("receptor-cache",
+    cl::desc("number of prepared receptors to keep for reuse by later queries"),
+    cl::init(16));
 cl::opt<string> logfile("logfile", cl::desc("file for logging information"));
 
-typedef unordered_map<string, boost::shared_ptr<Command> > cmd_map;
+typedef boost::unordered_map<string, boost::shared_ptr<Command> > cmd_map;
 
 static void process_request(stream_ptr s, cmd_map& cmap) {
   string cmd;
@@ -46,20 +53,103 @@ static void process_request(stream_ptr s, cmd_map& cmap) {
   }
 }
 
-//periodically check for expired queries
-static void thread_purge_old_queries(QueryManager *qmgr) {
-  while (true) {
-    boost::this_thread::sleep(posix_time::time_duration(0, 3, 0, 0));
-    unsigned npurged = qmgr->purgeOldQueries();
-  }
-}
+//accepts connections asynchronously on the threads running io and
+//processes their requests, which read from the client synchronously, on a
+//pool of maxConcurrent threads; once that many requests are in progress
+//nothing is accepted and new clients wait in the listen backlog
+class Server {
+    io_service& io;
+    tcp::acceptor acceptor;
+    cmd_map& commands;
+    QueryManager& queries;
+    work_scheduler& requests;
+    deadline_timer purgeTimer;
+    deadline_timer acceptTimer; //backs off after failed accepts
+
+    boost::mutex mu;
+    unsigned active; //requests being processed
+    bool accepting; //an accept, or a retry of one, is pending
+
+    void startAccept() {
+      stream_ptr s = stream_ptr(new tcp::iostream());
+      acceptor.async_accept(*s->rdbuf(),
+          boost::bind(&Server::handleAccept, this, s,
+              boost::asio::placeholders::error));
+    }
+
+    void handleAccept(stream_ptr s, const boost::system::error_code& ec) {
+      boost::lock_guard<boost::mutex> L(mu);
+      if (ec) {
+        //e.g. out of file descriptors, retrying right away would just spin
+        cerr << "Error accepting connection: " << ec.message() << "\n";
+        acceptTimer.expires_from_now(posix_time::seconds(1));
+        acceptTimer.async_wait(boost::bind(&Server::handleAcceptRetry, this,
+            boost::asio::placeholders::error));
+        return;
+      }
+      active++;
+      requests.submit(boost::bind(&Server::handleRequest, this, s));
+      accepting = active < maxConcurrent;
+      if (accepting) startAccept();
+    }
+
+    void handleAcceptRetry(const boost::system::error_code& ec) {
+      boost::lock_guard<boost::mutex> L(mu);
+      accepting = active < maxConcurrent;
+      if (accepting) startAccept();
+    }
+
+    void handleRequest(stream_ptr s) {
+      try {
+        process_request(s, commands);
+      } catch (...) { //client went away
+      }
+
+      boost::lock_guard<boost::mutex> L(mu);
+      active--;
+      if (!accepting) {
+        accepting = true;
+        startAccept();
+      }
+    }
+
+    //periodically check for expired queries
+    void startPurge() {
+      purgeTimer.expires_from_now(posix_time::minutes(3));
+      purgeTimer.async_wait(boost::bind(&Server::handlePurge, this,
+          boost::asio::placeholders::error));
+    }
+
+    void handlePurge(const boost::system::error_code& ec) {
+      if (ec) return;
+      queries.purgeOldQueries();
+      startPurge();
+    }
+
+  public:
+    Server(io_service& io_, unsigned port, cmd_map& cmds, QueryManager& q,
+        work_scheduler& reqs)
+        : io(io_), acceptor(io_, tcp::endpoint(tcp::v4(), port)),
+            commands(cmds), queries(q), requests(reqs), purgeTimer(io_),
+            acceptTimer(io_),
+            active(0), accepting(true) {
+      startAccept();
+      startPurge();
+    }
+};
 
 int main(int argc, char *argv[]) {
   cl::ParseCommandLineOptions(argc, argv);
 
+  //minimization threads are shared by all queries
+  if (!work_scheduler::configure_global(minimizationThreads)) {
+    cerr << "Minimization thread pool was already created\n";
+    exit(-1);
+  }
+
   //setup log
   Logger log(logfile);
-  QueryManager queries(minimizationThreads); //initialize query manager
+  QueryManager queries(minimizationThreads, 60 * 30, receptorCache); //initialize query manager
 
   //command map
   cmd_map commands = assign::map_list_of("startmin",
@@ -74,16 +164,16 @@ int main(int argc, char *argv[]) {
 
   //start listening
   io_service io_service;
-  tcp::acceptor a(io_service, tcp::endpoint(tcp::v4(), port));
+  work_scheduler requests(max(1U, (unsigned) maxConcurrent));
+  Server server(io_service, port, commands, queries, requests);
 
   cout << "Listening on port " << port << "\n";
 
-  //start up cleanup thread
-  boost::thread cleanup(thread_purge_old_queries, &queries);
-  while (true) {
-    stream_ptr s = stream_ptr(new tcp::iostream());
-    a.accept(*s->rdbuf());
-    boost::thread t(bind(process_request, s, commands));
-  }
-
+  boost::thread_group iothreads;
+  for (unsigned i = 1; i < ioThreads; i++)
+    iothreads.create_thread([&io_service]() {
+      io_service.run();
+    });
+  io_service.run();
+  iothreads.join_all();
 }
@@ -185,13 +185,16 @@ class GetStatus : public Command {
     void execute(stream_ptr io) {
       unsigned active, inactive, defunct;
       qmgr.getCounts(active, inactive, defunct);
+      unsigned receptors, hits, misses;
+      qmgr.getReceptorCounts(receptors, hits, misses);
       double load = 0;
 
       ifstream ldfile("/proc/loadavg");
       ldfile >> load;
 
       *io << "Active " << active << "\nInactive " << inactive << "\nDefunct "
-          << defunct << "\nLoad " << load << "\n";
+          << defunct << "\nLoad " << load << "\nReceptors " << receptors
+          << " " << hits << " " << misses << "\n";
       io->close();
     }
 };
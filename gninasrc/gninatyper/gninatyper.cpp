@@ -5,6 +5,7 @@
  *      Author: dkoes
  *
  *  Converts a (single) molecule into a binary file of x,y,z,smina atom type (NOT cnn types)
+ *  or packs the molecules of any number of files into a single .molcache2 archive
  */
 
 #include <iostream>
@@ -21,19 +22,64 @@
 
 #include "atom_type.h"
 #include "obmolopener.h"
+#include "molcache.h"
+#include "file.h"
 
 
 using namespace std;
 using namespace boost;
 using namespace OpenBabel;
 
-struct atom_info {
-	float x, y, z;
-	int type;
+typedef gninatypes_atom atom_info;
 
-	atom_info(): x(0), y(0), z(0), type(-1) {}
-	atom_info(float X, float Y, float Z, int T): x(X), y(Y), z(Z), type(T) {}
-};
+//append every molecule of fname to archive, naming the records as the
+//separate files "gninatyper fname base" would have created, with base being
+//fname without its extension(s)
+static void add_to_archive(const string& fname, molcache_writer& archive)
+{
+	OBConversion conv;
+	obmol_opener opener;
+	opener.openForInput(conv, fname);
+
+	boost::filesystem::path p(fname);
+	if (algorithm::ends_with(fname, ".gz"))
+		p.replace_extension("");
+	bool issdf = p.extension() == ".sdf";
+	p.replace_extension("");
+	string base = p.string();
+
+	OBMol mol;
+	int cnt = 0;
+	gninatypes_record atoms;
+	std::istream* in = conv.GetInStream();
+	while (*in)
+	{
+		while (conv.Read(&mol))
+		{
+			mol.AddHydrogens();
+			atoms.clear();
+			FOR_ATOMS_OF_MOL(a, mol)
+			{
+				smt t = obatom_to_smina_type(*a);
+				atoms.push_back(atom_info(a->x(), a->y(), a->z(), t));
+			}
+			string name = base + "_" + lexical_cast<string>(cnt) + ".gninatypes";
+			if (!archive.add(name, atoms))
+				cerr << "Skipping " << name << " since its name is too long\n";
+			cnt++;
+		}
+		if (issdf && *in)
+		{ //tolerate molecular errors
+			string line;
+			while (getline(*in, line))
+			{
+				if (line == "$$$$")
+					break;
+			}
+			if (*in) cerr << "Encountered invalid molecule " << cnt << " in " << fname << "; trying to recover\n";
+		}
+	}
+}
 
 int main(int argc, char *argv[])
 {
@@ -44,6 +90,22 @@ int main(int argc, char *argv[])
 		exit(-1);
 	}
 
+	if(argc >= 3 && algorithm::ends_with(argv[argc-1], ".molcache2"))
+	{
+		//pack all the inputs into one archive that training can read
+		//directly (recmolcache/ligmolcache) instead of a file per molecule
+		try {
+			molcache_writer archive(argv[argc-1]);
+			for(int i = 1; i < argc-1; i++)
+				add_to_archive(argv[i], archive);
+			archive.close();
+		} catch(file_error& e) {
+			cerr << "Error writing output file " << e.name.string() << "\n";
+			exit(1);
+		}
+		return 0;
+	}
+
 	OBConversion conv;
 	obmol_opener opener;
 	opener.openForInput(conv, argv[1]);
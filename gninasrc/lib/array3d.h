@@ -23,7 +23,10 @@
 #ifndef VINA_ARRAY3D_H
 #define VINA_ARRAY3D_H
 
-#include <exception> // std::bad_alloc#include "common.h"
+#include <exception> // std::bad_alloc
+#include <memory>
+#include <boost/serialization/split_member.hpp>
+#include "common.h"
 
 inline sz checked_multiply(sz i, sz j) {
   if (i == 0 || j == 0) return 0;
@@ -40,21 +43,82 @@ template<typename T>
 class array3d {
     sz m_i, m_j, m_k;
     std::vector<T> m_data;
+    T* m_ptr; //&m_data[0], or external memory kept alive by m_owner
+    std::shared_ptr<void> m_owner;
     template<typename U, typename V> friend class array3d_gpu;
     friend class boost::serialization::access;
     template<typename Archive>
-    void serialize(Archive& ar, const unsigned version) {
+    void save(Archive& ar, const unsigned version) const {
+      ar & m_i;
+      ar & m_j;
+      ar & m_k;
+      if (m_owner) {
+        std::vector<T> tmp(m_ptr, m_ptr + size());
+        ar & tmp;
+      } else
+        ar & m_data;
+    }
+    template<typename Archive>
+    void load(Archive& ar, const unsigned version) {
       ar & m_i;
       ar & m_j;
       ar & m_k;
       ar & m_data;
+      m_owner.reset();
+      m_ptr = m_data.empty() ? NULL : &m_data[0];
+    }
+    BOOST_SERIALIZATION_SPLIT_MEMBER()
+
+    void point_at(const array3d& rhs) {
+      if (rhs.m_owner)
+        m_ptr = rhs.m_ptr; //shared, copy on write is up to the owner
+      else
+        m_ptr = m_data.empty() ? NULL : &m_data[0];
     }
   public:
     array3d()
-        : m_i(0), m_j(0), m_k(0) {
+        : m_i(0), m_j(0), m_k(0), m_ptr(NULL) {
     }
     array3d(sz i, sz j, sz k)
-        : m_i(i), m_j(j), m_k(k), m_data(checked_multiply(i, j, k)) {
+        : m_i(i), m_j(j), m_k(k), m_data(checked_multiply(i, j, k)), m_ptr(
+            m_data.empty() ? NULL : &m_data[0]) {
+    }
+    array3d(const array3d& rhs)
+        : m_i(rhs.m_i), m_j(rhs.m_j), m_k(rhs.m_k), m_data(rhs.m_data), m_ptr(
+            NULL), m_owner(rhs.m_owner) {
+      point_at(rhs);
+    }
+    array3d& operator=(const array3d& rhs) {
+      if (this != &rhs) {
+        m_i = rhs.m_i;
+        m_j = rhs.m_j;
+        m_k = rhs.m_k;
+        m_data = rhs.m_data;
+        m_owner = rhs.m_owner;
+        point_at(rhs);
+      }
+      return *this;
+    }
+    //a moved vector keeps its buffer, so m_ptr stays valid
+    array3d(array3d&& rhs)
+        : m_i(rhs.m_i), m_j(rhs.m_j), m_k(rhs.m_k),
+            m_data(std::move(rhs.m_data)), m_ptr(rhs.m_ptr),
+            m_owner(std::move(rhs.m_owner)) {
+      rhs.m_i = rhs.m_j = rhs.m_k = 0;
+      rhs.m_ptr = NULL;
+    }
+    array3d& operator=(array3d&& rhs) {
+      if (this != &rhs) {
+        m_i = rhs.m_i;
+        m_j = rhs.m_j;
+        m_k = rhs.m_k;
+        m_data = std::move(rhs.m_data);
+        m_ptr = rhs.m_ptr;
+        m_owner = std::move(rhs.m_owner);
+        rhs.m_i = rhs.m_j = rhs.m_k = 0;
+        rhs.m_ptr = NULL;
+      }
+      return *this;
     }
     sz dim0() const {
       return m_i;
@@ -78,21 +142,44 @@ class array3d {
         return 0; // to get rid of the warning
       }
     }
+    sz size() const {
+      return m_i * m_j * m_k;
+    }
+    const T* data() const {
+      return m_ptr;
+    }
     void resize(sz i, sz j, sz k) { // data is essentially garbled
+      if (m_owner) {
+        m_owner.reset();
+        m_data.clear();
+      }
       m_i = i;
       m_j = j;
       m_k = k;
       m_data.resize(checked_multiply(i, j, k));
+      m_ptr = m_data.empty() ? NULL : &m_data[0];
+    }
+    //use i*j*k values at ext instead of owned storage; owner is kept
+    //alive for as long as this array or any copy of it refers to ext
+    void attach(sz i, sz j, sz k, T* ext, const std::shared_ptr<void>& owner) {
+      m_data.clear();
+      m_i = i;
+      m_j = j;
+      m_k = k;
+      m_ptr = ext;
+      m_owner = owner;
     }
 
     void clear() {
       m_data.clear();
+      m_owner.reset();
+      m_ptr = NULL;
     }
     T& operator()(sz i, sz j, sz k) {
-      return m_data[i + m_i * (j + m_j * k)];
+      return m_ptr[i + m_i * (j + m_j * k)];
     }
     const T& operator()(sz i, sz j, sz k) const {
-      return m_data[i + m_i * (j + m_j * k)];
+      return m_ptr[i + m_i * (j + m_j * k)];
     }
 };
 
@@ -23,6 +23,7 @@
 #ifndef VINA_ATOM_H
 #define VINA_ATOM_H
 
+#include <memory>
 #include "atom_base.h"
 
 struct atom_index {
@@ -86,4 +87,52 @@ struct atom : public atom_base {
 
 typedef std::vector<atom> atomv;
 
+//receptor atoms do not change once a model is set up, so every copy of the
+//model (one per ligand, one per monte carlo task) shares them; only const
+//access is implicit, mutate() copies them first if they are shared
+class shared_atomv {
+    std::shared_ptr<atomv> data;
+  public:
+    typedef atomv::const_iterator const_iterator;
+
+    shared_atomv()
+        : data(std::make_shared<atomv>()) {
+    }
+    shared_atomv& operator=(const atomv& v) {
+      data = std::make_shared<atomv>(v);
+      return *this;
+    }
+    shared_atomv& operator=(atomv&& v) {
+      data = std::make_shared<atomv>(std::move(v));
+      return *this;
+    }
+
+    sz size() const {
+      return data->size();
+    }
+    bool empty() const {
+      return data->empty();
+    }
+    const atom& operator[](sz i) const {
+      return (*data)[i];
+    }
+    const_iterator begin() const {
+      return data->begin();
+    }
+    const_iterator end() const {
+      return data->end();
+    }
+    const atomv& get() const {
+      return *data;
+    }
+    bool shared() const {
+      return data.use_count() > 1;
+    }
+
+    atomv& mutate() {
+      if (data.use_count() > 1) data = std::make_shared<atomv>(*data);
+      return *data;
+    }
+};
+
 #endif
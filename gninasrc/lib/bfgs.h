@@ -42,6 +42,11 @@ inline void minus_mat_vec_product(const flmat& m, const change& in,
   }
 }
 
+inline void set_diagonal(flmat& m, fl x) {
+  VINA_FOR(i, m.dim())
+    m(i, i) = x;
+}
+
 inline fl scalar_product(const change& a, const change& b, sz n) {
   fl tmp = 0;
   VINA_FOR(i, n)
@@ -49,11 +54,11 @@ inline fl scalar_product(const change& a, const change& b, sz n) {
   return tmp;
 }
 
+//minus_hy is scratch space shaped like y
 inline bool bfgs_update(flmat& h, const change& p, const change& y,
-    const fl alpha) {
+    const fl alpha, change& minus_hy) {
   const fl yp = scalar_product(y, p, h.dim());
   if (alpha * yp < epsilon_fl) return false; // FIXME?
-  change minus_hy(y);
   minus_mat_vec_product(h, y, minus_hy);
   const fl yhy = -scalar_product(y, minus_hy, h.dim());
   const fl r = 1 / (alpha * yp); // 1 / (s^T * y) , where s = alpha * p // FIXME   ... < epsilon
@@ -65,9 +70,38 @@ inline bool bfgs_update(flmat& h, const change& p, const change& y,
   return true;
 }
 
+inline bool bfgs_update(flmat& h, const change& p, const change& y,
+    const fl alpha) {
+  change minus_hy(y);
+  return bfgs_update(h, p, y, alpha, minus_hy);
+}
+
 void bfgs_update(const flmat_gpu& h, const change_gpu& p, const change_gpu& y,
     const fl alpha);
 
+//the buffers of a bfgs minimization; keeping one around (e.g. per thread)
+//means minimizations don't allocate once it has seen a conf of the same
+//shape, since assigning a conf or change of the same shape reuses storage
+template<typename Conf, typename Change>
+struct bfgs_workspace {
+    flmat h;
+    Change g_new, g_orig, p, y, minus_hy;
+    Conf x_new, x_orig;
+
+    //size everything like x and g, h is the identity
+    void prepare(const Conf& x, const Change& g) {
+      h.assign(g.num_floats(), 0);
+      set_diagonal(h, 1);
+      g_new = g;
+      g_orig = g;
+      p = g;
+      y = g;
+      minus_hy = g;
+      x_new = x;
+      x_orig = x;
+    }
+};
+
 //dkoes - this is the line search method used by vina,
 //it is simple and fast, but may return an inappropriately large alpha
 template<typename F, typename Conf, typename Change>
@@ -179,11 +213,6 @@ fl accurate_line_search(F& f, sz n, const Conf& x, const Change& g, const fl f0,
   }
 }
 
-inline void set_diagonal(flmat& m, fl x) {
-  VINA_FOR(i, m.dim())
-    m(i, i) = x;
-}
-
 void set_diagonal(const flmat_gpu& m, fl x);
 
 inline void subtract_change(change& b, const change& a, sz n) { // b -= a
@@ -355,19 +384,20 @@ fl simple_gradient_ascent(F& f, Conf& x, Change& g,
 
 template<typename F, typename Conf, typename Change>
 fl bfgs(F& f, Conf& x, Change& g, const fl average_required_improvement,
-    const minimization_params& params) { // x is I/O, final value is returned
+    const minimization_params& params, bfgs_workspace<Conf, Change>& ws) { // x is I/O, final value is returned
   bool didreset = false;
   sz n = g.num_floats();
-  flmat h(n, 0);
-  set_diagonal(h, 1);
-  Change g_new(g);
-  Conf x_new(x);
+  ws.prepare(x, g);
+  flmat& h = ws.h;
+  Change& g_new = ws.g_new;
+  Conf& x_new = ws.x_new;
   fl f0 = f(x, g);
   fl f_orig = f0;
-  Change g_orig(g);
-  Conf x_orig(x);
+  Change& g_orig = ws.g_orig;
+  g_orig = g;
+  Conf& x_orig = ws.x_orig;
 
-  Change p(g);
+  Change& p = ws.p;
   if (params.outputframes > 0) {
     std::cout << std::setprecision(8);
     std::cout << "f0 " << f0 << "\n";
@@ -423,7 +453,8 @@ fl bfgs(F& f, Conf& x, Change& g, const fl average_required_improvement,
       break; //line direction was wrong, give up
     }
 
-    Change y(g_new);
+    Change& y = ws.y;
+    y = g_new;
     // Update line direction
     subtract_change(y, g, n);
 
@@ -482,7 +513,7 @@ fl bfgs(F& f, Conf& x, Change& g, const fl average_required_improvement,
         set_diagonal(h, alpha * scalar_product(y, p, n) / yy);
     }
 
-    bfgs_update(h, p, y, alpha);
+    bfgs_update(h, p, y, alpha, ws.minus_hy);
   }
 
   if (!(f0 <= f_orig)) { // succeeds for nans too
@@ -498,6 +529,13 @@ fl bfgs(F& f, Conf& x, Change& g, const fl average_required_improvement,
   return f0;
 }
 
+template<typename F, typename Conf, typename Change>
+fl bfgs(F& f, Conf& x, Change& g, const fl average_required_improvement,
+    const minimization_params& params) {
+  bfgs_workspace<Conf, Change> ws;
+  return bfgs(f, x, g, average_required_improvement, params, ws);
+}
+
 template<typename infoT>
 fl bfgs(quasi_newton_aux_gpu<infoT> &f, conf_gpu& x, change_gpu& g,
     const fl average_required_improvement, const minimization_params& params);
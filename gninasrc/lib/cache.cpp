@@ -20,23 +20,34 @@
 
  */
 
-#include <algorithm> // fill, etc#if 0 // use binary cache// for some reason, binary archive gives four huge warnings in VC2008
+#include <algorithm> // fill, etc
+#include <cstdlib>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#if 0 // use binary cache
+// for some reason, binary archive gives four huge warnings in VC2008
 #include <boost/archive/binary_oarchive.hpp>
 #include <boost/archive/binary_iarchive.hpp>
 typedef boost::archive::binary_iarchive iarchive;
 typedef boost::archive::binary_oarchive oarchive;
-#else // use text cache#include <boost/archive/text_oarchive.hpp>
+#else // use text cache
+#include <boost/archive/text_oarchive.hpp>
 #include <boost/archive/text_iarchive.hpp>
 typedef boost::archive::text_iarchive iarchive;
 typedef boost::archive::text_oarchive oarchive;
 #endif 
 
 #include <boost/serialization/split_member.hpp>
+#include <boost/filesystem.hpp>
 #include <boost/filesystem/fstream.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/static_assert.hpp>
 #include "cache.h"
 #include "file.h"
 #include "szv_grid.h"
+#include "work_scheduler.h"
 
 cache::cache(const std::string& scoring_function_version_, const grid_dims& gd_,
     fl slope_)
@@ -98,84 +109,257 @@ void cache::load(Archive& ar, const unsigned version) {
   ar & grids;
 }
 
-void cache::populate(const model& m, const precalculate& p,
-    const std::vector<smt>& atom_types_needed, grid& user_grid,
-    bool display_progress) {
-  std::vector<smt> needed;
-  bool haschargeterms = p.has_components();
+//receptor atoms near a probe point, struct-of-arrays so the per point
+//accumulation over needed types is a simple vectorizable loop
+struct populate_neighbors {
+    std::vector<smt> types;
+    flv r2;
+    flv charge;
+    flv abscharge;
 
-  VINA_FOR_IN(i, atom_types_needed) {
-    smt t = atom_types_needed[i];
-    if (!grids[t].initialized()) {
-      needed.push_back(t);
-      grids[t].init(gd, haschargeterms);
+    void clear() {
+      types.clear();
+      r2.clear();
+      charge.clear();
+      abscharge.clear();
     }
-  }
-  if (needed.empty()) return;
-  flv affinities(needed.size());
-  flv chargeaffinities;
-  if (haschargeterms) chargeaffinities.resize(needed.size());
-
-  sz nat = num_atom_types();
-
-  grid& g = grids[needed.front()];
+    sz size() const {
+      return types.size();
+    }
+};
 
+//fill grid values for z planes [zbegin, zend) of every needed type;
+//each slab has its own szv_grid since the cache is not thread safe
+static void populate_slab(const model& m, const precalculate& p,
+    const grid_dims& gd, const std::vector<smt>& needed,
+    std::vector<grid>& grids, const grid& user_grid, fl slope, sz zbegin,
+    sz zend) {
+  const bool haschargeterms = p.has_components();
   const fl cutoff_sqr = p.cutoff_sqr();
+  const sz nt = needed.size();
+  const grid& g = grids[needed.front()];
 
   szv_grid_cache igcache(m, cutoff_sqr);
   szv_grid ig(igcache, gd);
 
-  VINA_FOR(x, g.data.dim0()) {
+  populate_neighbors near;
+  std::vector<result_components> vals(nt);
+  flv affinities(nt);
+  flv chargeaffinities(nt);
+
+  for (sz z = zbegin; z < zend; z++) {
     VINA_FOR(y, g.data.dim1()) {
-      VINA_FOR(z, g.data.dim2()) {
-        std::fill(affinities.begin(), affinities.end(), 0);
-        std::fill(chargeaffinities.begin(), chargeaffinities.end(), 0);
-        vec probe_coords;
-        probe_coords = g.index_to_argument(x, y, z);
+      VINA_FOR(x, g.data.dim0()) {
+        vec probe_coords = g.index_to_argument(x, y, z);
         const szv& possibilities = ig.possibilities(probe_coords);
+
+        //gather atoms within the cutoff
+        near.clear();
         VINA_FOR_IN(possibilities_i, possibilities) {
-          const sz i = possibilities[possibilities_i];
-          const atom& a = m.grid_atoms[i];
-          const smt t1 = a.get();
+          const atom& a = m.grid_atoms[possibilities[possibilities_i]];
           const fl r2 = vec_distance_sqr(a.coords, probe_coords);
-
           if (r2 <= cutoff_sqr) {
-            VINA_FOR_IN(j, needed) {
-              const smt t2 = needed[j];
-              assert(t2 < nat);
-              //t1 is the receptor atom, a
-              //t2 is type from the ligand, not corresponding to any
-              //particular atom
-              result_components val = p.eval_fast(t1, t2, r2);
-              if (haschargeterms) {
-                //affinities contains the terms that are independent of
-                //the ligand atom charge
-
-                affinities[j] += val[result_components::TypeDependentOnly]
-                    + val[result_components::AbsAChargeDependent]
-                        * fabs(a.charge);
-                //this component must be multiplied by the ligand atom charge
-                chargeaffinities[j] +=
-                    val[result_components::AbsBChargeDependent]
-                        + val[result_components::ABChargeDependent] * a.charge; //not abs value
-              } else {
-                affinities[j] += val[result_components::TypeDependentOnly];
-              }
+            near.types.push_back(a.get());
+            near.r2.push_back(r2);
+            near.charge.push_back(a.charge);
+            near.abscharge.push_back(fabs(a.charge));
+          }
+        }
+
+        std::fill(affinities.begin(), affinities.end(), 0);
+        std::fill(chargeaffinities.begin(), chargeaffinities.end(), 0);
+        VINA_FOR(i, near.size()) {
+          //receptor type is t1, needed ligand types are t2
+          p.eval_fast_many(near.types[i], &needed[0], nt, near.r2[i],
+              &vals[0]);
+          if (haschargeterms) {
+            //affinities contains the terms that are independent of
+            //the ligand atom charge; chargeaffinities must be multiplied
+            //by the ligand atom charge
+            const fl q = near.charge[i];
+            const fl absq = near.abscharge[i];
+            VINA_FOR(j, nt) {
+              const result_components& val = vals[j];
+              affinities[j] += val[result_components::TypeDependentOnly]
+                  + val[result_components::AbsAChargeDependent] * absq;
+              chargeaffinities[j] += val[result_components::AbsBChargeDependent]
+                  + val[result_components::ABChargeDependent] * q; //not abs value
             }
+          } else {
+            VINA_FOR(j, nt)
+              affinities[j] += vals[j][result_components::TypeDependentOnly];
           }
         }
-        VINA_FOR_IN(j, needed) {
-          sz t = needed[j];
-          assert(t < nat);
-          grids[t].data(x, y, z) = affinities[j]; //+ user_grid.evaluate_user(vec(x, y, z));
-          if (haschargeterms)
-            grids[t].chargedata(x, y, z) = chargeaffinities[j];
-
-          if (user_grid.initialized())
-            grids[t].data(x, y, z) += user_grid.evaluate_user(vec(x, y, z),
-                slope);
+
+        fl user = 0;
+        if (user_grid.initialized())
+          user = user_grid.evaluate_user(vec(x, y, z), slope);
+        VINA_FOR(j, nt) {
+          grid& gt = grids[needed[j]];
+          gt.data(x, y, z) = affinities[j] + user;
+          if (haschargeterms) gt.chargedata(x, y, z) = chargeaffinities[j];
         }
       }
     }
   }
 }
+
+//layout of an on-disk grid: this header, the data values and then, if
+//hascharge, the chargedata values, all in native byte order
+struct grid_file_header {
+    char magic[8];
+    boost::uint32_t version;
+    boost::uint32_t float_size;
+    boost::uint64_t key;
+    boost::uint64_t dims[3];
+    boost::uint64_t hascharge;
+};
+
+static const char grid_file_magic[8] = { 'G', 'N', 'I', 'N', 'A', 'G', 'R',
+    'D' };
+static const boost::uint32_t grid_file_version = 1;
+
+std::string cache::disk_key(const model& m, const grid_dims& gd,
+    const std::string& signature) {
+  key_hash hash;
+  hash.add(signature.data(), signature.size());
+  VINA_FOR(i, 3) {
+    hash.add(gd[i].begin);
+    hash.add(gd[i].end);
+    hash.add(boost::uint64_t(gd[i].n));
+  }
+  VINA_FOR_IN(i, m.grid_atoms) {
+    const atom& a = m.grid_atoms[i];
+    hash.add(boost::uint32_t(a.get()));
+    hash.add(a.charge);
+    VINA_FOR(j, 3)
+      hash.add(a.coords[j]);
+  }
+
+  return hash.str();
+}
+
+void cache::set_disk_cache(const std::string& dir, const std::string& key) {
+  disk_dir = dir;
+  disk_name = key;
+}
+
+std::string cache::grid_path(smt t) const {
+  boost::filesystem::path p(disk_dir);
+  p /= disk_name + "." + smina_type_to_string(t) + ".grid";
+  return p.string();
+}
+
+//map a previously stored grid of type t, returns false if there is none
+//(or it is unusable, in which case it will be overwritten)
+bool cache::load_grid(smt t, bool haschargeterms) {
+  std::string path = grid_path(t);
+  if (!boost::filesystem::exists(path)) return false;
+
+  //private mapping, pages are shared until written to
+  std::shared_ptr<boost::iostreams::mapped_file> file(
+      new boost::iostreams::mapped_file());
+  try {
+    file->open(path, boost::iostreams::mapped_file::priv);
+  } catch (std::exception&) {
+    return false;
+  }
+
+  sz n = (gd[0].n + 1) * (gd[1].n + 1) * (gd[2].n + 1);
+  sz nvals = haschargeterms ? 2 * n : n;
+  if (file->size() != sizeof(grid_file_header) + nvals * sizeof(fl))
+    return false;
+
+  const grid_file_header *h = (const grid_file_header*) file->const_data();
+  if (memcmp(h->magic, grid_file_magic, sizeof(grid_file_magic)) != 0
+      || h->version != grid_file_version || h->float_size != sizeof(fl)
+      || h->hascharge != haschargeterms) return false;
+  std::stringstream key;
+  key << std::hex << std::setw(16) << std::setfill('0') << h->key;
+  if (key.str() != disk_name) return false;
+  VINA_FOR(i, 3)
+    if (h->dims[i] != gd[i].n + 1) return false;
+
+  fl *vals = (fl*) (file->data() + sizeof(grid_file_header));
+  grids[t].init(gd, vals, haschargeterms ? vals + n : NULL, file);
+  return true;
+}
+
+//write grid of type t to a temporary file and rename it into place so that
+//concurrent runs never see a partial grid; failures just mean the grid
+//will be recomputed next time
+void cache::store_grid(smt t) const {
+  const grid& g = grids[t];
+  boost::filesystem::path path(grid_path(t));
+  boost::filesystem::path tmp = path.string()
+      + boost::filesystem::unique_path(".%%%%-%%%%-%%%%.tmp").string();
+
+  try {
+    boost::filesystem::create_directories(disk_dir);
+
+    grid_file_header h;
+    memcpy(h.magic, grid_file_magic, sizeof(grid_file_magic));
+    h.version = grid_file_version;
+    h.float_size = sizeof(fl);
+    h.key = strtoull(disk_name.c_str(), NULL, 16);
+    VINA_FOR(i, 3)
+      h.dims[i] = g.data.dim(i);
+    h.hascharge = g.chargedata.size() > 0;
+
+    boost::filesystem::ofstream out(tmp, std::ios::binary);
+    out.write((const char*) &h, sizeof(h));
+    out.write((const char*) g.data.data(), g.data.size() * sizeof(fl));
+    if (h.hascharge)
+      out.write((const char*) g.chargedata.data(),
+          g.chargedata.size() * sizeof(fl));
+    out.close();
+
+    if (out)
+      boost::filesystem::rename(tmp, path);
+    else
+      boost::filesystem::remove(tmp);
+  } catch (std::exception&) {
+    boost::system::error_code ec;
+    boost::filesystem::remove(tmp, ec);
+  }
+}
+
+void cache::populate(const model& m, const precalculate& p,
+    const std::vector<smt>& atom_types_needed, grid& user_grid,
+    bool display_progress) {
+  std::vector<smt> needed;
+  bool haschargeterms = p.has_components();
+  //user grid values are folded into the stored grids
+  bool use_disk = !disk_dir.empty() && !user_grid.initialized();
+
+  VINA_FOR_IN(i, atom_types_needed) {
+    smt t = atom_types_needed[i];
+    if (grids[t].initialized()) continue;
+    if (use_disk && load_grid(t, haschargeterms)) continue;
+    needed.push_back(t);
+    grids[t].init(gd, haschargeterms);
+  }
+  if (needed.empty()) return;
+
+  //split into z slabs, a few per thread for load balance (the box is usually
+  //unevenly filled with receptor atoms); array3d is z-major so each slab
+  //writes a contiguous block of every grid
+  work_scheduler& pool = work_scheduler::global();
+  const sz nz = grids[needed.front()].data.dim2();
+  const sz nslabs = std::min(nz, 4 * pool.num_threads());
+  const sz thickness = (nz + nslabs - 1) / nslabs;
+
+  work_scheduler::task_group group;
+  for (sz z = 0; z < nz; z += thickness) {
+    sz zend = std::min(nz, z + thickness);
+    pool.spawn(group, [&, z, zend]() {
+      populate_slab(m, p, gd, needed, grids, user_grid, slope, z, zend);
+    });
+  }
+  pool.wait(group);
+
+  if (use_disk) {
+    VINA_FOR_IN(j, needed)
+      store_grid(needed[j]);
+  }
+}
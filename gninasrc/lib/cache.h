@@ -50,12 +50,28 @@ struct cache : public igrid {
     virtual ~cache() {
     }
     ;
+
+    //read grids of missing types from, and write newly computed grids to,
+    //files in dir named after key (from disk_key) so they can be shared by
+    //later runs; files are memory mapped rather than read
+    void set_disk_cache(const std::string& dir, const std::string& key);
+    //identifies the grids of the receptor (grid atoms) of m in box gd;
+    //signature must describe everything else the values depend on
+    //(terms, weights, approximation, atom parameters)
+    static std::string disk_key(const model& m, const grid_dims& gd,
+        const std::string& signature);
   private:
     std::string scoring_function_version;
     atomv atoms; // for verification
     grid_dims gd;
     fl slope; // does not get (de-)serialized
     std::vector<grid> grids;
+    std::string disk_dir; //empty if grids are not cached on disk
+    std::string disk_name;
+
+    std::string grid_path(smt t) const;
+    bool load_grid(smt t, bool haschargeterms);
+    void store_grid(smt t) const;
     friend class boost::serialization::access;
     friend class cache_gpu;
     template<class Archive>
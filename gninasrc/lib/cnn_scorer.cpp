@@ -9,12 +9,15 @@
 #include "gridoptions.h"
 
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/layers/direct_conv_layer.hpp"
 #include "caffe/layers/pooling_layer.hpp"
 #include "caffe/util/math_functions.hpp"
 #include <google/protobuf/io/coded_stream.h>
 #include <google/protobuf/io/zero_copy_stream_impl.h>
 #include <google/protobuf/text_format.h>
 #include <boost/algorithm/string.hpp>
+#include <atomic>
+#include <algorithm>
 
 #include "cnn_data.h"
 
@@ -88,11 +91,214 @@ static void setup_mgridparm(caffe::MolGridDataParameter *mgridparam,
   mgridparam->set_random_translate(0);
 }
 
+//convolve with the direct engine in cpu mode, which doesn't allocate im2col
+//buffers and falls back to im2col where it doesn't apply
+static void use_direct_convolution(NetParameter& param)
+{
+  if (Caffe::mode() != Caffe::CPU)
+    return;
+  for (int i = 0, n = param.layer_size(); i < n; i++)
+  {
+    const LayerParameter& layer = param.layer(i);
+    if (layer.type() == "Convolution"
+        && layer.convolution_param().engine() == ConvolutionParameter_Engine_DEFAULT)
+      param.mutable_layer(i)->mutable_convolution_param()->set_engine(
+          ConvolutionParameter_Engine_DIRECT);
+  }
+}
+
+//the parameters of mgridparam that determine the grids of in memory examples,
+//empty if the grids are randomized (and so can't be shared between nets)
+static string gridding_signature(const caffe::MolGridDataParameter& mgridparam)
+{
+  if (mgridparam.random_rotation() || mgridparam.random_translate() > 0
+      || mgridparam.jitter() > 0 || mgridparam.peturb_ligand())
+    return "";
+
+  //drop everything about the training data and labels
+  caffe::MolGridDataParameter p(mgridparam);
+  p.clear_source();
+  p.clear_source2();
+  p.clear_root_folder();
+  p.clear_root_folder2();
+  p.clear_source_ratio();
+  p.clear_recmolcache();
+  p.clear_ligmolcache();
+  p.clear_batch_size();
+  p.clear_rand_skip();
+  p.clear_shuffle();
+  p.clear_balanced();
+  p.clear_stratify_receptor();
+  p.clear_stratify_affinity_min();
+  p.clear_stratify_affinity_max();
+  p.clear_stratify_affinity_step();
+  p.clear_has_affinity();
+  p.clear_has_rmsd();
+  p.clear_cache_structs();
+  p.clear_prefetch();
+  p.clear_check();
+  return p.SerializeAsString();
+}
+
+//a network parsed from a model definition together with its trained weights;
+//these are loaded once per process and never modified afterwards, scorers
+//build their own nets from param and share the weight blobs of weights
+struct loaded_cnn_model {
+    NetParameter param; //not yet set up for any cnn_options, without fillers
+    caffe::shared_ptr<Net<CNNScorer::Dtype> > weights;
+};
+
+//models are loaded by the first scorer needing them under the lock of their
+//entry, so that loading one model doesn't hold up scorers using others
+struct cnn_registry_entry {
+    boost::mutex mtx;
+    caffe::shared_ptr<const loaded_cnn_model> model; //null until loaded
+};
+
+static boost::mutex cnn_registry_mtx; //guards cnn_registry
+static std::map<string, caffe::shared_ptr<cnn_registry_entry> > cnn_registry;
+static boost::mutex cnn_weights_mtx; //guards first use of the weights
+
+//make the weights of net resident in the memory of the current mode, so
+//that afterwards every scorer sharing them only reads them
+//must be called with cnn_weights_mtx held
+static void make_weights_resident(Net<CNNScorer::Dtype>& net)
+{
+  for (const auto &layer : net.layers())
+    for (const auto &blob : layer->blobs())
+    {
+      blob->cpu_data();
+      if (Caffe::mode() == Caffe::GPU)
+        blob->gpu_data();
+    }
+}
+
+//nets that share the weights of a loaded net would only allocate, and draw
+//random values for, parameters that are replaced before they are used
+static void clear_fillers(NetParameter& param)
+{
+  for (int i = 0, n = param.layer_size(); i < n; i++)
+  {
+    LayerParameter *layer = param.mutable_layer(i);
+    if (layer->has_convolution_param())
+    {
+      layer->mutable_convolution_param()->mutable_weight_filler()->set_type("none");
+      layer->mutable_convolution_param()->mutable_bias_filler()->set_type("none");
+    }
+    if (layer->has_inner_product_param())
+    {
+      layer->mutable_inner_product_param()->mutable_weight_filler()->set_type("none");
+      layer->mutable_inner_product_param()->mutable_bias_filler()->set_type("none");
+    }
+    if (layer->has_scale_param())
+    {
+      layer->mutable_scale_param()->mutable_filler()->set_type("none");
+      layer->mutable_scale_param()->mutable_bias_filler()->set_type("none");
+    }
+  }
+}
+
+//parse the model and load its weights
+static caffe::shared_ptr<const loaded_cnn_model> read_cnn_model(
+    const string &name, const string &mfile, const string &wfile,
+    const cnn_options &opts)
+{
+  caffe::shared_ptr<loaded_cnn_model> ret(new loaded_cnn_model);
+  NetParameter& param = ret->param;
+  if (name.size())
+  {
+    if (cnn_models.count(name) == 0)
+    {
+      throw usage_error("Invalid model name: " + name);
+    }
+
+    const char *model = cnn_models[name].model;
+    google::protobuf::io::ArrayInputStream modeldata(model, strlen(model));
+    bool success = google::protobuf::TextFormat::Parse(&modeldata, &param);
+    if (!success)
+      throw usage_error(
+          "Error with built-in cnn model " + name);
+    UpgradeNetAsNeeded("default", &param);
+  }
+  else
+  {
+    ReadNetParamsFromTextFileOrDie(mfile, &param);
+  }
+  param.mutable_state()->set_phase(TEST);
+  param.set_force_backward(true);
+
+  //the data layer of the weight holding net is never used, any options do
+  NetParameter wnetparam(param);
+  setup_mgridparm(wnetparam.mutable_layer(0)->mutable_molgrid_data_param(),
+      opts, name);
+  use_direct_convolution(wnetparam);
+  ret->weights.reset(new Net<CNNScorer::Dtype>(wnetparam));
+
+  if (name.size())
+  {
+    //load weights
+    NetParameter wparam;
+
+    const unsigned char *weights = cnn_models[name].weights;
+    unsigned int nbytes = cnn_models[name].num_bytes;
+
+    google::protobuf::io::ArrayInputStream weightdata(weights, nbytes);
+    google::protobuf::io::CodedInputStream strm(&weightdata);
+#if GOOGLE_PROTOBUF_VERSION >= 3006000
+    strm.SetTotalBytesLimit(INT_MAX);
+#else
+    strm.SetTotalBytesLimit(INT_MAX, 536870912);
+#endif
+    bool success = wparam.ParseFromCodedStream(&strm);
+    if (!success)
+      throw usage_error("Error with default weights.");
+
+    ret->weights->CopyTrainedLayersFrom(wparam);
+  }
+  else
+  {
+    ret->weights->CopyTrainedLayersFrom(wfile);
+  }
+
+  clear_fillers(param);
+  return ret;
+}
+
+//return the built-in model name, or the model in mfile with weights in wfile
+//if name is empty, parsing and loading it on first use
+//external models are keyed by their paths, so a file edited after it was
+//loaded is not read again; subgrid_dim is the only option that changes the
+//shapes of the weights, so it is part of the key and the other options of
+//the first scorer to load a model don't matter
+static caffe::shared_ptr<const loaded_cnn_model> load_cnn_model(
+    const string &name, const string &mfile, const string &wfile,
+    const cnn_options &opts)
+{
+  string key = name.size() ? "builtin:" + name : mfile + "\n" + wfile;
+  key += "\nsubgrid:" + std::to_string(opts.subgrid_dim);
+  caffe::shared_ptr<cnn_registry_entry> entry;
+  {
+    boost::lock_guard<boost::mutex> guard(cnn_registry_mtx);
+    caffe::shared_ptr<cnn_registry_entry>& found = cnn_registry[key];
+    if (!found)
+      found.reset(new cnn_registry_entry);
+    entry = found;
+  }
+
+  boost::lock_guard<boost::mutex> guard(entry->mtx);
+  if (!entry->model)
+    entry->model = read_cnn_model(name, mfile, wfile, opts);
+  boost::lock_guard<boost::mutex> wguard(cnn_weights_mtx);
+  make_weights_resident(*entry->model->weights);
+  return entry->model;
+}
+
 //initialize from commandline options
 //throw error if missing required info
 CNNScorer::CNNScorer(const cnn_options &opts) :
     cnnopts(opts),
-        mtx(new boost::recursive_mutex), current_center(NAN, NAN, NAN)
+        mtx(new boost::recursive_mutex), replicas(new replica_set),
+        current_center(NAN, NAN, NAN)
 {
   if (cnnopts.cnn_scoring == CNNnone)
     return; //no cnn
@@ -131,70 +337,26 @@ CNNScorer::CNNScorer(const cnn_options &opts) :
     }
   }
 
-  //load built-in models
+  //built-in models, then external models
+  vector<caffe::shared_ptr<const loaded_cnn_model> > loaded;
   for (const auto &name : model_names)
-  {
-    NetParameter param;
-    if (cnn_models.count(name) == 0)
-    {
-      throw usage_error("Invalid model name: " + name);
-    }
-
-    const char *model = cnn_models[name].model;
-    google::protobuf::io::ArrayInputStream modeldata(model, strlen(model));
-    bool success = google::protobuf::TextFormat::Parse(&modeldata, &param);
-    if (!success)
-      throw usage_error(
-          "Error with built-in cnn model " + name);
-    UpgradeNetAsNeeded("default", &param);
-
-    param.mutable_state()->set_phase(TEST);
-
-    LayerParameter *first = param.mutable_layer(0);
-    mgridparams.push_back(first->mutable_molgrid_data_param());
-    setup_mgridparm(mgridparams.back(), cnnopts, name);
-
-    param.set_force_backward(true);
-    auto net = caffe::shared_ptr<caffe::Net < Dtype> >(new Net<Dtype>(param));
-    nets.push_back(net);
-
-    //load weights
-    NetParameter wparam;
-
-    const unsigned char *weights = cnn_models[name].weights;
-    unsigned int nbytes = cnn_models[name].num_bytes;
-
-    google::protobuf::io::ArrayInputStream weightdata(weights, nbytes);
-    google::protobuf::io::CodedInputStream strm(&weightdata);
-#if GOOGLE_PROTOBUF_VERSION >= 3006000
-    strm.SetTotalBytesLimit(INT_MAX);
-#else
-    strm.SetTotalBytesLimit(INT_MAX, 536870912);
-#endif
-    success = wparam.ParseFromCodedStream(&strm);
-    if (!success)
-      throw usage_error("Error with default weights.");
-
-    net->CopyTrainedLayersFrom(wparam);
-  }
-
-  //load external models
+    loaded.push_back(load_cnn_model(name, "", "", cnnopts));
   for (unsigned i = 0, n = cnnopts.cnn_models.size(); i < n; i++)
-  {
-    const string &mfile = cnnopts.cnn_models[i];
-    const string &wfile = cnnopts.cnn_weights[i];
-    NetParameter param;
+    loaded.push_back(load_cnn_model("", cnnopts.cnn_models[i],
+        cnnopts.cnn_weights[i], cnnopts));
 
-    ReadNetParamsFromTextFileOrDie(mfile, &param);
-    param.mutable_state()->set_phase(TEST);
+  for (unsigned i = 0, n = loaded.size(); i < n; i++)
+  {
+    NetParameter param(loaded[i]->param);
     LayerParameter *first = param.mutable_layer(0);
-    mgridparams.push_back(first->mutable_molgrid_data_param());
-    setup_mgridparm(mgridparams.back(), cnnopts, "");
+    setup_mgridparm(first->mutable_molgrid_data_param(), cnnopts,
+        i < model_names.size() ? model_names[i] : "");
+    use_direct_convolution(param);
 
-    param.set_force_backward(true);
+    replicas->params.push_back(param);
     auto net = caffe::shared_ptr<caffe::Net < Dtype> >(new Net<Dtype>(param));
+    net->ShareTrainedLayersWith(loaded[i]->weights.get());
     nets.push_back(net);
-    net->CopyTrainedLayersFrom(wfile);
   }
 
   //check that networks matches our expectations and set mgrids
@@ -233,6 +395,205 @@ CNNScorer::CNNScorer(const cnn_options &opts) :
     }
   }
 
+  //per net debugging output needs every net to grid on its own
+  share_grids(!cnnopts.outputxyz && !cnnopts.gradient_check);
+  sparse_grids(!cnnopts.outputdx && !cnnopts.gradient_check);
+}
+
+void CNNScorer::share_grids(bool enable)
+{
+  vector<string> signatures;
+  grid_leader.clear();
+  for (unsigned i = 0, n = nets.size(); i < n; i++)
+  {
+    signatures.push_back(enable ? gridding_signature(
+        replicas->params[i].layer(0).molgrid_data_param()) : "");
+    grid_leader.push_back(i);
+    if (signatures[i].size() == 0)
+      continue;
+    for (unsigned j = 0; j < i; j++)
+    {
+      if (grid_leader[j] == j && signatures[j] == signatures[i])
+      {
+        grid_leader[i] = j;
+        break;
+      }
+    }
+  }
+  set_grid_sources();
+  sparse_grids(sparse); //a net's tiles come from the net whose grids it uses
+}
+
+//point the mgrid of every net that doesn't grid on its own at the data
+//blob of the net whose grids it uses
+void CNNScorer::set_grid_sources()
+{
+  for (unsigned i = 0, n = nets.size(); i < n; i++)
+  {
+    mgrids[i]->setGridSource(grid_leader[i] != i ?
+        nets[grid_leader[i]]->top_vecs()[0][0] : NULL);
+  }
+}
+
+//edge, in grid points, of the tiles whose occupancy is tracked for sparse grids
+static const unsigned sparse_tile_size = 8;
+
+void CNNScorer::sparse_grids(bool enable)
+{
+  sparse = enable;
+  for (unsigned i = 0, n = nets.size(); i < n; i++)
+  {
+    if (grid_leader[i] == i)
+      mgrids[i]->setTileSize(enable ? sparse_tile_size : 0);
+    //nets using the grids of another net use its occupancy too
+    const GridTiles *tiles =
+        enable ? mgrids[grid_leader[i]]->getTiles() : NULL;
+
+    //follow the grids through pooling layers to the first convolution
+    const vector<caffe::shared_ptr<Layer<Dtype> > > &layers = nets[i]->layers();
+    const Blob<Dtype> *blob = nets[i]->top_vecs()[0][0];
+    for (unsigned l = 1, nl = layers.size(); l < nl; l++)
+    {
+      const vector<Blob<Dtype>*> &bottom = nets[i]->bottom_vecs()[l];
+      if (std::find(bottom.begin(), bottom.end(), blob) == bottom.end())
+        continue;
+      auto pool = dynamic_cast<PoolingLayer<Dtype>*>(layers[l].get());
+      if (pool)
+      {
+        pool->SetInputTiles(tiles);
+        pool->SetSparseBackward(enable && sparse_backward);
+        tiles = enable ? pool->output_tiles() : NULL;
+        blob = nets[i]->top_vecs()[l][0];
+        continue;
+      }
+      auto conv = dynamic_cast<DirectConvolutionLayer<Dtype>*>(layers[l].get());
+      if (conv)
+      {
+        conv->SetInputTiles(tiles);
+        conv->SetSparseBackward(enable && sparse_backward);
+      }
+      break;
+    }
+  }
+}
+
+//let the backward of the layers skipping empty tiles also skip them, which
+//leaves the grid gradient of those zero; that is enough for the gradients
+//of the ligand atoms, which lie in occupied tiles, but not for those of the
+//receptor, as the receptor transformation gradient and flexible residues
+//need, nor for any output of the grid gradient
+void CNNScorer::sparse_backward_grids(bool enable)
+{
+  if (enable != sparse_backward)
+  {
+    sparse_backward = enable;
+    sparse_grids(sparse);
+  }
+}
+
+//set group to the nets that use the grids of net leader, leader first
+void CNNScorer::grid_group(unsigned leader, vector<unsigned>& group) const
+{
+  group.clear();
+  for (unsigned i = leader, n = nets.size(); i < n; i++)
+  {
+    if (grid_leader[i] == leader)
+      group.push_back(i);
+  }
+}
+
+//backpropagate every net of group, which use the grids of the first;
+//the grid gradients are summed into the data diff of the first net so the
+//atom gradients of the whole group are computed once, by its mgrid
+void CNNScorer::backward_group(const vector<unsigned>& group)
+{
+  auto leader = nets[group[0]];
+  if (group.size() == 1)
+  {
+    leader->Backward();
+    return;
+  }
+
+  leader->BackwardTo(1);
+  Blob<Dtype> *data = leader->top_vecs()[0][0];
+  for (unsigned k = 1, n = group.size(); k < n; k++)
+  {
+    auto net = nets[group[k]];
+    net->BackwardTo(1);
+    const Blob<Dtype> *diff = net->top_vecs()[0][0];
+    if (Caffe::mode() == Caffe::GPU)
+      caffe_gpu_axpy(data->count(), Dtype(1), diff->gpu_diff(),
+          data->mutable_gpu_diff());
+    else
+      caffe_axpy(data->count(), Dtype(1), diff->cpu_diff(),
+          data->mutable_cpu_diff());
+  }
+  leader->BackwardFromTo(0, 0);
+}
+
+CNNScorer CNNScorer::clone() const
+{
+  static std::atomic<unsigned long> clones(0);
+  CNNScorer ret(*this);
+  ret.cnnopts.thread_replicas = true;
+  ret.current_center = vec(NAN, NAN, NAN);
+  ret.clone_id = ++clones;
+  return ret;
+}
+
+//return the copy of the networks for the calling thread, creating it if needed,
+//set up to score with the options and center of this scorer
+CNNScorer& CNNScorer::thread_replica()
+{
+  CNNScorer &r = *create_replica();
+  r.cnnopts = cnnopts;
+  r.cnnopts.thread_replicas = false;
+  if (r.clone_id != clone_id)
+  {
+    r.receptor_coords.clear();
+    r.receptor_smtypes.clear();
+    r.clone_id = clone_id;
+  }
+  if (r.grid_leader != grid_leader)
+  {
+    r.grid_leader = grid_leader;
+    r.set_grid_sources();
+    r.sparse_grids(sparse);
+  }
+  else if (r.sparse != sparse)
+    r.sparse_grids(sparse);
+  boost::lock_guard<boost::recursive_mutex> guard(*mtx);
+  r.current_center = current_center;
+  return r;
+}
+
+caffe::shared_ptr<CNNScorer> CNNScorer::create_replica()
+{
+  boost::lock_guard<boost::mutex> guard(replicas->mtx);
+  caffe::shared_ptr<CNNScorer>& r = replicas->by_thread[boost::this_thread::get_id()];
+  if (!r)
+  {
+    r.reset(new CNNScorer);
+    for (unsigned i = 0, n = nets.size(); i < n; i++)
+    {
+      {
+        //make the shared weights resident now, they are only read from here on
+        boost::lock_guard<boost::mutex> guard(cnn_weights_mtx);
+        make_weights_resident(*nets[i]);
+      }
+
+      auto net = caffe::shared_ptr<caffe::Net<Dtype> >(
+          new Net<Dtype>(replicas->params[i]));
+      net->ShareTrainedLayersWith(nets[i].get());
+      r->nets.push_back(net);
+      r->mgrids.push_back(
+          dynamic_cast<MolGridDataLayer<Dtype>*>(net->layers()[0].get()));
+    }
+    r->grid_leader = grid_leader;
+    r->set_grid_sources();
+    r->sparse_grids(sparse);
+  }
+  return r;
 }
 
 //returns gradient scores per atom
@@ -295,6 +656,7 @@ void CNNScorer::lrp(const model &m, const string &layer_to_ignore,
   if(mgrids.size() != 1) throw usage_error("Relevance visualization does not support model ensembles yet");
   auto& mgrid = mgrids[0];
   auto net = nets[0];
+  sparse_grids(false); //the whole grid gradient is visualized
   caffe::Caffe::set_random_seed(cnnopts.seed); //same random rotations for each ligand..
 
   setLigand(m);
@@ -333,6 +695,7 @@ void CNNScorer::gradient_setup(const model &m, const string &recname,
   if(mgrids.size() != 1) throw usage_error("Gradient visualization does not support model ensembles yet");
   auto& mgrid = mgrids[0];
   auto net = nets[0];
+  sparse_grids(false); //the whole grid gradient is visualized
   caffe::Caffe::set_random_seed(cnnopts.seed); //same random rotations for each ligand..
 
   setLigand(m);
@@ -437,18 +800,19 @@ void CNNScorer::set_center_from_model(model &m)
 }
 
 //populate score and aff with current network output
-void CNNScorer::get_net_output(caffe::shared_ptr<caffe::Net<Dtype> >& net, Dtype &score, Dtype &aff, Dtype &loss)
+//for a batch, the outputs of example batch_idx (loss is for the whole batch)
+void CNNScorer::get_net_output(caffe::shared_ptr<caffe::Net<Dtype> >& net, Dtype &score, Dtype &aff, Dtype &loss, unsigned batch_idx)
 {
   const caffe::shared_ptr<Blob<Dtype> > outblob = net->blob_by_name("output");
   const caffe::shared_ptr<Blob<Dtype> > lossblob = net->blob_by_name("loss");
   const caffe::shared_ptr<Blob<Dtype> > affblob = net->blob_by_name("predaff");
 
   const Dtype *out = outblob->cpu_data();
-  score = out[1];
+  score = out[2 * batch_idx + 1];
   aff = 0.0;
   if (affblob)
   {
-    aff = affblob->cpu_data()[0];
+    aff = affblob->cpu_data()[batch_idx];
   }
 
   loss = lossblob->cpu_data()[0];
@@ -594,18 +958,18 @@ void CNNScorer::setReceptor(const model &m)
 }
 
 // Get ligand (and flexible receptor) gradient
-void CNNScorer::getGradient(caffe::MolGridDataLayer<Dtype> *mgrid)
+void CNNScorer::getGradient(caffe::MolGridDataLayer<Dtype> *mgrid, unsigned batch_idx)
 {
   gradient.reserve(ligand_coords.size() + num_flex_atoms);
 
 // Get ligand gradient
-  mgrid->getLigandGradient(0, gradient);
+  mgrid->getLigandGradient(batch_idx, gradient);
 
 // Get receptor gradient
   std::vector<gfloat3> gradient_rec;
   if (num_flex_atoms != 0)
   { // Optimization of flexible residues
-    mgrid->getReceptorGradient(0, gradient_rec);
+    mgrid->getReceptorGradient(batch_idx, gradient_rec);
   }
 
 // Merge ligand and flexible residues gradient
@@ -616,6 +980,54 @@ void CNNScorer::getGradient(caffe::MolGridDataLayer<Dtype> *mgrid)
   CHECK_EQ(gradient.size(), ligand_coords.size() + num_flex_atoms);
 }
 
+//position the receptor and ligand last extracted from m as example batch_idx of mgrid
+void CNNScorer::setupMolGrid(caffe::MolGridDataLayer<Dtype> *mgrid,
+    const model &m, bool compute_gradient, unsigned batch_idx)
+{
+  if (!isnan(cnnopts.cnn_center[0]))
+  {
+    mgrid->setGridCenter(cnnopts.cnn_center);
+    current_center = mgrid->getGridCenter();
+  }
+  else if (!isnan(current_center[0]))
+  {
+    mgrid->setGridCenter(current_center);
+  }
+
+  mgrid->setLigand(ligand_coords, ligand_smtypes, cnnopts.move_minimize_frame,
+      batch_idx);
+
+  if (!cnnopts.move_minimize_frame)
+  { //if fixed_receptor, rec_conf will be identify
+    mgrid->setReceptor(receptor_coords, receptor_smtypes, m.rec_conf.position,
+        m.rec_conf.orientation, batch_idx);
+  }
+  else
+  { //don't move receptor
+    mgrid->setReceptor(receptor_coords, receptor_smtypes, {}, {}, batch_idx);
+    current_center = mgrid->getGridCenter(); //has been recalculated from ligand
+    if (cnnopts.verbose)
+    {
+      std::cout << "current center: ";
+      current_center.print(std::cout);
+      std::cout << "\n";
+    }
+  }
+
+  if (compute_gradient || cnnopts.outputxyz)
+  {
+    mgrid->enableLigandGradients();
+    if (cnnopts.moving_receptor() || cnnopts.outputxyz)
+    {
+      mgrid->enableReceptorGradients();
+    }
+    else if (num_flex_atoms != 0)
+    {
+      mgrid->enableReceptorGradients(); // rmeli: TODO flexres gradients only
+    }
+  }
+}
+
 //return score of model, assumes receptor has not changed from initialization
 //also sets affinity (if available) and loss (for use with minimization)
 //if compute_gradient is set, also adds cnn atom gradient to m.minus_forces
@@ -624,6 +1036,15 @@ void CNNScorer::getGradient(caffe::MolGridDataLayer<Dtype> *mgrid)
 float CNNScorer::score(model &m, bool compute_gradient, float &affinity,
     float &loss, float& variance)
 {
+  if (cnnopts.thread_replicas && initialized())
+  {
+    CNNScorer &r = thread_replica();
+    float ret = r.score(m, compute_gradient, affinity, loss, variance);
+    boost::lock_guard<boost::recursive_mutex> guard(*mtx);
+    current_center = r.current_center;
+    return ret;
+  }
+
   boost::lock_guard<boost::recursive_mutex> guard(*mtx);
   if (!initialized())
     return -1.0;
@@ -650,78 +1071,49 @@ float CNNScorer::score(model &m, bool compute_gradient, float &affinity,
   unsigned nscores = nets.size()*max(cnnopts.cnn_rotations, 1U);
   vector<float> affinities;
   if(nscores > 1) affinities.reserve(nscores);
+  sparse_backward_grids(compute_gradient && !cnnopts.outputxyz
+      && !cnnopts.moving_receptor() && num_flex_atoms == 0);
   for(unsigned i = 0, n = nets.size(); i < n; i++) {
+    if (grid_leader[i] != i)
+      continue; //evaluated along with the net whose grids it uses
     caffe::Caffe::set_random_seed(cnnopts.seed); //same random rotations for each ligand..
     auto net = nets[i];
     auto mgrid = mgrids[i];
+    vector<unsigned> group;
+    grid_group(i, group);
 
-    if (!isnan(cnnopts.cnn_center[0]))
-    {
-      mgrid->setGridCenter(cnnopts.cnn_center);
-      current_center = mgrid->getGridCenter();
-    }
-    else if (!isnan(current_center[0]))
-    {
-      mgrid->setGridCenter(current_center);
-    }
-
-    mgrid->setLigand(ligand_coords, ligand_smtypes, cnnopts.move_minimize_frame);
-
-    if (!cnnopts.move_minimize_frame)
-    { //if fixed_receptor, rec_conf will be identify
-      mgrid->setReceptor(receptor_coords, receptor_smtypes, m.rec_conf.position,
-          m.rec_conf.orientation);
-    }
-    else
-    { //don't move receptor
-      mgrid->setReceptor(receptor_coords, receptor_smtypes);
-      current_center = mgrid->getGridCenter(); //has been recalculated from ligand
-      if (cnnopts.verbose)
-      {
-        std::cout << "current center: ";
-        current_center.print(std::cout);
-        std::cout << "\n";
-      }
-    }
-
-    if (compute_gradient || cnnopts.outputxyz)
-    {
-      mgrid->enableLigandGradients();
-      if (cnnopts.moving_receptor() || cnnopts.outputxyz)
-      {
-        mgrid->enableReceptorGradients();
-      }
-      else if (num_flex_atoms != 0)
-      {
-        mgrid->enableReceptorGradients(); // rmeli: TODO flexres gradients only
-      }
-    }
+    setupMolGrid(mgrid, m, compute_gradient, 0);
 
-    mgrid->setLabels(1); //for now pose optimization only
+    for (unsigned g : group)
+      mgrids[g]->setLabels(1); //for now pose optimization only
     for (unsigned r = 0, n = max(cnnopts.cnn_rotations, 1U); r < n; r++)
     {
-      Dtype s = 0, a = 0, l = 0;
-      net->Forward(); //do all rotations at once if requested
+      for (unsigned g : group)
+      {
+        Dtype s = 0, a = 0, l = 0;
+        nets[g]->Forward(); //do all rotations at once if requested
 
-      get_net_output(net, s, a, l);
-      score += s;
-      if(nscores > 1) affinities.push_back(a);
-      affinity += a;
-      loss += l;
+        get_net_output(nets[g], s, a, l);
+        score += s;
+        if(nscores > 1) affinities.push_back(a);
+        affinity += a;
+        loss += l;
 
-      if (cnnopts.cnn_rotations > 1)
-      {
-        if (cnnopts.verbose) {
-          std::cout << "RotateScore: " << s << "\n";
-          if (a)
-            std::cout << "RotateAff: " << a << "\n";
+        if (cnnopts.cnn_rotations > 1)
+        {
+          if (cnnopts.verbose) {
+            std::cout << "RotateScore: " << s << "\n";
+            if (a)
+              std::cout << "RotateAff: " << a << "\n";
+          }
         }
+        cnt++;
       }
 
       if (compute_gradient || cnnopts.outputxyz)
       {
-        net->Backward();
-        // Get gradient from mgrid into CNNScorer::gradient
+        backward_group(group);
+        // Get gradient of the whole group from mgrid into CNNScorer::gradient
         getGradient(mgrid);
 
         // Update ligand (and flexible residues) gradient
@@ -732,7 +1124,6 @@ float CNNScorer::score(model &m, bool compute_gradient, float &affinity,
           mgrid->getReceptorTransformationGradient(0, m.rec_change.position,
               m.rec_change.orientation);
       }
-      cnt++;
     } //end rotations
 
     if (cnnopts.outputxyz)
@@ -789,6 +1180,153 @@ float CNNScorer::score(model &m, bool compute_gradient, float &affinity,
   return score;
 }
 
+//score every model in ms, which must all be poses of the same receptor and ligand
+//up to cnn_batch_size poses are gridded into each forward pass of a network,
+//or just one if there are random rotations;
+//scores, affinities and variances are the per pose values that score would return
+//if compute_gradient is set, also adds cnn atom gradient to each model's minus_forces
+//ALERT: clears minus forces
+void CNNScorer::score_batch(const std::vector<model*>& ms, bool compute_gradient,
+    std::vector<float>& scores, std::vector<float>& affinities,
+    std::vector<float>& variances)
+{
+  if (cnnopts.thread_replicas && initialized())
+  {
+    CNNScorer &r = thread_replica();
+    r.score_batch(ms, compute_gradient, scores, affinities, variances);
+    boost::lock_guard<boost::recursive_mutex> guard(*mtx);
+    current_center = r.current_center;
+    return;
+  }
+
+  boost::lock_guard<boost::recursive_mutex> guard(*mtx);
+  unsigned N = ms.size();
+  scores.assign(N, -1.0);
+  affinities.assign(N, 0);
+  variances.assign(N, 0);
+  if (!initialized())
+    return;
+
+  //debugging output is per pose; random rotations are drawn per example of
+  //a batch, so a pose would get different rotations than when scored alone
+  if (cnnopts.outputdx || cnnopts.outputxyz || cnnopts.gradient_check
+      || cnnopts.cnn_rotations > 0)
+  {
+    float loss = 0;
+    for (unsigned i = 0; i < N; i++)
+      scores[i] = score(*ms[i], compute_gradient, affinities[i], loss,
+          variances[i]);
+    return;
+  }
+
+  unsigned nrot = max(cnnopts.cnn_rotations, 1U);
+  unsigned nscores = nets.size() * nrot;
+  unsigned maxbatch = max(cnnopts.cnn_batch_size, 1U);
+  vector<float> allaffs; //affinity of every evaluation of a pose, for variance
+
+  for (unsigned start = 0; start < N; start += maxbatch)
+  {
+    unsigned n = min(N - start, maxbatch);
+    allaffs.assign(n * nscores, 0);
+    for (unsigned b = 0; b < n; b++)
+    {
+      ms[start + b]->clear_minus_forces();
+      scores[start + b] = 0;
+    }
+
+    for (unsigned i = 0, nn = nets.size(); i < nn; i++)
+    {
+      if (grid_leader[i] != i)
+        continue; //evaluated along with the net whose grids it uses
+      caffe::Caffe::set_random_seed(cnnopts.seed); //same random rotations for each ligand..
+      auto mgrid = mgrids[i];
+      vector<unsigned> group;
+      grid_group(i, group);
+
+      for (unsigned g : group)
+        mgrids[g]->setBatchSize(n);
+      bool flex = false;
+      for (unsigned b = 0; b < n; b++)
+      {
+        const model &m = *ms[start + b];
+        setLigand(m);
+        setReceptor(m);
+        CHECK_EQ(num_flex_atoms + ligand_coords.size(), m.m_num_movable_atoms);
+        setupMolGrid(mgrid, m, compute_gradient, b);
+        flex = flex || num_flex_atoms != 0;
+      }
+      sparse_backward_grids(compute_gradient && !cnnopts.moving_receptor()
+          && !flex);
+      for (unsigned g : group)
+        mgrids[g]->setLabels(1); //for now pose optimization only
+
+      for (unsigned r = 0; r < nrot; r++)
+      {
+        for (unsigned g : group)
+        {
+          nets[g]->Forward();
+          for (unsigned b = 0; b < n; b++)
+          {
+            Dtype s = 0, a = 0, l = 0;
+            get_net_output(nets[g], s, a, l, b);
+            scores[start + b] += s;
+            affinities[start + b] += a;
+            allaffs[b * nscores + g * nrot + r] = a;
+          }
+        }
+
+        if (compute_gradient)
+        {
+          backward_group(group);
+          //the loss is averaged over the batch, undo that for per pose gradients
+          for (unsigned b = 0; b < n; b++)
+          {
+            model &m = *ms[start + b];
+            getGradient(mgrid, b);
+            for (auto &g : gradient)
+              g = g * (float) n;
+            m.add_minus_forces(gradient);
+
+            if (cnnopts.moving_receptor())
+            {
+              mgrid->getReceptorTransformationGradient(b, m.rec_change.position,
+                  m.rec_change.orientation);
+              m.rec_change.position *= n;
+              m.rec_change.orientation *= n;
+            }
+          }
+        }
+      } //end rotations
+    } //end models loop
+
+    for (unsigned b = 0; b < n; b++)
+    {
+      unsigned p = start + b;
+      if (nscores > 1)
+        ms[p]->scale_minus_forces(1.0 / nscores);
+      scores[p] /= nscores;
+      affinities[p] /= nscores;
+      if (nscores > 1)
+      {
+        float sum = 0;
+        for (unsigned k = 0; k < nscores; k++)
+        {
+          float diff = affinities[p] - allaffs[b * nscores + k];
+          sum += diff * diff;
+        }
+        variances[p] = sum / nscores;
+      }
+      if (cnnopts.verbose)
+        std::cout << std::fixed << std::setprecision(10) << "cnnscore "
+            << scores[p] << "\n";
+    }
+  }
+
+  //leave the networks ready for single pose scoring
+  for (auto mgrid : mgrids)
+    mgrid->setBatchSize(1);
+}
+
 //return only score
 float CNNScorer::score(model &m, float& variance)
 {
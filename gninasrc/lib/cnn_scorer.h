@@ -14,6 +14,8 @@
 #include "caffe/layers/molgrid_data_layer.hpp"
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/recursive_mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <map>
 #include <vector>
 
 #include "model.h"
@@ -32,10 +34,27 @@ class CNNScorer {
   private:
     std::vector<caffe::shared_ptr<caffe::Net<Dtype> > > nets;
     std::vector<caffe::MolGridDataLayer<Dtype> *> mgrids;
-    std::vector<caffe::MolGridDataParameter *> mgridparams;
     cnn_options cnnopts;
-
-    caffe::shared_ptr<boost::recursive_mutex> mtx; //todo, enable parallel scoring
+    //index of the net whose grids each net uses; this is the net itself
+    //unless an earlier net has the same gridding parameters
+    std::vector<unsigned> grid_leader;
+    bool sparse = false; //set by sparse_grids
+    bool sparse_backward = false; //set by sparse_backward_grids
+
+    caffe::shared_ptr<boost::recursive_mutex> mtx; //guards nets, unless scoring with thread replicas
+
+    //with thread_replicas, every thread scores with its own copy of the
+    //networks; the copies share the weight blobs of nets and only have their
+    //own activations (and scratch vectors)
+    struct replica_set {
+        boost::mutex mtx;
+        std::vector<caffe::NetParameter> params; //how each of nets was built
+        std::map<boost::thread::id, caffe::shared_ptr<CNNScorer> > by_thread;
+    };
+    caffe::shared_ptr<replica_set> replicas;
+    //set by clone, a replica last used by a different clone drops the
+    //receptor it extracted for that one
+    unsigned long clone_id = 0;
 
     //scratch vectors to avoid memory reallocation
     std::vector<gfloat3> gradient;
@@ -53,7 +72,15 @@ class CNNScorer {
     void setLigand(const model& m);
     void setReceptor(const model& m);
 
-    void getGradient(caffe::MolGridDataLayer<Dtype> *mgrid);
+    void getGradient(caffe::MolGridDataLayer<Dtype> *mgrid, unsigned batch_idx = 0);
+    CNNScorer& thread_replica();
+    caffe::shared_ptr<CNNScorer> create_replica();
+    void setupMolGrid(caffe::MolGridDataLayer<Dtype> *mgrid, const model& m,
+        bool compute_gradient, unsigned batch_idx);
+    void set_grid_sources();
+    void grid_group(unsigned leader, std::vector<unsigned>& group) const;
+    void backward_group(const std::vector<unsigned>& group);
+    void sparse_backward_grids(bool enable);
 
   public:
     CNNScorer()
@@ -64,6 +91,11 @@ class CNNScorer {
 
     CNNScorer(const cnn_options& opts);
 
+    //a scorer with the networks of this one that evaluates them with per
+    //thread copies, so it can be used concurrently with this scorer and its
+    //other clones; like a newly constructed scorer, it has no center yet
+    CNNScorer clone() const;
+
     bool initialized() const {
       return nets.size() > 0;
     }
@@ -72,6 +104,10 @@ class CNNScorer {
 
     float score(model& m,float& variance); //score only - no gradient
     float score(model& m, bool compute_gradient, float& affinity, float& loss, float& variance);
+    //score several poses with one forward pass per model (and rotation)
+    void score_batch(const std::vector<model*>& ms, bool compute_gradient,
+        std::vector<float>& scores, std::vector<float>& affinities,
+        std::vector<float>& variances);
 
     void outputDX(const std::string& prefix, double scale = 1.0, bool relevance =
         false, std::string layer_to_ignore = "", bool zero_values = false);
@@ -85,6 +121,16 @@ class CNNScorer {
     void gradient_setup(const model& m, const std::string& recname,
         const std::string& ligname, const std::string& layer_to_ignore = "");
 
+    //let nets that grid the same way use the grids of the first of them
+    //(the default, unless per net debugging output is enabled), or grid
+    //every net on its own; not while scoring
+    void share_grids(bool enable);
+
+    //let the layers consuming the grids skip empty tiles of them when
+    //scoring on the cpu; when only the ligand atom gradients are needed,
+    //the grid gradient is then also only computed near atoms
+    void sparse_grids(bool enable);
+
     //readjust center
     void set_center_from_model(model &m);
 
@@ -114,8 +160,13 @@ class CNNScorer {
       if(which >= mgrids.size()) throw usage_error("CNN network doesn't exist");
       return mgrids[which];
     }
+
+    caffe::shared_ptr<caffe::Net<Dtype> > get_net(unsigned which=0) {
+      if(which >= nets.size()) throw usage_error("CNN network doesn't exist");
+      return nets[which];
+    }
   protected:
-    void get_net_output(caffe::shared_ptr<caffe::Net<Dtype> >& net, Dtype& score, Dtype& aff, Dtype& loss);
+    void get_net_output(caffe::shared_ptr<caffe::Net<Dtype> >& net, Dtype& score, Dtype& aff, Dtype& loss, unsigned batch_idx = 0);
     void check_gradient(caffe::shared_ptr<caffe::Net<Dtype> >& net);
 };
 
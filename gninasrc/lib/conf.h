@@ -248,6 +248,9 @@ struct change {
     rigid_change receptor;
     bool include_receptor;
 
+    change()
+        : include_receptor(false) {
+    }
     change(const conf_size& s, bool enable_receptor)
         : ligands(s.ligands.size()), flex(s.flex.size()),
             include_receptor(enable_receptor) {
@@ -21,6 +21,7 @@
  */
 
 #include "coords.h"
+#include <utility>
 
 fl rmsd_upper_bound(const vecv& a, const vecv& b) {
   VINA_CHECK(a.size() == b.size());
@@ -55,3 +56,123 @@ void add_to_output_container(output_container& out, const output_type& t,
   }
   out.sort();
 }
+
+//centroid and radius of gyration of the pose coordinates
+static void shape_of(const vecv& coords, vec& centroid, fl& radius) {
+  centroid = zero_vec;
+  radius = 0;
+  if (coords.empty()) return;
+  VINA_FOR_IN(i, coords)
+    centroid += coords[i];
+  centroid /= coords.size();
+  fl acc = 0;
+  VINA_FOR_IN(i, coords)
+    acc += vec_distance_sqr(coords[i], centroid);
+  radius = std::sqrt(acc / coords.size());
+}
+
+//index of the entry closest to t if it is within min_rmsd, else entries.size()
+//the mean squared distance of paired coordinates is the squared distance of
+//the centroids plus that of the centered coordinates, which is at least the
+//squared difference of the radii, so that sum bounds rmsd^2 from below
+sz output_heap::find_similar(const output_type& t, const vec& centroid,
+    fl radius) const {
+  const fl slack = 1e-3; //rounding in the bound, only costs an exact check
+  sz closest = entries.size();
+  fl best = min_rmsd;
+  VINA_FOR_IN(i, entries) {
+    const entry& en = entries[i];
+    fl bound = vec_distance_sqr(centroid, en.centroid) + sqr(radius - en.radius);
+    if (bound > sqr(best) + slack) continue;
+    fl res = rmsd_upper_bound(t.coords, en.pose->coords);
+    //ties go to the lower energy, which was first in the sorted container
+    if (res < best || (res == best && closest < entries.size()
+        && en.pose->e < entries[closest].pose->e)) {
+      closest = i;
+      best = res;
+    }
+  }
+  return closest;
+}
+
+void output_heap::swap_positions(sz i, sz j) {
+  std::swap(heap[i], heap[j]);
+  entries[heap[i]].position = i;
+  entries[heap[j]].position = j;
+}
+
+void output_heap::sift_up(sz position) {
+  while (position > 0) {
+    sz parent = (position - 1) / 2;
+    if (energy(parent) >= energy(position)) break;
+    swap_positions(parent, position);
+    position = parent;
+  }
+}
+
+void output_heap::sift_down(sz position) {
+  for (;;) {
+    sz largest = position;
+    sz left = 2 * position + 1, right = left + 1;
+    if (left < heap.size() && energy(left) > energy(largest)) largest = left;
+    if (right < heap.size() && energy(right) > energy(largest)) largest = right;
+    if (largest == position) break;
+    swap_positions(largest, position);
+    position = largest;
+  }
+}
+
+template<typename T>
+void output_heap::insert(T&& t) {
+  vec centroid;
+  fl radius;
+  shape_of(t.coords, centroid, radius);
+  sz closest = find_similar(t, centroid, radius);
+  sz replace = entries.size();
+  if (closest < entries.size()) { // have a very similar one
+    if (t.e < entries[closest].pose->e) replace = closest;
+  } else if (entries.size() < max_size) {
+    entry en;
+    en.pose.reset(new output_type(std::forward<T>(t)));
+    en.centroid = centroid;
+    en.radius = radius;
+    en.position = heap.size();
+    heap.push_back(entries.size());
+    entries.push_back(std::move(en));
+    sift_up(heap.size() - 1);
+    return;
+  } else if (!heap.empty() && t.e < energy(0)) {
+    replace = heap[0]; //the worst energy
+  }
+
+  if (replace < entries.size()) {
+    //energy only goes down
+    entry& en = entries[replace];
+    *en.pose = std::forward<T>(t);
+    en.centroid = centroid;
+    en.radius = radius;
+    sift_down(en.position);
+  }
+}
+
+void output_heap::add(const output_type& t) {
+  insert(t);
+}
+
+void output_heap::add(output_type&& t) {
+  insert(std::move(t));
+}
+
+void output_heap::release(output_container& out) {
+  std::vector<output_type*> poses;
+  VINA_FOR_IN(i, entries)
+    poses.push_back(entries[i].pose.release());
+  std::stable_sort(poses.begin(), poses.end(),
+      [](const output_type* a, const output_type* b) {
+        return a->e < b->e;
+      });
+  VINA_FOR_IN(i, poses)
+    out.push_back(poses[i]);
+  entries.clear();
+  heap.clear();
+}
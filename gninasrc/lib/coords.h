@@ -24,9 +24,53 @@
 #define VINA_COORDS_H
 
 #include "conf.h"
-#include "atom.h" // for atomvfl rmsd_upper_bound(const vecv& a, const vecv& b);
+#include <memory>
+#include "atom.h" // for atomv
+
+fl rmsd_upper_bound(const vecv& a, const vecv& b);
 std::pair<sz, fl> find_closest(const vecv& a, const output_container& b);
 void add_to_output_container(output_container& out, const output_type& t,
     fl min_rmsd, sz max_size);
 
+//collects the lowest energy poses under the same rules as
+//add_to_output_container, without sorting or copying on every insert:
+//energies are kept in a max heap so the worst pose is replaced in O(log k),
+//and the exact rmsd is only computed for poses that a bound from the
+//centroid and radius of gyration can't rule out
+class output_heap {
+    struct entry {
+        std::unique_ptr<output_type> pose;
+        vec centroid;
+        fl radius; //root mean square distance from centroid
+        sz position; //in heap
+    };
+    std::vector<entry> entries;
+    szv heap; //indices into entries, highest energy first
+    fl min_rmsd;
+    sz max_size;
+
+    sz find_similar(const output_type& t, const vec& centroid, fl radius) const;
+    fl energy(sz position) const {
+      return entries[heap[position]].pose->e;
+    }
+    void swap_positions(sz i, sz j);
+    void sift_up(sz position);
+    void sift_down(sz position);
+    template<typename T> void insert(T&& t);
+  public:
+    output_heap(fl min_rmsd_, sz max_size_)
+        : min_rmsd(min_rmsd_), max_size(max_size_) {
+    }
+
+    sz size() const {
+      return entries.size();
+    }
+
+    void add(const output_type& t);
+    void add(output_type&& t);
+
+    //append all poses to out in order of energy, leaving this empty
+    void release(output_container& out);
+};
+
 #endif
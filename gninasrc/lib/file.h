@@ -29,8 +29,37 @@
 #include <boost/iostreams/filtering_stream.hpp>
 #include <boost/iostreams/stream.hpp>
 #include <boost/iostreams/device/null.hpp>
+#include <boost/cstdint.hpp>
+#include <iomanip>
+#include <sstream>
 #include "common.h"
 
+//FNV-1a for naming files that are shared between runs; stable across
+//platforms and boost versions unlike boost::hash
+struct key_hash {
+    boost::uint64_t h;
+    key_hash()
+        : h(14695981039346656037ULL) {
+    }
+    void add(const void *data, sz n) {
+      const unsigned char *bytes = (const unsigned char*) data;
+      for (sz i = 0; i < n; i++) {
+        h ^= bytes[i];
+        h *= 1099511628211ULL;
+      }
+    }
+    template<typename T>
+    void add(const T& val) {
+      add(&val, sizeof(T));
+    }
+    //fixed width hex digits of h
+    std::string str() const {
+      std::stringstream ret;
+      ret << std::hex << std::setw(16) << std::setfill('0') << h;
+      return ret.str();
+    }
+};
+
 struct file_error {
     path name;
     bool in;
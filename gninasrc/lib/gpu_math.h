@@ -191,8 +191,8 @@ class array3d_gpu {
     array3d_gpu(const array3d<U>& carr)
         : i(carr.m_i), j(carr.m_j), k(carr.m_k) {
       CUDA_CHECK_GNINA(thread_buffer.alloc(&data, i * j * k * sizeof(T)));
-      definitelyPinnedMemcpy(data, &carr.m_data[0],
-          sizeof(T) * carr.m_data.size(), cudaMemcpyHostToDevice);
+      definitelyPinnedMemcpy(data, carr.data(), sizeof(T) * carr.size(),
+          cudaMemcpyHostToDevice);
     }
 
     __device__ sz dim0() const {
@@ -53,6 +53,22 @@ fl grid::evaluate_user(const vec& location, fl slope, vec *deriv) const {
 void grid::init(const grid_dims& gd, bool hascharged) {
   data.resize(gd[0].n + 1, gd[1].n + 1, gd[2].n + 1);
   if (hascharged) chargedata.resize(gd[0].n + 1, gd[1].n + 1, gd[2].n + 1);
+  set_dims(gd);
+}
+
+void grid::init(const grid_dims& gd, fl* vals, fl* chargevals,
+    const std::shared_ptr<void>& owner) {
+  data.attach(gd[0].n + 1, gd[1].n + 1, gd[2].n + 1, vals, owner);
+  if (chargevals)
+    chargedata.attach(gd[0].n + 1, gd[1].n + 1, gd[2].n + 1, chargevals,
+        owner);
+  else
+    chargedata = array3d<fl>();
+  set_dims(gd);
+}
+
+//set up coordinate transforms, data must already be sized
+void grid::set_dims(const grid_dims& gd) {
   m_init = vec(gd[0].begin, gd[1].begin, gd[2].begin);
   m_range = vec(gd[0].span(), gd[1].span(), gd[2].span());
   assert(m_range[0] > 0);
@@ -51,6 +51,10 @@ class grid { // FIXME rm 'm_', consistent with my new style
     }
     void init(const grid_dims& gd, bool hascharged);
     void init(const grid_dims& gd, std::istream& user_in, fl ug_scaling_factor);
+    //use externally owned values (e.g. a memory mapped file) rather than
+    //allocating; chargevals may be NULL if there are no charge terms
+    void init(const grid_dims& gd, fl* vals, fl* chargevals,
+        const std::shared_ptr<void>& owner);
     vec index_to_argument(sz x, sz y, sz z) const {
       return vec(m_init[0] + m_factor_inv[0] * x,
           m_init[1] + m_factor_inv[1] * y, m_init[2] + m_factor_inv[2] * z);
@@ -62,6 +66,7 @@ class grid { // FIXME rm 'm_', consistent with my new style
         NULL) const;
     fl evaluate_user(const vec& location, fl slope, vec* deriv = NULL) const;
   private:
+    void set_dims(const grid_dims& gd);
     fl evaluate_aux(const array3d<fl>& m_data, const vec& location, fl slope,
         fl v, vec* deriv) const; // sets *deriv if not NULL
     friend class boost::serialization::access;
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <time.h>
+#include <boost/thread/thread.hpp>
 
 using namespace std;
 
@@ -13,6 +14,8 @@ struct gridoptions {
     string outname;
     string recmap;
     string ligmap;
+    string recmolcache; //if set, receptorfile names a record in it
+    string ligmolcache; //if set, ligandfile names a record in it
     vector<string> usergrids;
     string examplegrid;
     double dim;
@@ -20,6 +23,7 @@ struct gridoptions {
     double subgrid_dim;
     fl randtranslate;
     int verbosity;
+    unsigned cpu; //gridding threads for batch output
     int seed;
     bool randrotate;
     bool help;
@@ -32,14 +36,19 @@ struct gridoptions {
     bool gpu;
     bool separate;
     bool use_covalent_radius;
+    bool batch; //all grids in one file
+    bool float16;
+    bool sparse;
     gridoptions()
         :
             //a default dimension of 23.5 yields 48x48x48 gridpoints
             dim(23.5), res(0.5), subgrid_dim(0.0), randtranslate(0.0), 
-            verbosity(1), seed((int) time(NULL)),
+            verbosity(1), cpu(boost::thread::hardware_concurrency()),
+            seed((int) time(NULL)),
             randrotate(false), help(false), version(false),
             timeit(false), outmap(false), binary(false), spherize(false),
-            gpu(false), separate(false), use_covalent_radius(false) {
+            gpu(false), separate(false), use_covalent_radius(false),
+            batch(false), float16(false), sparse(false) {
     }
 };
 
@@ -109,6 +109,11 @@ class triangular_matrix {
     triangular_matrix(sz n, const T& filler_val)
         : m_data(n * (n + 1) / 2, filler_val), m_dim(n) {
     }
+    //like constructing anew, but reuses the storage
+    void assign(sz n, const T& filler_val) {
+      m_data.assign(n * (n + 1) / 2, filler_val);
+      m_dim = n;
+    }
     VINA_MATRIX_DEFINE_OPERATORS // temp macro defined above
     sz dim() const {
       return m_dim;
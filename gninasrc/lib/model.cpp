@@ -101,6 +101,26 @@ class appender {
         update(a[i]);
     }
 
+    //grid atoms are shared with other models, so only copy them if
+    //appending actually changes them: b has grid atoms or some of a's are
+    //bonded to movable/inflex atoms whose indices shift
+    void append(shared_atomv& a, const shared_atomv& b) {
+      bool changed = !b.empty();
+      is_a = true;
+      VINA_FOR_IN(i, a) {
+        if (changed) break;
+        const std::vector<bond>& bonds = a[i].bonds;
+        VINA_FOR_IN(j, bonds) {
+          const atom_index& idx = bonds[j].connected_atom_index;
+          if (!idx.in_grid && operator()(idx.i) != idx.i) {
+            changed = true;
+            break;
+          }
+        }
+      }
+      if (changed) append(a.mutate(), b.get());
+    }
+
     //add b to a
     void append(context& a, const context& b) {
       append(a.pdbqttext, b.pdbqttext);
@@ -403,7 +423,7 @@ void model::strip_hydrogens() {
   }
 
   //set atoms arrays
-  grid_atoms.swap(newgridatoms);
+  grid_atoms = std::move(newgridatoms);
   atoms.swap(newatoms);
 
   m_num_movable_atoms = n_good_moveable;
@@ -38,18 +38,39 @@ fl model::eval_interacting_pairs(const precalculate& p, fl v,
 fl model::eval_interacting_pairs_deriv(const precalculate& p, fl v,
     const interacting_pairs& pairs, const vecv& coords, vecv& forces) const { // adds to forces  // clean up
   const fl cutoff_sqr = p.cutoff_sqr();
+  const sz width = 16; //pairs handed to the precalculate batch kernel at once
   fl e = 0;
-  VINA_FOR_IN(i, pairs) {
-    const interacting_pair& ip = pairs[i];
-    vec r;
-    r = coords[ip.b] - coords[ip.a]; // a -> b
-    fl r2 = sqr(r);
-    if (r2 < cutoff_sqr) {
-      pr tmp = p.eval_deriv(atoms[ip.a], atoms[ip.b], r2);
+  for (sz start = 0, npairs = pairs.size(); start < npairs; start += width) {
+    //gather the pairs of this chunk that are within the cutoff
+    sz close[width];
+    vec r[width];
+    smt ta[width], tb[width];
+    fl qa[width], qb[width], r2[width], pair_e[width], pair_dor[width];
+    sz nclose = 0;
+    for (sz i = start, end = std::min(npairs, start + width); i < end; i++) {
+      const interacting_pair& ip = pairs[i];
+      vec rab = coords[ip.b] - coords[ip.a]; // a -> b
+      fl rab2 = sqr(rab);
+      if (rab2 < cutoff_sqr) {
+        close[nclose] = i;
+        r[nclose] = rab;
+        r2[nclose] = rab2;
+        ta[nclose] = atoms[ip.a].get();
+        tb[nclose] = atoms[ip.b].get();
+        qa[nclose] = atoms[ip.a].charge;
+        qb[nclose] = atoms[ip.b].charge;
+        nclose++;
+      }
+    }
+    if (nclose == 0) continue;
+
+    p.eval_deriv_many(ta, tb, qa, qb, r2, nclose, pair_e, pair_dor);
+    for (sz c = 0; c < nclose; c++) {
+      const interacting_pair& ip = pairs[close[c]];
       vec force;
-      force = tmp.second * r;
-      curl(tmp.first, force, v);
-      e += tmp.first;
+      force = pair_dor[c] * r[c];
+      curl(pair_e[c], force, v);
+      e += pair_e[c];
 
       // FIXME inefficient, if using hard curl
       forces[ip.a] -= force; // we could omit forces on inflex here
@@ -490,10 +490,15 @@ struct model {
     }
     vecv get_heavy_atom_movable_coords() const { // FIXME mv
       vecv tmp;
-      VINA_FOR(i, num_movable_atoms())
-        if (!atoms[i].is_hydrogen()) tmp.push_back(coords[i]);
+      get_heavy_atom_movable_coords(tmp);
       return tmp;
     }
+    //fill out, reusing its storage
+    void get_heavy_atom_movable_coords(vecv& out) const {
+      out.clear();
+      VINA_FOR(i, num_movable_atoms())
+        if (!atoms[i].is_hydrogen()) out.push_back(coords[i]);
+    }
     void check_internal_pairs() const;
     void print_stuff() const; // FIXME rm
     void print_counts(unsigned nrec_atoms) const;
@@ -501,7 +506,7 @@ struct model {
     fl clash_penalty() const;
 
     const atomv& get_fixed_atoms() const {
-      return grid_atoms;
+      return grid_atoms.get();
     }
     const atomv& get_movable_atoms() const {
       return atoms;
@@ -532,7 +537,7 @@ struct model {
     vector_mutable<ligand> ligands;
     sz m_num_movable_atoms;
     atomv atoms; // movable, inflex
-    atomv grid_atoms;
+    shared_atomv grid_atoms; //receptor, shared between copies
     interacting_pairs other_pairs;
 
     //for cnn, allow rigid body movement of receptor
@@ -559,8 +564,8 @@ struct model {
       return (i.in_grid ? grid_atoms[i.i] : atoms[i.i]);
     }
 
-    atom& get_atom(const atom_index& i) {
-      return (i.in_grid ? grid_atoms[i.i] : atoms[i.i]);
+    atom& get_atom(const atom_index& i) { //only for setup, unshares grid atoms
+      return (i.in_grid ? grid_atoms.mutate()[i.i] : atoms[i.i]);
     }
 
     void write_context(const context& c, std::ostream& out) const;
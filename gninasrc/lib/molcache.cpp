@@ -0,0 +1,112 @@
+/*
+ * molcache.cpp
+ *
+ *  Packed archives of gninatypes records.
+ */
+
+#include "molcache.h"
+#include "file.h"
+#include <cstring>
+#include <boost/static_assert.hpp>
+
+BOOST_STATIC_ASSERT(sizeof(gninatypes_atom) == 16);
+
+static const boost::int32_t molcache_version = -1;
+static const sz molcache_header = sizeof(boost::int32_t)
+    + sizeof(boost::uint64_t);
+
+molcache_writer::molcache_writer(const std::string& fname_)
+    : out(fname_, std::ios::binary), fname(fname_) {
+  if (!out) throw file_error(fname, false);
+  boost::uint64_t start = 0; //placeholder for index offset
+  out.write((const char*) &molcache_version, sizeof(molcache_version));
+  out.write((const char*) &start, sizeof(start));
+}
+
+molcache_writer::~molcache_writer() {
+  if (out.is_open()) close();
+}
+
+bool molcache_writer::add(const std::string& name,
+    const gninatypes_record& atoms) {
+  if (name.size() > 255) return false;
+  index.push_back(std::make_pair(name, (boost::uint64_t) out.tellp()));
+  boost::int32_t natoms = atoms.size();
+  out.write((const char*) &natoms, sizeof(natoms));
+  if (natoms > 0)
+    out.write((const char*) &atoms[0], natoms * sizeof(gninatypes_atom));
+  return true;
+}
+
+void molcache_writer::close() {
+  boost::uint64_t start = out.tellp();
+  VINA_FOR_IN(i, index) {
+    unsigned char len = index[i].first.size();
+    out.write((const char*) &len, 1);
+    out.write(index[i].first.data(), len);
+    out.write((const char*) &index[i].second, sizeof(boost::uint64_t));
+  }
+  out.seekp(sizeof(boost::int32_t));
+  out.write((const char*) &start, sizeof(start));
+  out.close();
+  if (!out) throw file_error(fname, false);
+}
+
+molcache_reader::molcache_reader(const std::string& fname) {
+  try {
+    file.open(fname);
+  } catch (std::exception&) {
+    throw file_error(fname, true);
+  }
+
+  const char *data = file.data();
+  sz size = file.size();
+  boost::int32_t version = 0;
+  boost::uint64_t start = 0;
+  if (size < molcache_header) throw file_error(fname, true);
+  memcpy(&version, data, sizeof(version));
+  memcpy(&start, data + sizeof(version), sizeof(start));
+  if (version != molcache_version || start < molcache_header || start > size)
+    throw file_error(fname, true);
+
+  sz pos = start;
+  while (pos < size) {
+    unsigned char len = data[pos];
+    if (pos + 1 + len + sizeof(boost::uint64_t) > size)
+      throw file_error(fname, true); //truncated
+    std::string name(data + pos + 1, len);
+    boost::uint64_t offset = 0;
+    memcpy(&offset, data + pos + 1 + len, sizeof(offset));
+    if (offset < molcache_header || offset + sizeof(boost::int32_t) > start)
+      throw file_error(fname, true);
+    index[name] = offset;
+    pos += 1 + len + sizeof(boost::uint64_t);
+  }
+}
+
+const gninatypes_atom* molcache_reader::get(const std::string& name,
+    sz& natoms) const {
+  natoms = 0;
+  boost::unordered_map<std::string, boost::uint64_t>::const_iterator pos =
+      index.find(name);
+  if (pos == index.end()) return NULL;
+
+  const char *rec = file.data() + pos->second;
+  boost::int32_t n = 0;
+  memcpy(&n, rec, sizeof(n));
+  if (n < 0
+      || pos->second + sizeof(n) + n * sizeof(gninatypes_atom) > file.size())
+    return NULL;
+  natoms = n;
+  //records are only 4 byte aligned, which is all gninatypes_atom needs
+  return (const gninatypes_atom*) (rec + sizeof(n));
+}
+
+bool molcache_reader::get(const std::string& name,
+    gninatypes_record& atoms) const {
+  sz n = 0;
+  const gninatypes_atom *a = get(name, n);
+  if (a == NULL) return false;
+  atoms.assign(a, a + n);
+  return true;
+}
@@ -0,0 +1,83 @@
+/*
+ * molcache.h
+ *
+ *  Packed archives of gninatypes records (x,y,z,smina type per atom), in the
+ *  molcache2 layout that libmolgrid reads for the recmolcache/ligmolcache
+ *  settings of the MolGridData layer:
+ *
+ *    int32 version (-1), uint64 offset of the index
+ *    records: int32 number of atoms, then that many gninatypes_atom
+ *    index, to the end of the file: uint8 name length, name, uint64 offset
+ *
+ *  Lookups by name read straight out of a memory mapping of the file.
+ */
+
+#ifndef GNINA_MOLCACHE_H
+#define GNINA_MOLCACHE_H
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/filesystem/fstream.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
+#include <boost/unordered_map.hpp>
+#include "common.h"
+
+//one atom of a .gninatypes file
+struct gninatypes_atom {
+    float x, y, z;
+    int type; //smina type
+
+    gninatypes_atom()
+        : x(0), y(0), z(0), type(-1) {
+    }
+    gninatypes_atom(float X, float Y, float Z, int T)
+        : x(X), y(Y), z(Z), type(T) {
+    }
+};
+
+typedef std::vector<gninatypes_atom> gninatypes_record;
+
+//appends records to a new archive; the index is written by close
+class molcache_writer {
+    boost::filesystem::ofstream out;
+    std::vector<std::pair<std::string, boost::uint64_t> > index;
+    std::string fname;
+  public:
+    //throws file_error if fname can't be created
+    molcache_writer(const std::string& fname);
+    ~molcache_writer();
+
+    //names are limited to 255 bytes; returns false if the name is too long
+    bool add(const std::string& name, const gninatypes_record& atoms);
+    void close();
+
+    sz size() const {
+      return index.size();
+    }
+};
+
+//read only view of an archive
+class molcache_reader {
+    boost::iostreams::mapped_file_source file;
+    boost::unordered_map<std::string, boost::uint64_t> index;
+  public:
+    //throws file_error if fname can't be read or isn't an archive
+    molcache_reader(const std::string& fname);
+
+    bool has(const std::string& name) const {
+      return index.count(name) > 0;
+    }
+
+    //atoms of record name, pointing into the mapping; NULL if there is none
+    const gninatypes_atom* get(const std::string& name, sz& natoms) const;
+
+    //copy of the atoms of record name, false if there is none
+    bool get(const std::string& name, gninatypes_record& atoms) const;
+
+    sz size() const {
+      return index.size();
+    }
+};
+
+#endif /* GNINA_MOLCACHE_H */
@@ -13,6 +13,13 @@
 #include <boost/timer/timer.hpp>
 #include "GninaConverter.h"
 #include <openbabel/bond.h>
+#include <boost/bind/bind.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <deque>
+#include <exception>
+#include <map>
 
 //create the initial model from the specified receptor files
 //mostly because Matt kept complaining about it, this will automatically create
@@ -107,9 +114,58 @@ void MolGetter::create_init_model(const std::string& rigid_name,
   if (strip_hydrogens) initm.strip_hydrogens();
 }
 
+//a ligand read from the input but not yet converted into a model
+struct MolGetter::ligand_record {
+    std::string name;
+    parsing_struct p;
+    context c;
+    unsigned torsdof;
+    bool valid; //false if the molecule could not be parsed
+
+    ligand_record()
+        : torsdof(0), valid(false) {
+    }
+};
+
+//molecules read and converted ahead of readMoleculeIntoModel; a single
+//thread reads records (openbabel perception relies on shared global state)
+//and the parse threads convert them into models concurrently
+struct MolGetter::parse_ahead {
+    boost::mutex mtx;
+    boost::condition_variable changed;
+    std::deque<std::pair<sz, boost::shared_ptr<ligand_record> > > records; //read, not converted
+    std::map<sz, boost::shared_ptr<model> > converted; //by input position, NULL if unusable
+    sz nread; //records read so far
+    sz next; //input position of the next molecule to return
+    sz capacity; //most records read but not yet returned
+    bool eof;
+    bool stopping;
+    std::exception_ptr error;
+    boost::thread_group threads;
+
+    parse_ahead(sz cap)
+        : nread(0), next(0), capacity(cap), eof(false), stopping(false) {
+    }
+
+    ~parse_ahead() {
+      {
+        boost::lock_guard<boost::mutex> lk(mtx);
+        stopping = true;
+        changed.notify_all();
+      }
+      threads.join_all();
+    }
+};
+
+static void report_parse_error(const std::string& name, const parse_error& e) {
+  std::cerr << "\n\nParse error with molecule " << name << " in file \""
+      << e.file.string() << "\": " << e.reason << '\n';
+}
+
 //setup for reading from fname
 void MolGetter::setInputFile(const std::string &fname)
 {
+  ahead.reset(); //stop reading the previous file
   if (fname.size() > 0) //zer if no_lig
   {
     lpath = path(fname);
@@ -139,47 +195,179 @@ void MolGetter::setInputFile(const std::string &fname)
       VINA_CHECK(conv.SetOutFormat("PDBQT"));
 
     }
+
+    if (parse_threads > 0 && type != PDBQT) {
+      ahead.reset(new parse_ahead(16 * parse_threads));
+      ahead->threads.create_thread(
+          boost::bind(&MolGetter::readAhead, this, ahead.get()));
+      VINA_FOR(i, parse_threads)
+        ahead->threads.create_thread(
+            boost::bind(&MolGetter::convertAhead, this, ahead.get()));
+    }
   }
 }
 
-//initialize model to initm and add next molecule
-//return false if no molecule available;
-bool MolGetter::readMoleculeIntoModel(model &m) {
-  //reinit the model
-  m = initm;
+//read the next ligand of a smina, gnina or openbabel file into r,
+//return false at the end of the input
+bool MolGetter::readRecord(ligand_record& r) {
   switch (type) {
   case SMINA:
   case GNINA: {
-    parsing_struct p;
-    context c;
-    unsigned torsdof = 0;
     if (!infile) return false;
     try {
       boost::archive::binary_iarchive serialin(infile,
           boost::archive::no_header | boost::archive::no_tracking);
-      serialin >> torsdof;
-      serialin >> p;
-      serialin >> c;
+      serialin >> r.torsdof;
+      serialin >> r.p;
+      serialin >> r.c;
+    } catch (boost::archive::archive_exception& e) {
+      return false;
+    }
+    if (r.c.sdftext.valid()) r.name = r.c.sdftext.name;
+    r.valid = true;
+    return true;
+  }
+  case OB: {
+    OpenBabel::OBMol mol;
+    if (!conv.Read(&mol)) return false;
+    r.name = mol.GetTitle();
+    mol.StripSalts();
+    try {
+      r.torsdof = GninaConverter::convertParsing(mol, r.p, r.c,
+          add_hydrogens);
+      r.valid = true;
+    } catch (parse_error& e) {
+      report_parse_error(r.name, e);
+    }
+    return true;
+  }
+  default:
+    return false;
+  }
+}
 
-      non_rigid_parsed nr;
-      postprocess_ligand(nr, p, c, torsdof);
-      VINA_CHECK(nr.atoms_atoms_bonds.dim() == nr.atoms.size());
+//build the ligand model of r, return false if it can't be parsed
+bool MolGetter::convertRecord(ligand_record& r, model& lig) const {
+  if (!r.valid) return false;
+  try {
+    non_rigid_parsed nr;
+    postprocess_ligand(nr, r.p, r.c, r.torsdof);
+    VINA_CHECK(nr.atoms_atoms_bonds.dim() == nr.atoms.size());
 
-      pdbqt_initializer tmp;
-      tmp.initialize_from_nrp(nr, c, true);
-      tmp.initialize(nr.mobility_matrix());
+    pdbqt_initializer tmp;
+    tmp.initialize_from_nrp(nr, r.c, true);
+    tmp.initialize(nr.mobility_matrix());
+    if (strip_hydrogens) tmp.m.strip_hydrogens();
 
-      if (c.sdftext.valid()) {
-        //set name
-        m.set_name(c.sdftext.name);
+    lig = tmp.m;
+    lig.set_name(r.name);
+    return true;
+  } catch (parse_error& e) {
+    report_parse_error(r.name, e);
+    return false;
+  }
+}
+
+//reader thread, stays at most capacity records ahead of the consumer
+void MolGetter::readAhead(parse_ahead *a) {
+  try {
+    for (;;) {
+      {
+        boost::unique_lock<boost::mutex> lk(a->mtx);
+        while (!a->stopping && a->nread - a->next >= a->capacity)
+          a->changed.wait(lk);
+        if (a->stopping) return;
       }
 
-      if (strip_hydrogens) tmp.m.strip_hydrogens();
-      m.append(tmp.m);
+      boost::shared_ptr<ligand_record> r(new ligand_record);
+      if (!readRecord(*r)) break;
 
-      return true;
-    } catch (boost::archive::archive_exception& e) {
-      return false;
+      boost::lock_guard<boost::mutex> lk(a->mtx);
+      a->records.push_back(std::make_pair(a->nread, r));
+      a->nread++;
+      a->changed.notify_all();
+    }
+  } catch (...) {
+    boost::lock_guard<boost::mutex> lk(a->mtx);
+    if (!a->error) a->error = std::current_exception();
+  }
+
+  boost::lock_guard<boost::mutex> lk(a->mtx);
+  a->eof = true;
+  a->changed.notify_all();
+}
+
+//parse thread, converts records in whatever order they are claimed
+void MolGetter::convertAhead(parse_ahead *a) {
+  for (;;) {
+    std::pair<sz, boost::shared_ptr<ligand_record> > rec;
+    {
+      boost::unique_lock<boost::mutex> lk(a->mtx);
+      while (!a->stopping && !a->eof && a->records.empty())
+        a->changed.wait(lk);
+      if (a->stopping || a->records.empty()) return;
+      rec = a->records.front();
+      a->records.pop_front();
+    }
+
+    boost::shared_ptr<model> lig(new model);
+    try {
+      if (!convertRecord(*rec.second, *lig)) lig.reset();
+    } catch (...) {
+      lig.reset();
+      boost::lock_guard<boost::mutex> lk(a->mtx);
+      if (!a->error) a->error = std::current_exception();
+    }
+
+    boost::lock_guard<boost::mutex> lk(a->mtx);
+    a->converted[rec.first] = lig;
+    a->changed.notify_all();
+  }
+}
+
+//initialize model to initm and add next molecule
+//return false if no molecule available;
+bool MolGetter::readMoleculeIntoModel(model &m) {
+  //reinit the model
+  m = initm;
+  if (ahead) {
+    boost::shared_ptr<model> lig;
+    {
+      boost::unique_lock<boost::mutex> lk(ahead->mtx);
+      while (!lig) {
+        if (ahead->error) std::rethrow_exception(ahead->error);
+        std::map<sz, boost::shared_ptr<model> >::iterator pos =
+            ahead->converted.find(ahead->next);
+        if (pos != ahead->converted.end()) {
+          lig = pos->second; //NULL if unparseable, skip it
+          ahead->converted.erase(pos);
+          ahead->next++;
+          ahead->changed.notify_all();
+        } else
+          if (ahead->eof && ahead->next == ahead->nread)
+            return false;
+          else
+            ahead->changed.wait(lk);
+      }
+    }
+    m.set_name(lig->get_name());
+    m.append(*lig);
+    return true;
+  }
+
+  switch (type) {
+  case SMINA:
+  case GNINA:
+  case OB: {
+    for (;;) {
+      ligand_record r;
+      if (!readRecord(r)) return false; //no valid molecules read
+      model lig;
+      if (convertRecord(r, lig)) {
+        m.set_name(lig.get_name());
+        m.append(lig);
+        return true;
+      }
     }
   }
     break;
@@ -192,38 +380,6 @@ bool MolGetter::readMoleculeIntoModel(model &m) {
     return true;
   }
     break;
-  case OB: {
-    OpenBabel::OBMol mol;
-    while (conv.Read(&mol)) //will return after first success
-    {
-      std::string name = mol.GetTitle();
-      mol.StripSalts();
-      m.set_name(name);
-      try {
-        parsing_struct p;
-        context c;
-        unsigned torsdof = GninaConverter::convertParsing(mol, p, c,
-            add_hydrogens);
-        non_rigid_parsed nr;
-        postprocess_ligand(nr, p, c, torsdof);
-        VINA_CHECK(nr.atoms_atoms_bonds.dim() == nr.atoms.size());
-
-        pdbqt_initializer tmp;
-        tmp.initialize_from_nrp(nr, c, true);
-        tmp.initialize(nr.mobility_matrix());
-        if (strip_hydrogens) tmp.m.strip_hydrogens();
-
-        m.append(tmp.m);
-        return true;
-      } catch (parse_error& e) {
-        std::cerr << "\n\nParse error with molecule " << mol.GetTitle()
-            << " in file \"" << e.file.string() << "\": " << e.reason << '\n';
-        continue;
-      }
-    }
-
-    return false; //no valid molecules read
-  }
   case NONE:
     return true; //nolig
     break;
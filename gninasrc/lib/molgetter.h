@@ -11,12 +11,15 @@
 #include "model.h"
 #include "obmolopener.h"
 #include "flexinfo.h"
+#include <boost/shared_ptr.hpp>
 
 //this class abstracts reading molecules from a file
 //we have three means of input:
 //openbabel for general molecular data (default)
 //vina parse_pdbqt for pdbqt files (one ligand, obey rotational bonds)
 //smina format
+//optionally, molecules can be read and converted by background threads
+//ahead of readMoleculeIntoModel, which still returns them in input order
 class MolGetter {
     model initm;
     enum Type {
@@ -37,20 +40,37 @@ class MolGetter {
     //pdbqt data
     bool pdbqtdone;
 
+    //parse ahead data, must be destroyed before the inputs above
+    unsigned parse_threads; //0 converts molecules in readMoleculeIntoModel
+    struct ligand_record;
+    struct parse_ahead;
+    boost::shared_ptr<parse_ahead> ahead;
+
+    bool readRecord(ligand_record& r);
+    bool convertRecord(ligand_record& r, model& lig) const;
+    void readAhead(parse_ahead *a);
+    void convertAhead(parse_ahead *a);
+
   public:
 
     MolGetter(bool addH = true, bool stripH = true)
         : add_hydrogens(addH), strip_hydrogens(stripH), type(NONE),
-            pdbqtdone(false) {
+            pdbqtdone(false), parse_threads(0) {
     }
 
     MolGetter(const std::string& rigid_name, const std::string& flex_name,
         FlexInfo& finfo, bool addH, bool stripH, tee& log)
         : add_hydrogens(addH), strip_hydrogens(stripH), type(NONE),
-            pdbqtdone(false) {
+            pdbqtdone(false), parse_threads(0) {
       create_init_model(rigid_name, flex_name, finfo, log);
     }
 
+    //convert molecules on n threads ahead of readMoleculeIntoModel;
+    //takes effect with the next setInputFile
+    void setParseThreads(unsigned n) {
+      parse_threads = n;
+    }
+
     //create the initial model from the specified receptor files
     void create_init_model(const std::string& rigid_name,
         const std::string& flex_name, FlexInfo& finfo, tee& log);
@@ -52,8 +52,10 @@ void monte_carlo::single_run(model& m, output_type& out, const precalculate& p,
   if (minparms.maxiters == 0) minparms.maxiters = ssd_par.evals;
 
   quasi_newton quasi_newton_par(minparms);
+  output_type candidate(current.c, max_fl);
   VINA_U_FOR(step, num_steps) {
-    output_type candidate(current.c, max_fl);
+    candidate.c = current.c; //reuses the storage of the last step
+    candidate.e = max_fl;
     mutate_conf(candidate.c, m, mutation_amplitude, generator);
     quasi_newton_par(m, p, ig, candidate, g, hunt_cap, user_grid);
     if (step == 0
@@ -102,9 +104,14 @@ void monte_carlo::operator()(model& m, output_container& out,
 
   if (minparms.maxiters == 0) minparms.maxiters = ssd_par.evals;
   quasi_newton quasi_newton_par(minparms);
+  output_heap saved(min_rmsd, num_saved_mins);
+  VINA_FOR_IN(i, out)
+    saved.add(out[i]);
+  out.clear();
+  output_type candidate = tmp;
   VINA_U_FOR(step, num_steps) {
     if (increment_me) ++(*increment_me);
-    output_type candidate = tmp;
+    candidate = tmp; //reuses the storage of the last step
     mutate_conf(candidate.c, m, mutation_amplitude, generator);
 
     if (minparms.single_min) //use full v to begin with
@@ -119,20 +126,21 @@ void monte_carlo::operator()(model& m, output_container& out,
       m.set(tmp.c); // FIXME? useless?
 
       // FIXME only for very promising ones
-      if (tmp.e < best_e || out.size() < num_saved_mins) {
+      if (tmp.e < best_e || saved.size() < num_saved_mins) {
 
         if (!minparms.single_min) { //refine with full v
           quasi_newton_par(m, p, ig, tmp, g, authentic_v, user_grid);
           m.set(tmp.c); // FIXME? useless?
         }
-        tmp.coords = m.get_heavy_atom_movable_coords();
-        add_to_output_container(out, tmp, min_rmsd, num_saved_mins); // 20 - max size
+        m.get_heavy_atom_movable_coords(tmp.coords);
+        saved.add(tmp); //tmp is still the current state
         if (tmp.e < best_e) {
           best_e = tmp.e;
         }
       }
     }
   }
+  saved.release(out);
   VINA_CHECK(!out.empty());
   VINA_CHECK(out.front().e <= out.back().e); // make sure the sorting worked in the correct order
 }
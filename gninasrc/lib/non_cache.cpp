@@ -127,6 +127,7 @@ fl non_cache::eval_deriv(model& m, fl v, const grid& user_grid) const { // clean
   const fl cutoff_sqr = p->cutoff_sqr();
 
   sz n = num_atom_types();
+  const sz width = receptor_block::width;
 
   VINA_FOR(i, m.num_movable_atoms()) {
     const atom& a = m.atoms[i];
@@ -144,25 +145,52 @@ fl non_cache::eval_deriv(model& m, fl v, const grid& user_grid) const { // clean
 
     fl this_e = 0;
     vec deriv(0, 0, 0);
-    const szv& possibilities = sgrid.possibilities(adjusted_a_coords);
-    VINA_FOR_IN(possibilities_j, possibilities) {
-      const sz j = possibilities[possibilities_j];
-      const atom& b = m.grid_atoms[j];
-      smt t2 = b.get();
-      vec r_ba;
-      r_ba = adjusted_a_coords - b.coords;
-      fl r2 = sqr(r_ba);
-      if (r2 < cutoff_sqr) {
-        if (r2 < epsilon_fl) {
-          throw std::runtime_error(
-              "Ligand atom exactly overlaps receptor atom.  I can't deal with this.");
+    const receptor_block& block = sgrid.block(adjusted_a_coords);
+    VINA_FOR_IN(ri, block.runs) {
+      const receptor_block::run& run = block.runs[ri];
+      for (sz k = run.begin; k < run.end; k += width) {
+        fl dx[width], dy[width], dz[width], r2[width];
+        //distances for the whole chunk; padding atoms are never in range
+        for (sz l = 0; l < width; l++) {
+          dx[l] = adjusted_a_coords[0] - block.x[k + l];
+          dy[l] = adjusted_a_coords[1] - block.y[k + l];
+          dz[l] = adjusted_a_coords[2] - block.z[k + l];
+          r2[l] = dx[l] * dx[l] + dy[l] * dy[l] + dz[l] * dz[l];
+        }
+
+        //compact the pairs within the cutoff
+        sz close[width];
+        fl close_r2[width], close_charge[width];
+        smt ta[width], tb[width];
+        fl qa[width];
+        sz nclose = 0;
+        for (sz l = 0; l < width; l++) {
+          if (r2[l] < cutoff_sqr) {
+            if (r2[l] < epsilon_fl) {
+              throw std::runtime_error(
+                  "Ligand atom exactly overlaps receptor atom.  I can't deal with this.");
+            }
+            close[nclose] = l;
+            close_r2[nclose] = r2[l];
+            close_charge[nclose] = block.charge[k + l];
+            ta[nclose] = t1;
+            tb[nclose] = run.type;
+            qa[nclose] = a.charge;
+            nclose++;
+          }
         }
+        if (nclose == 0) continue;
+
         //dkoes - the "derivative" value returned by eval_deriv
         //is normalized by r (dor = derivative over r?)
-        pr e_dor = p->eval_deriv(a, b, r2);
-        this_e += e_dor.first;
-        deriv += e_dor.second * r_ba;
-        vec out_deriv = e_dor.second * r_ba;
+        fl pair_e[width], pair_dor[width];
+        p->eval_deriv_many(ta, tb, qa, close_charge, close_r2, nclose, pair_e,
+            pair_dor);
+        for (sz c = 0; c < nclose; c++) {
+          sz l = close[c];
+          this_e += pair_e[c];
+          deriv += pair_dor[c] * vec(dx[l], dy[l], dz[l]);
+        }
       }
     }
     if (user_grid.initialized()) {
@@ -23,155 +23,75 @@
 #ifndef VINA_PARALLEL_H
 #define VINA_PARALLEL_H
 
+#include <algorithm>
+#include <atomic>
 #include <vector>
 
 #include "common.h"
-#include "device_buffer.h"
-
-#include <boost/optional.hpp>
-#include <boost/thread/thread.hpp>
-#include <boost/thread/mutex.hpp>
-#include <boost/thread/condition.hpp>
-#include "caffe/caffe.hpp"
+#include "work_scheduler.h"
 
+//f(i) is evaluated for every i < size on the process-wide pool using at
+//most num_threads of its threads; thread_init is run only the first time a
+//pool thread executes a loop of this type, not on every call
 template<typename F, typename thread_init_t, bool Sync = false>
-struct parallel_for : private boost::thread_group {
+struct parallel_for {
     parallel_for(const F* f, sz num_threads, thread_init_t thread_init)
-        : m_f(f), tinit(thread_init), destructing(false), size(0),
-            thread_finished(num_threads, true), count_finished(0),
-            num_threads(num_threads) {
-      VINA_FOR(i, num_threads)
-        create_thread(aux(i, this));
-    }
-    void run(sz size_) {
-      boost::mutex::scoped_lock self_lk(self);
-      size = size_;
-      count_finished = 0;
-      VINA_FOR_IN(i, thread_finished)
-        thread_finished[i] = false;
-      cond.notify_all(); // many things modified
-      while (count_finished < num_threads) // wait until processing of all elements is thread_finished
-        busy.wait(self_lk);
+        : m_f(f), tinit(thread_init), num_threads(num_threads) {
     }
-    virtual ~parallel_for() {
-      {
-        boost::mutex::scoped_lock self_lk(self);
-        destructing = true;
-        cond.notify_all(); // destructing modified
-      }
-      join_all();
+    void run(sz size) {
+      work_scheduler& pool = work_scheduler::global();
+      work_scheduler::task_group group;
+      sz stride = std::min(num_threads, size);
+      VINA_FOR(offset, stride)
+        pool.spawn(group, [this, offset, stride, size]() {
+          init_thread();
+          for (sz i = offset; i < size; i += stride)
+            (*m_f)(i);
+        });
+      pool.wait(group);
     }
   private:
-    void loop(sz offset) {
-      tinit();
-      while (boost::optional<sz> sz_option = get_size(offset)) {
-        sz s = sz_option.get();
-        for (sz i = offset; i < s; i += num_threads)
-          (*m_f)(i);
-        {
-          boost::mutex::scoped_lock self_lk(self);
-          thread_finished[offset] = true;
-          ++count_finished;
-          busy.notify_one();
-        }
+    void init_thread() {
+      static thread_local bool initialized = false;
+      if (!initialized) {
+        initialized = true;
+        tinit();
       }
     }
-    struct aux {
-        sz offset;
-        parallel_for* par;
-        aux(sz offset, parallel_for* par)
-            : offset(offset), par(par) {
-        }
-        void operator()() const {
-          par->loop(offset);
-        }
-    };
     const F* m_f; // does not keep a local copy!
     thread_init_t tinit;
-    boost::condition cond;
-    boost::condition busy;
-    bool destructing; // dtor called
-    sz size; // size of the vector given to run()
-    std::vector<bool> thread_finished;
-    sz count_finished;
     sz num_threads;
-    boost::mutex self; // any modification or reading of mutables should lock this first
-    boost::optional<sz> get_size(sz offset) {
-      boost::mutex::scoped_lock self_lk(self);
-      while (!destructing && thread_finished[offset])
-        cond.wait(self_lk);
-      if (destructing) return boost::optional<sz>(); // wrap it up!
-      return size;
-    }
 };
 
+//elements are handed out one at a time, for jobs of uneven length
 template<typename F, typename thread_init_t>
-struct parallel_for<F, thread_init_t, true> : private boost::thread_group {
+struct parallel_for<F, thread_init_t, true> {
     parallel_for(const F* f, sz num_threads, thread_init_t thread_init)
-        : m_f(f), tinit(thread_init), destructing(false), size(0), started(0),
-            finished(0) {
-      a.par = this; // VC8 warning workaround
-      VINA_FOR(i, num_threads)
-        create_thread(boost::ref(a));
+        : m_f(f), tinit(thread_init), num_threads(num_threads) {
     }
-    void run(sz size_) {
-      boost::mutex::scoped_lock self_lk(self);
-      size = size_;
-      finished = 0;
-      started = 0;
-      cond.notify_all(); // many things modified
-      while (finished < size) // wait until processing of all elements is finished
-        busy.wait(self_lk);
-    }
-    virtual ~parallel_for() {
-      {
-        boost::mutex::scoped_lock self_lk(self);
-        destructing = true;
-        cond.notify_all(); // destructing modified
-      }
-      join_all();
+    void run(sz size) {
+      work_scheduler& pool = work_scheduler::global();
+      work_scheduler::task_group group;
+      std::atomic<sz> next(0);
+      VINA_FOR(t, std::min(num_threads, size))
+        pool.spawn(group, [this, &next, size]() {
+          init_thread();
+          for (sz i = next++; i < size; i = next++)
+            (*m_f)(i);
+        });
+      pool.wait(group);
     }
   private:
-    void loop() {
-      tinit();
-      while (boost::optional<sz> i = get_next()) {
-        (*m_f)(i.get());
-        {
-          boost::mutex::scoped_lock self_lk(self);
-          ++finished;
-          busy.notify_one();
-        }
+    void init_thread() {
+      static thread_local bool initialized = false;
+      if (!initialized) {
+        initialized = true;
+        tinit();
       }
     }
-    struct aux {
-        parallel_for* par;
-        aux()
-            : par(NULL) {
-        }
-        void operator()() const {
-          par->loop();
-        }
-    };
-    aux a;
     const F* m_f; // does not keep a local copy!
     thread_init_t tinit;
-    boost::condition cond;
-    boost::condition busy;
-    bool destructing; // dtor called
-    sz size; // size of the vector given to run() // FIXME?
-    sz started; // the number of jobs given to run() the work started on
-    sz finished; // the number of jobs given to run() the work finished on
     sz num_threads;
-    boost::mutex self; // any modification or reading of mutables should lock this first
-    boost::optional<sz> get_next() {
-      boost::mutex::scoped_lock self_lk(self);
-      while (!destructing && started >= size)
-        cond.wait(self_lk);
-      if (destructing) return boost::optional<sz>(); // NOTHING
-      sz tmp = started;
-      ++started;
-      return tmp;
-    }
 };
 
 template<typename F, typename Container, typename Input, typename thread_init_t,
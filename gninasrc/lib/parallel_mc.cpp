@@ -142,7 +142,7 @@ struct parallel_mc_aux {
         t.m.gdata.bfs_order_dfs_indices = bfs_order_dfs_indices;
       }
       if (cnn) {
-        CNNScorer cnn_scorer(cnn->get_scorer().options());
+        CNNScorer cnn_scorer = cnn->get_scorer().clone();
         const precalculate* p = cnn->get_precalculate();
         szv_grid_cache gridcache(t.m, p->cutoff_sqr());
         non_cache_cnn new_cnn(gridcache, cnn->get_grid_dims(), p,
@@ -157,19 +157,21 @@ struct parallel_mc_aux {
 
 //TODO: null model.gdata pointers at task exit
 
-void merge_output_containers(const output_container& in, output_container& out,
-    fl min_rmsd, sz max_size) {
-  VINA_FOR_IN(i, in)
-    add_to_output_container(out, in[i], min_rmsd, max_size);
-}
-
-void merge_output_containers(const parallel_mc_task_container& many,
+//the task poses are moved out, many is left with empty containers
+void merge_output_containers(parallel_mc_task_container& many,
     output_container& out, fl min_rmsd, sz max_size) {
   min_rmsd = 2; // FIXME? perhaps it's necessary to separate min_rmsd during search and during output?
+  output_heap merged(min_rmsd, max_size);
+  VINA_FOR_IN(i, out)
+    merged.add(out[i]);
+  out.clear();
   VINA_FOR_IN(i, many) {
-    merge_output_containers(many[i].out, out, min_rmsd, max_size);
+    output_container& in = many[i].out;
+    VINA_FOR_IN(j, in)
+      merged.add(std::move(in[j]));
+    in.clear();
   }
-  out.sort();
+  merged.release(out);
 }
 
 void parallel_mc::operator()(const model& m, output_container& out,
@@ -184,6 +186,7 @@ void parallel_mc::operator()(const model& m, output_container& out,
         new parallel_mc_task(m, random_int(0, 1000000, generator)));
   if (display_progress) pp.init(num_tasks * mc.num_steps);
 
+  //runs once per pool thread, not once per ligand
   auto thread_init = [&]()
   {
     initializeCUDA(m.gdata.device_id); //harmless to do if there isn't a gpu
@@ -0,0 +1,155 @@
+/*
+ * Eager construction and on-disk storage of spline tables.
+ */
+
+#include "precalculate.h"
+#include "file.h"
+#include "work_scheduler.h"
+#include <algorithm>
+#include <cstring>
+#include <boost/cstdint.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/filesystem/fstream.hpp>
+
+void precalculate_splines::prepare(const std::vector<smt>& types) const {
+  std::vector<smt> ts(types);
+  std::sort(ts.begin(), ts.end());
+  ts.erase(std::unique(ts.begin(), ts.end()), ts.end());
+
+  std::vector<const spline_cache*> missing;
+  VINA_FOR_IN(i, ts) {
+    if (ts[i] >= data.dim()) break;
+    VINA_RANGE(j, i, ts.size()) {
+      if (ts[j] >= data.dim()) break;
+      const spline_cache& s = data(ts[i], ts[j]);
+      if (!s.built()) missing.push_back(&s);
+    }
+  }
+  if (missing.empty()) return;
+
+  work_scheduler& pool = work_scheduler::global();
+  work_scheduler::task_group group;
+  VINA_FOR_IN(i, missing) {
+    const spline_cache *s = missing[i];
+    pool.spawn(group, [s]() {
+      s->build();
+    });
+  }
+  pool.wait(group);
+}
+
+//layout of a spline table file: this header, a built flag for every type
+//pair (t1 <= t2, in row order) and then both tables of every pair, unbuilt
+//pairs being zero; native byte order
+struct spline_file_header {
+    char magic[8];
+    boost::uint32_t version;
+    boost::uint32_t float_size;
+    boost::uint64_t key;
+    boost::uint64_t types;
+    boost::uint64_t intervals;
+    boost::uint64_t components;
+};
+
+static const char spline_file_magic[8] = { 'G', 'N', 'I', 'N', 'A', 'S',
+    'P', 'L' };
+static const boost::uint32_t spline_file_version = 1;
+
+void precalculate_splines::set_disk_cache(const std::string& dir,
+    const std::string& signature) {
+  key_hash hash;
+  hash.add(signature.data(), signature.size());
+  boost::filesystem::path p(dir);
+  p /= hash.str() + ".splines";
+  disk_path = p.string();
+  disk_key = hash.h;
+  disk_file.reset();
+  disk_pairs = 0;
+  if (!boost::filesystem::exists(p)) return;
+
+  std::shared_ptr<boost::iostreams::mapped_file_source> file(
+      new boost::iostreams::mapped_file_source());
+  try {
+    file->open(disk_path);
+  } catch (std::exception&) {
+    return;
+  }
+
+  const sz npairs = data.dim() * (data.dim() + 1) / 2;
+  const sz tsize = 2 * data(0, 0).table_size();
+  const sz offset = sizeof(spline_file_header)
+      + npairs * sizeof(boost::uint64_t);
+  if (file->size() != offset + npairs * tsize * sizeof(fl)) return;
+
+  const spline_file_header *h = (const spline_file_header*) file->data();
+  if (memcmp(h->magic, spline_file_magic, sizeof(spline_file_magic)) != 0
+      || h->version != spline_file_version || h->float_size != sizeof(fl)
+      || h->key != disk_key || h->types != data.dim()
+      || h->intervals != unsigned(factor * m_cutoff)
+      || h->components != scoring.num_used_components()) return;
+
+  const boost::uint64_t *built = (const boost::uint64_t*) (file->data()
+      + sizeof(spline_file_header));
+  const fl *vals = (const fl*) (file->data() + offset);
+  sz k = 0;
+  VINA_FOR(t1, data.dim())
+    VINA_RANGE(t2, t1, data.dim()) {
+      if (built[k]) {
+        data(t1, t2).assign(vals + k * tsize);
+        disk_pairs++;
+      }
+      k++;
+    }
+  disk_file = file;
+}
+
+//write to a temporary file and rename it into place so that concurrent
+//runs never see a partial file; failures just mean the splines will be
+//built again next time
+void precalculate_splines::store_disk_cache() const {
+  if (disk_path.empty()) return;
+
+  std::vector<boost::uint64_t> built;
+  VINA_FOR(t1, data.dim())
+    VINA_RANGE(t2, t1, data.dim())
+      built.push_back(data(t1, t2).built());
+  if (sz(std::count(built.begin(), built.end(), 1)) <= disk_pairs) return; //nothing new
+
+  boost::filesystem::path path(disk_path);
+  boost::filesystem::path tmp = path.string()
+      + boost::filesystem::unique_path(".%%%%-%%%%-%%%%.tmp").string();
+  try {
+    boost::filesystem::create_directories(path.parent_path());
+
+    spline_file_header h;
+    memcpy(h.magic, spline_file_magic, sizeof(spline_file_magic));
+    h.version = spline_file_version;
+    h.float_size = sizeof(fl);
+    h.key = disk_key;
+    h.types = data.dim();
+    h.intervals = unsigned(factor * m_cutoff);
+    h.components = scoring.num_used_components();
+
+    const sz tsize = 2 * data(0, 0).table_size();
+    flv zeros(tsize, 0);
+    boost::filesystem::ofstream out(tmp, std::ios::binary);
+    out.write((const char*) &h, sizeof(h));
+    out.write((const char*) &built[0], built.size() * sizeof(built[0]));
+    sz k = 0;
+    VINA_FOR(t1, data.dim())
+      VINA_RANGE(t2, t1, data.dim()) {
+        const fl *t = built[k] ? data(t1, t2).table(false) : &zeros[0];
+        out.write((const char*) t, tsize * sizeof(fl));
+        k++;
+      }
+    out.close();
+
+    if (out)
+      boost::filesystem::rename(tmp, path);
+    else
+      boost::filesystem::remove(tmp);
+  } catch (std::exception&) {
+    boost::system::error_code ec;
+    boost::filesystem::remove(tmp, ec);
+  }
+}
@@ -23,6 +23,11 @@
 #ifndef VINA_PRECALCULATE_H
 #define VINA_PRECALCULATE_H
 
+#include <atomic>
+#include <memory>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/iostreams/device/mapped_file.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/locks.hpp>
 #include "scoring_function.h"
@@ -35,12 +40,44 @@ class precalculate {
     //return just the fast evaluation of types, no derivative
     virtual result_components eval_fast(smt t1, smt t2, fl r2) const = 0;
 
+    //fast evaluation of t1 against each of the n types in t2 at the same
+    //distance, writing out[i] for t2[i]; used when filling grids so there is
+    //one virtual call per receptor atom rather than one per type
+    virtual void eval_fast_many(smt t1, const smt *t2, sz n, fl r2,
+        result_components *out) const {
+      for (sz i = 0; i < n; i++)
+        out[i] = eval_fast(t1, t2[i], r2);
+    }
+
     //return value and derivative
     //IMPORTANT: derivative is scaled by sqrt(r2) so that when
     //multiplied by the direction vector the result is normalized
     virtual pr eval_deriv(const atom_base& a, const atom_base& b,
         fl r2) const = 0;
 
+    //eval_deriv of n pairs of atoms with types ta/tb and charges qa/qb at
+    //squared distances r2 (all within the cutoff), writing values to e and
+    //scaled derivatives to dor; subclasses evaluate the whole batch in one
+    //call, looking up type pair data only when the pair changes
+    virtual void eval_deriv_many(const smt *ta, const smt *tb, const fl *qa,
+        const fl *qb, const fl *r2, sz n, fl *e, fl *dor) const {
+      atom_base a, b;
+      for (sz i = 0; i < n; i++) {
+        a.sm = ta[i];
+        a.charge = qa[i];
+        b.sm = tb[i];
+        b.charge = qb[i];
+        pr ret = eval_deriv(a, b, r2[i]);
+        e[i] = ret.first;
+        dor[i] = ret.second;
+      }
+    }
+
+    //compute, ahead of use, any lazily built data for pairs of the given
+    //types; nothing to do by default
+    virtual void prepare(const std::vector<smt>& types) const {
+    }
+
     precalculate(const scoring_function& sf)
         : // sf should not be discontinuous, even near cutoff, for the sake of the derivatives
             m_cutoff(sf.cutoff()), m_cutoff_sqr(sqr(sf.cutoff())), scoring(sf) {
@@ -209,6 +246,20 @@ class precalculate_linear : public precalculate {
       return eval_fast_data(t1, t2, r2);
     }
 
+    void eval_fast_many(smt t1, const smt *t2, sz n, fl r2,
+        result_components *out) const {
+      assert(r2 <= m_cutoff_sqr);
+      sz index = sz(factor * r2); //same bucket for every type
+      for (sz i = 0; i < n; i++) {
+        if (t1 <= t2[i]) {
+          out[i] = data(t1, t2[i]).fast[index];
+        } else {
+          out[i] = data(t2[i], t1).fast[index];
+          out[i].swapOrder();
+        }
+      }
+    }
+
     pr eval_deriv(const atom_base& a, const atom_base& b, fl r2) const {
       assert(r2 <= m_cutoff_sqr);
       smt t1 = a.get();
@@ -256,6 +307,29 @@ class precalculate_linear : public precalculate {
       return ret;
     }
 
+    void eval_deriv_many(const smt *ta, const smt *tb, const fl *qa,
+        const fl *qb, const fl *r2, sz n, fl *e, fl *dor) const {
+      if (scoring.has_slow()) {
+        precalculate::eval_deriv_many(ta, tb, qa, qb, r2, n, e, dor);
+        return;
+      }
+      atom_base a, b;
+      for (sz i = 0; i < n; i++) {
+        assert(r2[i] <= m_cutoff_sqr);
+        a.sm = ta[i];
+        a.charge = qa[i];
+        b.sm = tb[i];
+        b.charge = qb[i];
+        pr ret;
+        if (a.sm <= b.sm)
+          ret = data(a.sm, b.sm).eval_deriv(num_components, a, b, r2[i]);
+        else
+          ret = data(b.sm, a.sm).eval_deriv(num_components, b, a, r2[i]);
+        e[i] = ret.first;
+        dor[i] = ret.second;
+      }
+    }
+
   private:
     sz n;
     triangular_matrix<precalculate_linear_element> data;
@@ -273,17 +347,18 @@ class precalculate_linear : public precalculate {
 
 typedef std::pair<result_components, result_components> component_pair;
 //evaluates spline between two smina atom types as needed
-//will decompose charge dependent terms
+//will decompose charge dependent terms; only the flattened coefficient
+//tables of the splines are kept, and these may be mapped from a file
 class spline_cache {
     const scoring_function* sf;
     fl cutoff;
     sz n;
     smt t1, t2;
-    //the following are only computed when needed
-    mutable Spline *splines; //one for each component
-    mutable unsigned num_splines; //size of splines
-    mutable bool valid;
-    mutable boost::mutex lock; //make thread safe
+    sz ncomp; //components in the tables
+    //tables for both type orders, NULL until built; readers never lock
+    mutable std::atomic<const fl*> coefs;
+    mutable flv storage; //owns coefs unless they were assigned
+    mutable boost::mutex lock; //serializes building
 
     //create control points for spline
     //poitns indexed by component first; nonzero indexec by component
@@ -315,22 +390,37 @@ class spline_cache {
         points[c].push_back(pr(cutoff, 0));
       }
     }
+
+    void fill_table(const std::vector<Spline>& s, bool swapped, fl *t) const {
+      for (sz c = 0; c < ncomp; c++) {
+        sz src = c;
+        if (swapped && c == result_components::AbsAChargeDependent)
+          src = result_components::AbsBChargeDependent;
+        else if (swapped && c == result_components::AbsBChargeDependent)
+          src = result_components::AbsAChargeDependent;
+
+        const std::vector<SplineData>& data = s[src].getData();
+        for (sz i = 0, m = std::min(n, data.size()); i < m; i++) {
+          fl *coef = t + (i * ncomp + c) * 4;
+          coef[0] = data[i].a;
+          coef[1] = data[i].b;
+          coef[2] = data[i].c;
+          coef[3] = data[i].d;
+        }
+      }
+    }
+
   public:
 
     spline_cache()
         : sf(NULL), cutoff(0), n(0), t1(smina_atom_type::NumTypes),
-            t2(smina_atom_type::NumTypes), splines(NULL), num_splines(0),
-            valid(false) {
+            t2(smina_atom_type::NumTypes), ncomp(0), coefs(NULL) {
     }
 
     //need explicit copy constructor to deal with mutex vairable
     spline_cache(const spline_cache& rhs)
         : sf(rhs.sf), cutoff(rhs.cutoff), n(rhs.n), t1(rhs.t1), t2(rhs.t2),
-            splines(NULL), num_splines(0), valid(false) { //mutable member do not get copied
-    }
-
-    ~spline_cache() {
-      if (splines) delete[] splines;
+            ncomp(rhs.ncomp), coefs(NULL) { //mutable member do not get copied
     }
 
     //intialize values to approprate types etc - do not compute spline
@@ -340,38 +430,115 @@ class spline_cache {
       n = n_;
       t1 = t1_;
       t2 = t2_;
+      ncomp = sf_.num_used_components();
 
       if (t1 > t2) std::swap(t1, t2);
     }
 
-    component_pair eval(fl r) const {
-      if (splines == NULL) {
-        //create spline, thread safe
-        boost::lock_guard<boost::mutex> L(lock);
-
-        if (splines == NULL) //another thread didn't fix it for us
-        {
-          std::vector<std::vector<pr> > points;
-          std::vector<bool> nonzero;
-          setup_points(points, nonzero);
-
-          num_splines = sf->num_used_components();
-          Spline *tmpsplines = new Spline[num_splines];
-          for (sz i = 0, n = num_splines; i < n; i++) {
-            if (nonzero[i]) //worth interpolating
-              tmpsplines[i].initialize(points[i]);
-          }
-          splines = tmpsplines; //this is assumed atomic
-        }
+    //number of values in the table of one type order
+    sz table_size() const {
+      return n * 4 * ncomp;
+    }
+
+    bool built() const {
+      return coefs.load(std::memory_order_acquire) != NULL;
+    }
+
+    //compute the splines if they don't exist yet, thread safe
+    void build() const {
+      if (built()) return;
+      boost::lock_guard<boost::mutex> L(lock);
+      if (coefs.load(std::memory_order_relaxed) != NULL) return; //another thread beat us
+
+      std::vector<std::vector<pr> > points;
+      std::vector<bool> nonzero;
+      setup_points(points, nonzero);
+
+      std::vector<Spline> splines(ncomp);
+      for (sz i = 0; i < ncomp; i++) {
+        if (nonzero[i]) //worth interpolating
+          splines[i].initialize(points[i]);
+      }
+      storage.assign(2 * table_size(), 0);
+      fill_table(splines, false, &storage[0]);
+      fill_table(splines, true, &storage[table_size()]);
+      coefs.store(&storage[0], std::memory_order_release);
+    }
+
+    //use 2*table_size() externally owned values, laid out as by table(),
+    //instead of building the splines
+    void assign(const fl *t) {
+      coefs.store(t, std::memory_order_release);
+    }
+
+    //flattened cubic coefficients (a, b, c, d) of every component for each
+    //of the n intervals, so the stride of an interval is 4*ncomp; if
+    //swapped, the components are ordered as if t1 and t2 were exchanged
+    const fl* table(bool swapped) const {
+      const fl *t = coefs.load(std::memory_order_acquire);
+      if (t == NULL) {
+        build();
+        t = coefs.load(std::memory_order_acquire);
+      }
+      return swapped ? t + table_size() : t;
+    }
+
+    //value and derivative of nc components from table t at r, mirroring
+    //Spline::eval_deriv
+    template<sz nc>
+    static void eval_table(const fl *t, fl fraction, fl cutoff, fl r, fl *val,
+        fl *deriv) {
+      if (r >= cutoff) {
+        for (sz c = 0; c < nc; c++)
+          val[c] = deriv[c] = 0;
+        return;
       }
+      unsigned index = r / fraction;
+      const fl lx = r - index * fraction;
+      const fl *coef = t + index * 4 * nc;
+      for (sz c = 0; c < nc; c++, coef += 4) {
+        val[c] = ((coef[0] * lx + coef[1]) * lx + coef[2]) * lx + coef[3];
+        deriv[c] = (3 * coef[0] * lx + 2 * coef[1]) * lx + coef[2];
+      }
+    }
+
+    component_pair eval(fl r) const {
+      const fl *t = table(false);
+      fl fraction = cutoff / (fl) n;
+      fl val[result_components::Last], deriv[result_components::Last];
+      if (ncomp == 1)
+        eval_table<1>(t, fraction, cutoff, r, val, deriv);
+      else
+        eval_table<result_components::Last>(t, fraction, cutoff, r, val,
+            deriv);
 
-      result_components val, deriv;
-      for (sz i = 0, n = num_splines; i < n; i++) {
-        pr ret = splines[i].eval_deriv(r);
-        val[i] = ret.first;
-        deriv[i] = ret.second;
+      component_pair ret;
+      for (sz i = 0; i < ncomp; i++) {
+        ret.first[i] = val[i];
+        ret.second[i] = deriv[i];
       }
-      return component_pair(val, deriv);
+      return ret;
+    }
+};
+
+//combines the component values of a pair into a single value; the charge
+//independent specialization ignores charges entirely
+template<bool charged>
+struct pair_components {
+    static const sz size = result_components::Last;
+    static fl combine(const fl *c, fl qa, fl qb) {
+      return c[result_components::TypeDependentOnly]
+          + std::abs(qa) * c[result_components::AbsAChargeDependent]
+          + std::abs(qb) * c[result_components::AbsBChargeDependent]
+          + qa * qb * c[result_components::ABChargeDependent];
+    }
+};
+
+template<>
+struct pair_components<false> {
+    static const sz size = 1;
+    static fl combine(const fl *c, fl qa, fl qb) {
+      return c[result_components::TypeDependentOnly];
     }
 };
 
@@ -394,9 +561,10 @@ class precalculate_splines : public precalculate {
         :
             // sf should not be discontinuous, even near cutoff, for the sake of the derivatives
             precalculate(sf), data(num_atom_types(), spline_cache()),
-            delta(0.000005), factor(factor_) {
+            delta(0.000005), factor(factor_), fraction(0), disk_key(0), disk_pairs(0) {
       VINA_CHECK(factor > epsilon_fl);
       unsigned n = factor * m_cutoff;
+      fraction = m_cutoff / (fl) n; //as in spline_cache::setup_points
       VINA_FOR(t1, data.dim())
         VINA_RANGE(t2, t1, data.dim()) {
           //initialize spline cache - this doesn't create the splines
@@ -410,6 +578,25 @@ class precalculate_splines : public precalculate {
       return evaldata(t1, t2, r).first;
     }
 
+    void eval_fast_many(smt t1, const smt *t2, sz n, fl r2,
+        result_components *out) const {
+      assert(r2 <= m_cutoff_sqr);
+      fl r = sqrt(r2);
+      const sz ncomp = scoring.num_used_components();
+      fl val[result_components::Last], deriv[result_components::Last];
+      for (sz i = 0; i < n; i++) {
+        if (ncomp == 1)
+          spline_cache::eval_table<1>(pair_table(t1, t2[i]), fraction,
+              m_cutoff, r, val, deriv);
+        else
+          spline_cache::eval_table<result_components::Last>(
+              pair_table(t1, t2[i]), fraction, m_cutoff, r, val, deriv);
+        out[i] = result_components();
+        for (sz c = 0; c < ncomp; c++)
+          out[i][c] = val[c];
+      }
+    }
+
     pr eval_deriv(const atom_base& a, const atom_base& b, fl r2) const {
       assert(r2 <= m_cutoff_sqr);
       smt t1 = a.get();
@@ -441,11 +628,66 @@ class precalculate_splines : public precalculate {
       return ret;
     }
 
+    void eval_deriv_many(const smt *ta, const smt *tb, const fl *qa,
+        const fl *qb, const fl *r2, sz n, fl *e, fl *dor) const {
+      if (scoring.has_slow())
+        precalculate::eval_deriv_many(ta, tb, qa, qb, r2, n, e, dor);
+      else if (has_components())
+        eval_deriv_table<pair_components<true> >(ta, tb, qa, qb, r2, n, e, dor);
+      else
+        eval_deriv_table<pair_components<false> >(ta, tb, qa, qb, r2, n, e,
+            dor);
+    }
+
+    //build the splines of all pairs of types in parallel
+    void prepare(const std::vector<smt>& types) const;
+
+    //map the tables stored in dir for this scoring function (signature must
+    //describe the terms, weights and atom parameters), if any;
+    //store_disk_cache writes all built tables back for later runs
+    void set_disk_cache(const std::string& dir, const std::string& signature);
+    void store_disk_cache() const;
+
   private:
 
     triangular_matrix<spline_cache> data;
     fl delta;
     fl factor;
+    fl fraction; //spacing of spline points
+    std::string disk_path; //empty if tables are not cached on disk
+    std::shared_ptr<boost::iostreams::mapped_file_source> disk_file;
+    boost::uint64_t disk_key; //hash of the scoring function signature
+    sz disk_pairs; //number of tables mapped from disk_path
+
+    const fl* pair_table(smt t1, smt t2) const {
+      if (t1 <= t2)
+        return data(t1, t2).table(false);
+      else
+        return data(t2, t1).table(true);
+    }
+
+    //batch kernel for scoring functions without slow terms, the pair table
+    //is only looked up again when the type pair changes
+    template<class components>
+    void eval_deriv_table(const smt *ta, const smt *tb, const fl *qa,
+        const fl *qb, const fl *r2, sz n, fl *e, fl *dor) const {
+      const fl *t = NULL;
+      smt last1 = smina_atom_type::NumTypes, last2 = smina_atom_type::NumTypes;
+      fl val[components::size], deriv[components::size];
+      for (sz i = 0; i < n; i++) {
+        assert(r2[i] <= m_cutoff_sqr);
+        if (ta[i] != last1 || tb[i] != last2) {
+          last1 = ta[i];
+          last2 = tb[i];
+          t = pair_table(last1, last2);
+        }
+        fl r = sqrt(r2[i]);
+        spline_cache::eval_table<components::size>(t, fraction, m_cutoff, r,
+            val, deriv);
+        e[i] = components::combine(val, qa[i], qb[i]);
+        dor[i] = components::combine(deriv, qa[i], qb[i]) / r;
+      }
+    }
 };
 
 // dkoes - do a full function recomputation (no precalculation)
@@ -32,9 +32,10 @@ struct quasi_newton_aux {
     igrid* ig;
     const vec v;
     const grid* user_grid;
+    sz evaluations;
     quasi_newton_aux(model* m_, const precalculate* p_, igrid* ig_,
         const vec& v_, const grid* user_grid_)
-        : m(m_), p(p_), ig(ig_), v(v_), user_grid(user_grid_) {
+        : m(m_), p(p_), ig(ig_), v(v_), user_grid(user_grid_), evaluations(0) {
     }
 
     vec get_center() const {
@@ -42,12 +43,20 @@ struct quasi_newton_aux {
     }
 
     fl operator()(const conf& c, change& g) {
+      evaluations++;
       return m->eval_deriv(*p, *ig, v, c, g, *user_grid);
     }
 };
 
+//minimizations on a thread reuse the same buffers; a thread that waits
+//on the pool may start another minimization while one is in progress, in
+//which case the inner one uses its own
+static thread_local bfgs_workspace<conf, change> workspace;
+static thread_local bool workspace_busy = false;
+
 void quasi_newton::operator()(model& m, const precalculate& p, igrid& ig,
-    output_type& out, change& g, const vec& v, const grid& user_grid) const {
+    output_type& out, change& g, const vec& v, const grid& user_grid,
+    sz *evaluations) const {
   // g must have correct size
   const non_cache_gpu* n_gpu = dynamic_cast<const non_cache_gpu*>(&ig);
   const cache_gpu* c_gpu = dynamic_cast<const cache_gpu*>(&ig);
@@ -76,9 +85,21 @@ void quasi_newton::operator()(model& m, const precalculate& p, igrid& ig,
     if (params.type == minimization_params::Simple)
       res = simple_gradient_ascent(aux, out.c, g, average_required_improvement,
           params);
-    else
+    else if (workspace_busy)
       res = bfgs(aux, out.c, g, average_required_improvement, params);
+    else {
+      workspace_busy = true;
+      try {
+        res = bfgs(aux, out.c, g, average_required_improvement, params,
+            workspace);
+      } catch (...) {
+        workspace_busy = false;
+        throw;
+      }
+      workspace_busy = false;
+    }
     out.e = res;
+    if (evaluations) *evaluations += aux.evaluations;
   }
 }
 
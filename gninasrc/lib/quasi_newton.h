@@ -34,8 +34,10 @@ class quasi_newton {
         : params(p), average_required_improvement(0.0) {
     }
     // clean up
+    //if evaluations is provided, the number of cpu function evaluations is added to it
     void operator()(model& m, const precalculate& p, igrid& ig,
-        output_type& out, change& g, const vec& v, const grid& user_grid) const; // g must have correct size
+        output_type& out, change& g, const vec& v, const grid& user_grid,
+        sz *evaluations = NULL) const; // g must have correct size
 };
 
 template<typename infoT> struct quasi_newton_aux_gpu {
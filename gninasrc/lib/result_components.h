@@ -64,10 +64,14 @@ class result_components {
     }
 
     fl eval(const atom_base& a, const atom_base& b) const {
+      return eval(a.charge, b.charge);
+    }
+
+    fl eval(fl acharge, fl bcharge) const {
       return components[TypeDependentOnly]
-          + std::abs(a.charge) * components[AbsAChargeDependent]
-          + std::abs(b.charge) * components[AbsBChargeDependent]
-          + a.charge * b.charge * components[ABChargeDependent];
+          + std::abs(acharge) * components[AbsAChargeDependent]
+          + std::abs(bcharge) * components[AbsBChargeDependent]
+          + acharge * bcharge * components[ABChargeDependent];
     }
 
     //if you know the scoring function doesn't have charge dependencies
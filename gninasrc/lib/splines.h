@@ -2,7 +2,8 @@
  * Assume and enforce that x values are evenly spaced from
  * zero to some cutoff (user may specify a larger last step to cutoff to
  * enhance smoothing), derivatives must go to zero at ends, value goes to
- * zero at cutoff.  Eigen is used for matrix calculations.
+ * zero at cutoff.  The second derivatives are found by solving a
+ * tridiagonal system.
  *
  * The spline is initialized with a function object.
  *
@@ -11,8 +12,7 @@
  */
 
 #include "common.h"
-#include "Eigen/Core"
-#include "Eigen/Dense"
+#include <vector>
 
 typedef fl fltype;
 struct SplineData {
@@ -41,52 +41,53 @@ class Spline {
       fraction = points[1].first - points[0].first;
       const unsigned e = points.size() - 1;
 
-      typedef Eigen::Matrix<fltype, Eigen::Dynamic, Eigen::Dynamic> flMatrix;
-      flMatrix A = flMatrix::Zero(points.size(), points.size());
+      //ddy satisfies, for each point i,
+      //lower[i]*ddy[i-1] + diag[i]*ddy[i] + upper[i]*ddy[i+1] = C[i]
+      std::vector<double> lower(e + 1, 0), diag(e + 1, 0), upper(e + 1, 0),
+          C(e + 1, 0);
       fltype hlast = points[e].first - points[e - 1].first;
       for (unsigned i = 1; i < e; ++i) {
         fltype hi = fraction;
         //last point may not have fixed delta due to smoothing
         if (i == e - 1) hi = hlast;
-        A(i - 1, i) = hi;
-        A(i, i) = 2 * (fraction + hi);
-        A(i + 1, i) = hi;
-      }
-
-      typedef Eigen::Matrix<fltype, 1, Eigen::Dynamic> flVector;
-      flVector C = flVector::Zero(points.size());
-
-      for (unsigned i = 1; i < e; ++i) {
-        fltype hi = fraction;
-        if (i == e - 1) hi = hlast;
+        lower[i] = hi;
+        diag[i] = 2 * (fraction + hi);
+        upper[i] = hi;
 
-        C(i) = 6
+        C[i] = 6
             * ((points[i + 1].second - points[i].second) / hi
                 - (points[i].second - points[i - 1].second) / fraction);
       }
 
       //Boundary condition: zero first derivative
-      C(0) = 6 * ((points[1].second - points[0].second) / fraction);
-      A(0, 0) = 2 * fraction;
-      A(1, 0) = fraction;
-
-      C(e) = 6 * (-(points[e].second - points[e - 1].second) / hlast);
-      A(e, e) = 2 * hlast;
-      A(e - 1, e) = hlast;
-
-      flMatrix AInv = A.inverse();
-
-      flVector ddy = C * AInv;
+      C[0] = 6 * ((points[1].second - points[0].second) / fraction);
+      diag[0] = 2 * fraction;
+      upper[0] = fraction;
+
+      C[e] = 6 * (-(points[e].second - points[e - 1].second) / hlast);
+      diag[e] = 2 * hlast;
+      lower[e] = hlast;
+
+      //Thomas algorithm, the system is diagonally dominant so no pivoting
+      for (unsigned i = 1; i <= e; ++i) {
+        double w = lower[i] / diag[i - 1];
+        diag[i] -= w * upper[i - 1];
+        C[i] -= w * C[i - 1];
+      }
+      std::vector<double> ddy(e + 1);
+      ddy[e] = C[e] / diag[e];
+      for (unsigned i = e; i-- > 0;)
+        ddy[i] = (C[i] - upper[i] * ddy[i + 1]) / diag[i];
 
       data.resize(e);
       for (unsigned i = 0; i < e; ++i) {
         fltype hi = fraction;
         if (i == e - 1) hi = hlast;
         data[i].x = points[i].first;
-        data[i].a = (ddy(i + 1) - ddy(i)) / (6 * hi);
-        data[i].b = ddy(i) / 2;
+        data[i].a = (ddy[i + 1] - ddy[i]) / (6 * hi);
+        data[i].b = ddy[i] / 2;
         data[i].c = (points[i + 1].second - points[i].second) / hi
-            - ddy(i + 1) * hi / 6 - ddy(i) * hi / 3;
+            - ddy[i + 1] * hi / 6 - ddy[i] * hi / 3;
         data[i].d = points[i].second;
       }
     }
@@ -27,7 +27,10 @@
 #include "grid_dim.h"
 #include "array3d.h"
 #include "brick.h"
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
 
+#include <algorithm>
 #include <boost/unordered_map.hpp>
 #include <boost/functional/hash.hpp>
 
@@ -47,24 +50,81 @@ inline std::size_t hash_value(const array<int, 3> &e) {
 }
 }
 
+//receptor atoms near a cache cell; besides their indices, the atoms are
+//stored as contiguous coordinate and charge arrays grouped into runs of a
+//single type, so a pair kernel can look up the type pair data once per run
+//and compute distances for width atoms at a time.  Runs are padded to a
+//multiple of width with dummy atoms that are never within the cutoff.
+struct receptor_block {
+    static const sz width = 16;
+
+    struct run {
+        smt type;
+        sz begin;
+        sz end; //includes padding
+    };
+
+    szv atoms; //indices into grid_atoms, in receptor order
+    flv x, y, z, charge;
+    std::vector<run> runs;
+
+    void build(const atomv& grid_atoms) {
+      const fl faraway = 1e6; //squared distance is far beyond any cutoff
+      szv bytype(atoms);
+      std::stable_sort(bytype.begin(), bytype.end(),
+          [&grid_atoms](sz i, sz j) {
+            return grid_atoms[i].get() < grid_atoms[j].get();
+          });
+
+      VINA_FOR_IN(k, bytype) {
+        const atom& a = grid_atoms[bytype[k]];
+        if (runs.empty() || runs.back().type != a.get()) {
+          run r;
+          r.type = a.get();
+          r.begin = r.end = x.size();
+          runs.push_back(r);
+        }
+        x.push_back(a.coords[0]);
+        y.push_back(a.coords[1]);
+        z.push_back(a.coords[2]);
+        charge.push_back(a.charge);
+        runs.back().end++;
+        if (k + 1 == bytype.size()
+            || grid_atoms[bytype[k + 1]].get() != a.get()) {
+          while ((runs.back().end - runs.back().begin) % width != 0) {
+            x.push_back(faraway);
+            y.push_back(faraway);
+            z.push_back(faraway);
+            charge.push_back(0);
+            runs.back().end++;
+          }
+        }
+      }
+    }
+};
+
 //dkoes - this is a 'global' cache of receptor atoms that are within a cutoff
 //distance from global grid points; the atom lists are calculated on demand
 //and stored in a hash
 class szv_grid_cache {
     typedef boost::array<int, 3> ijk;
-    typedef boost::unordered_map<ijk, szv*> cache_type;
+    typedef boost::unordered_map<ijk, receptor_block*> cache_type;
     mutable cache_type cache;
     const model& m;
     fl cutoff_sqr;
+    //if shared, cells may be requested concurrently by grids of unrelated
+    //dimensions (e.g. by server queries against one receptor)
+    bool shared;
+    mutable boost::mutex lock;
     static constexpr fl granularity = 3.0; //good balance of cache locality and avoiding redundant computation
   public:
-    szv_grid_cache(const model& m_, fl cut)
-        : m(m_), cutoff_sqr(cut) {
+    szv_grid_cache(const model& m_, fl cut, bool shared_ = false)
+        : m(m_), cutoff_sqr(cut), shared(shared_) {
 
     }
 
     ~szv_grid_cache() {
-      //clear out szv vectors
+      //clear out atom blocks
       for (cache_type::iterator itr = cache.begin(), end = cache.end();
           itr != end; ++itr) {
         if (itr->second != NULL) {
@@ -78,6 +138,11 @@ class szv_grid_cache {
       return m;
     }
 
+    //true if cells hold every nearby atom, regardless of the grid asking
+    bool is_shared() const {
+      return shared;
+    }
+
     //compute all the receptor atoms that may be reachable by passed grid dims
     void compute_relevant(const grid_dims& gd, szv& relevant_indices) const {
       vec start, end;
@@ -112,10 +177,24 @@ class szv_grid_cache {
       return ret;
     }
 
-    //return pointer to possibilities vector from cache
+    //return pointer to the block of possible atoms from cache
     //the value is generated on-demand looking just at the receptor
     //atoms in relvant_indices if necessary
-    const szv* get(const vec& coord, const szv& relevant_indices) const {
+    const receptor_block* get(const vec& coord,
+        const szv& relevant_indices) const {
+      if (shared) {
+        //cells have to be complete for any grid, so check every atom
+        boost::lock_guard<boost::mutex> L(lock);
+        return lookup(coord, NULL);
+      }
+      return lookup(coord, &relevant_indices);
+    }
+
+  private:
+    //cached block of coord, considering relevant_indices or all grid atoms
+    //if that is NULL
+    const receptor_block* lookup(const vec& coord,
+        const szv *relevant_indices) const {
       //get unique global index for coord
       ijk index;
       for (sz i = 0; i < 3; i++) {
@@ -124,26 +203,29 @@ class szv_grid_cache {
 
       if (cache.count(index) == 0) {
         //fill out the list of close enough receptor atoms
-        szv *atoms = new szv();
+        receptor_block *atoms = new receptor_block();
         //compute lower and upper coordinates of this grid point
         vec lower, upper;
         for (sz i = 0; i < 3; i++) {
           lower[i] = std::floor(coord[i] / granularity) * granularity;
           upper[i] = std::ceil(coord[i] / granularity) * granularity;
         }
-        VINA_FOR_IN(ri, relevant_indices) {
-          const sz i = relevant_indices[ri];
+        sz n = relevant_indices ? relevant_indices->size() : m.grid_atoms.size();
+        VINA_FOR(ri, n) {
+          const sz i = relevant_indices ? (*relevant_indices)[ri] : ri;
           const atom& a = m.grid_atoms[i];
           if (!a.is_hydrogen() && a.acceptable_type()) {
             if (brick_distance_sqr(lower, upper, a.coords) < cutoff_sqr)
-              atoms->push_back(i);
+              atoms->atoms.push_back(i);
           }
         }
+        atoms->build(m.grid_atoms.get());
         cache[index] = atoms;
       }
       return cache[index];
     }
 
+  public:
     //return the dimension of the grid for given dimensions
     static grid_dims szv_grid_dims(const grid_dims& gd) {
       ijk off, range;
@@ -167,16 +249,21 @@ struct szv_grid {
       cache.get_local_dims(gd, offset, range);
       m_data.resize(range[0], range[1], range[2]);
 
-      cache.compute_relevant(gd, relevant_indexes);
+      if (!cache.is_shared()) //shared cells don't use relevant_indexes
+        cache.compute_relevant(gd, relevant_indexes);
       //don't precompute - this is particularly inefficient for minimization
     }
 
     const szv& possibilities(const vec& coords) const {
+      return block(coords).atoms;
+    }
+
+    const receptor_block& block(const vec& coords) const {
       boost::array<int, 3> index = cache.local_index(coords, offset);
       assert(index[0] < m_data.dim0());
       assert(index[1] < m_data.dim1());
       assert(index[2] < m_data.dim2());
-      const szv* ret = m_data(index[0], index[1], index[2]);
+      const receptor_block* ret = m_data(index[0], index[1], index[2]);
       if (ret == NULL) {
         //fetch from cache
         ret = cache.get(coords, relevant_indexes);
@@ -187,7 +274,7 @@ struct szv_grid {
   private:
     szv_grid_cache& cache;
     szv relevant_indexes; //rec atoms within distance of docking grid
-    mutable array3d<const szv*> m_data; //this is updated as needed, does NOT own memory
+    mutable array3d<const receptor_block*> m_data; //this is updated as needed, does NOT own memory
     boost::array<int, 3> offset;
     boost::array<int, 3> range;
 
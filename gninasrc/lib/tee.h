@@ -29,8 +29,16 @@
 struct tee {
     bool quiet;
     ofile* of;
+    std::ostream* buf; //if set, all output is captured here instead
     tee(bool q = false)
-        : of(NULL), quiet(q) {
+        : of(NULL), quiet(q), buf(NULL) {
+    }
+    //capture output in out so it can be replayed into another tee later
+    explicit tee(std::ostream& out)
+        : of(NULL), quiet(false), buf(&out) {
+    }
+    bool buffered() const {
+      return buf != NULL;
     }
     void init(const path& name) {
       of = new ofile(name);
@@ -39,18 +47,34 @@ struct tee {
       delete of;
     }
     void flush() {
+      if (buf) {
+        (*buf) << std::flush;
+        return;
+      }
       if (!quiet) std::cout << std::flush;
       if (of) (*of) << std::flush;
     }
     void endl() {
+      if (buf) {
+        (*buf) << '\n';
+        return;
+      }
       if (!quiet) std::cout << std::endl;
       if (of) (*of) << std::endl;
     }
     void setf(std::ios::fmtflags a) {
+      if (buf) {
+        buf->setf(a);
+        return;
+      }
       if (!quiet) std::cout.setf(a);
       if (of) of->setf(a);
     }
     void setf(std::ios::fmtflags a, std::ios::fmtflags b) {
+      if (buf) {
+        buf->setf(a, b);
+        return;
+      }
       if (!quiet) std::cout.setf(a, b);
       if (of) of->setf(a, b);
     }
@@ -58,6 +82,10 @@ struct tee {
 
 template<typename T>
 tee& operator<<(tee& out, const T& x) {
+  if (out.buf) {
+    (*out.buf) << x;
+    return out;
+  }
   if (!out.quiet) std::cout << x;
   if (out.of) (*out.of) << x;
   return out;
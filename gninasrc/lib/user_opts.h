@@ -40,6 +40,7 @@ struct cnn_options {
     vec cnn_center;
     fl resolution; //this isn't specified in model file, so be careful about straying from default
     unsigned cnn_rotations; //do we want to score multiple orientations?
+    unsigned cnn_batch_size; //max poses scored together by score_batch
     cnn_scoring_level cnn_scoring;
     double subgrid_dim;
     fl empirical_weight; //weight for scaling and merging potentials
@@ -50,6 +51,7 @@ struct cnn_options {
     bool fix_receptor;
     bool mix_emp_force;//merge empirical and CNN minus forces
     bool mix_emp_energy;//merge empirical and CNN energy
+    bool thread_replicas; //every thread gets its own copy of the networks
     bool verbose;
 
     std::string xyzprefix;
@@ -57,10 +59,10 @@ struct cnn_options {
 
     cnn_options()
         : cnn_center(NAN, NAN, NAN),
-           resolution(0.5), cnn_rotations(0), cnn_scoring(CNNrescore),
+           resolution(0.5), cnn_rotations(0), cnn_batch_size(16), cnn_scoring(CNNrescore),
             subgrid_dim(0.0), outputdx(false),
             outputxyz(false), gradient_check(false), move_minimize_frame(false),
-            fix_receptor(false), verbose(false), mix_emp_force(false),mix_emp_energy(false),empirical_weight(1.0),seed(0) {
+            fix_receptor(false), verbose(false), mix_emp_force(false),mix_emp_energy(false),thread_replicas(false),empirical_weight(1.0),seed(0) {
     }
 
     bool moving_receptor() const {
@@ -95,6 +97,8 @@ struct user_settings {
     bool gpu_docking; //use gpu for non-CNN operations too
     bool no_gpu;
 
+    std::string grid_cache; //directory of grids shared between runs, may be empty
+    std::string grid_cache_signature; //what grid values depend on besides receptor and box
 
     cnn_options cnnopts;
 
@@ -0,0 +1,239 @@
+/*
+ * Process-wide work-stealing thread pool.
+ */
+
+#include "work_scheduler.h"
+#include <boost/bind/bind.hpp>
+
+static thread_local work_scheduler* current_scheduler = NULL;
+static thread_local sz current_index = 0;
+
+static boost::mutex global_mtx;
+static work_scheduler* global_scheduler = NULL; //never destroyed, workers may outlive main
+
+work_scheduler::work_scheduler(sz num_threads, const task& thread_init_,
+    sz max_jobs_)
+    : thread_init(thread_init_), epoch(0), max_jobs(max_jobs_),
+        pending_jobs(0), stopping(false), tasks_run(0), queue_wait_ns(0),
+        idle_ns(0) {
+  if (num_threads < 1) num_threads = 1;
+  VINA_FOR(i, num_threads + 1)
+    deques.push_back(new task_deque);
+  VINA_FOR(i, num_threads)
+    workers.create_thread(boost::bind(&work_scheduler::loop, this, i));
+}
+
+work_scheduler::~work_scheduler() {
+  drain();
+  {
+    boost::lock_guard<boost::mutex> lk(self);
+    stopping = true;
+    ++epoch;
+    changed.notify_all();
+  }
+  workers.join_all();
+}
+
+work_scheduler& work_scheduler::global() {
+  boost::lock_guard<boost::mutex> lk(global_mtx);
+  if (global_scheduler == NULL)
+    global_scheduler = new work_scheduler(boost::thread::hardware_concurrency());
+  return *global_scheduler;
+}
+
+bool work_scheduler::configure_global(sz num_threads, const task& thread_init) {
+  boost::lock_guard<boost::mutex> lk(global_mtx);
+  if (global_scheduler != NULL) return false;
+  global_scheduler = new work_scheduler(num_threads, thread_init);
+  return true;
+}
+
+work_scheduler* work_scheduler::current() {
+  return current_scheduler;
+}
+
+sz work_scheduler::local_index() const {
+  if (current_scheduler == this) return current_index;
+  return deques.size() - 1; //shared deque of non-worker threads
+}
+
+void work_scheduler::bump() {
+  boost::lock_guard<boost::mutex> lk(self);
+  ++epoch;
+  changed.notify_all();
+}
+
+void work_scheduler::record_start(const entry& e) {
+  tasks_run++;
+  queue_wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+      clock::now() - e.queued).count();
+}
+
+void work_scheduler::record_idle(clock::time_point since) {
+  idle_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+      clock::now() - since).count();
+}
+
+work_scheduler::statistics work_scheduler::stats() const {
+  statistics ret;
+  ret.tasks = tasks_run;
+  ret.queue_wait = queue_wait_ns / 1e9;
+  ret.idle = idle_ns / 1e9;
+  return ret;
+}
+
+void work_scheduler::set_max_jobs(sz n) {
+  boost::lock_guard<boost::mutex> lk(self);
+  max_jobs = n;
+  job_done.notify_all();
+}
+
+void work_scheduler::submit(const task& job) {
+  boost::unique_lock<boost::mutex> lk(self);
+  while (max_jobs > 0 && pending_jobs >= max_jobs)
+    job_done.wait(lk);
+  ++pending_jobs;
+  jobs.push_back(entry(job, NULL));
+  ++epoch;
+  changed.notify_all();
+}
+
+void work_scheduler::spawn(task_group& g, const task& t) {
+  ++g.pending;
+  task_deque& d = deques[local_index()];
+  {
+    boost::lock_guard<boost::mutex> lk(d.mtx);
+    d.tasks.push_front(entry(t, &g));
+  }
+  bump();
+}
+
+bool work_scheduler::try_pop(sz index, bool front, entry& e) {
+  task_deque& d = deques[index];
+  boost::lock_guard<boost::mutex> lk(d.mtx);
+  if (d.tasks.empty()) return false;
+  if (front) {
+    e = d.tasks.front();
+    d.tasks.pop_front();
+  } else {
+    e = d.tasks.back();
+    d.tasks.pop_back();
+  }
+  return true;
+}
+
+void work_scheduler::run_subtask(entry& e) {
+  task_group* g = e.group;
+  record_start(e);
+  try {
+    e.f();
+  } catch (...) {
+    boost::lock_guard<boost::mutex> lk(g->error_mtx);
+    if (!g->error) g->error = std::current_exception();
+  }
+  //g may be destroyed by its waiter as soon as pending reaches zero
+  if (--g->pending == 0) bump();
+}
+
+bool work_scheduler::try_run_subtask(sz index) {
+  entry e;
+  if (!try_pop(index, true, e)) {
+    //steal round robin, starting after ourselves
+    sz n = deques.size();
+    bool found = false;
+    for (sz k = 1; k < n && !found; k++)
+      found = try_pop((index + k) % n, false, e);
+    if (!found) return false;
+  }
+  run_subtask(e);
+  return true;
+}
+
+void work_scheduler::wait(task_group& g) {
+  bool worker = current_scheduler == this;
+  sz index = local_index();
+  while (g.pending > 0) {
+    unsigned long seen;
+    {
+      boost::lock_guard<boost::mutex> lk(self);
+      seen = epoch;
+    }
+    if (g.pending == 0) break;
+    if (worker && try_run_subtask(index)) continue;
+
+    clock::time_point start = clock::now();
+    {
+      boost::unique_lock<boost::mutex> lk(self);
+      while (epoch == seen && g.pending > 0)
+        changed.wait(lk);
+    }
+    if (worker) record_idle(start);
+  }
+  if (g.error) {
+    std::exception_ptr err = g.error;
+    g.error = std::exception_ptr();
+    std::rethrow_exception(err);
+  }
+}
+
+void work_scheduler::drain() {
+  boost::unique_lock<boost::mutex> lk(self);
+  while (pending_jobs > 0)
+    job_done.wait(lk);
+  job_error = std::exception_ptr();
+}
+
+void work_scheduler::join() {
+  boost::unique_lock<boost::mutex> lk(self);
+  while (pending_jobs > 0)
+    job_done.wait(lk);
+  if (job_error) {
+    std::exception_ptr err = job_error;
+    job_error = std::exception_ptr();
+    std::rethrow_exception(err);
+  }
+}
+
+void work_scheduler::loop(sz index) {
+  current_scheduler = this;
+  current_index = index;
+  if (thread_init) thread_init();
+
+  for (;;) {
+    unsigned long seen;
+    {
+      boost::lock_guard<boost::mutex> lk(self);
+      seen = epoch;
+    }
+    if (try_run_subtask(index)) continue;
+
+    entry job;
+    {
+      boost::unique_lock<boost::mutex> lk(self);
+      if (jobs.empty()) {
+        if (stopping) return;
+        clock::time_point start = clock::now();
+        while (epoch == seen && !stopping)
+          changed.wait(lk);
+        record_idle(start);
+        continue;
+      }
+      job = jobs.front();
+      jobs.pop_front();
+    }
+
+    record_start(job);
+    try {
+      job.f();
+    } catch (...) {
+      boost::lock_guard<boost::mutex> lk(self);
+      if (!job_error) job_error = std::current_exception();
+    }
+
+    boost::lock_guard<boost::mutex> lk(self);
+    --pending_jobs;
+    ++epoch;
+    changed.notify_all();
+    job_done.notify_all();
+  }
+}
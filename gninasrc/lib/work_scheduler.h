@@ -0,0 +1,150 @@
+/*
+ * Process-wide work-stealing thread pool.  The worker threads are created
+ * once and shared by ligand-level jobs, parallel_mc chains, parallel_for
+ * loops (cache population etc.) and the minimization server.
+ *
+ * Top-level jobs (usually one per ligand) are queued with submit().  A job
+ * may spawn() subtasks (e.g. monte carlo chains) into a task_group and then
+ * wait() on them; while waiting, the thread executes queued subtasks of any
+ * job instead of sleeping, so idle cores are always fed from whichever
+ * ligand has work available.  Subtasks are preferred over starting new jobs,
+ * and a waiting thread never starts a new job, which bounds nesting to one
+ * level.
+ */
+
+#ifndef VINA_WORK_SCHEDULER_H
+#define VINA_WORK_SCHEDULER_H
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <vector>
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+
+#include "common.h"
+
+class work_scheduler {
+  public:
+    typedef std::function<void()> task;
+
+    //a set of spawned subtasks that can be waited on together
+    class task_group {
+        friend class work_scheduler;
+        std::atomic<sz> pending;
+        std::exception_ptr error; //first exception thrown by a member task
+        boost::mutex error_mtx;
+      public:
+        task_group()
+            : pending(0) {
+        }
+    };
+
+    //cumulative counters, for tuning
+    struct statistics {
+        unsigned long tasks; //jobs and subtasks executed
+        double queue_wait; //seconds tasks spent queued before they started
+        double idle; //seconds worker threads spent without anything to do
+        statistics()
+            : tasks(0), queue_wait(0), idle(0) {
+        }
+    };
+
+    //thread_init is run once in every worker thread before any work;
+    //at most max_jobs top-level jobs are queued or running at once (0 is unbounded)
+    work_scheduler(sz num_threads, const task& thread_init = task(),
+        sz max_jobs = 0);
+    virtual ~work_scheduler();
+
+    //the process-wide pool; unless configure_global was called first, it is
+    //created on first use with one thread per hardware thread
+    static work_scheduler& global();
+    //set up the process-wide pool, returns false if it already exists
+    static bool configure_global(sz num_threads, const task& thread_init =
+        task());
+
+    //queue a top-level job, blocking while max_jobs are already pending
+    void submit(const task& job);
+
+    //queue a subtask of g; subtasks are run before any new top-level job
+    void spawn(task_group& g, const task& t);
+
+    //return once every task of g has finished; worker threads execute queued
+    //subtasks meanwhile, other threads just block (so they never run tasks
+    //without the per-thread initialization); rethrows the first exception
+    //raised by a task of g
+    void wait(task_group& g);
+
+    //wait for all submitted jobs; rethrows the first exception raised by a job
+    void join();
+    //wait for all submitted jobs, discarding their errors
+    void drain();
+
+    void set_max_jobs(sz n);
+
+    sz num_threads() const {
+      return deques.size() - 1;
+    }
+
+    statistics stats() const;
+
+    //scheduler running the calling thread, NULL if not a worker thread
+    static work_scheduler* current();
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    struct entry {
+        task f;
+        task_group* group; //NULL for top-level jobs
+        clock::time_point queued;
+        entry()
+            : group(NULL) {
+        }
+        entry(const task& f_, task_group* g)
+            : f(f_), group(g), queued(clock::now()) {
+        }
+    };
+
+    //each worker owns a deque; the owner pops from the front and thieves
+    //take from the back so that stolen work is the oldest (largest) work
+    struct task_deque {
+        boost::mutex mtx;
+        std::deque<entry> tasks;
+    };
+
+    boost::thread_group workers;
+    boost::ptr_vector<task_deque> deques; //one per worker, plus one for outside threads
+    task thread_init;
+
+    boost::mutex self; //protects everything below
+    boost::condition_variable changed; //signalled whenever epoch is bumped
+    boost::condition_variable job_done;
+    unsigned long epoch; //incremented whenever work is queued or finished
+    std::deque<entry> jobs;
+    sz max_jobs;
+    sz pending_jobs; //queued or running top-level jobs
+    std::exception_ptr job_error;
+    bool stopping;
+
+    //statistics, times are in nanoseconds
+    std::atomic<unsigned long> tasks_run;
+    std::atomic<unsigned long> queue_wait_ns;
+    std::atomic<unsigned long> idle_ns;
+
+    void loop(sz index);
+    void record_start(const entry& e);
+    void record_idle(clock::time_point since);
+    bool try_run_subtask(sz index);
+    bool try_pop(sz index, bool front, entry& e);
+    void run_subtask(entry& e);
+    void bump();
+    sz local_index() const;
+};
+
+#endif
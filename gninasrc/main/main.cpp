@@ -28,6 +28,7 @@
 #include <boost/bind.hpp>
 #include <boost/lockfree/queue.hpp>
 #include <boost/unordered_map.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include "parse_pdbqt.h"
 #include "parallel_mc.h"
@@ -59,6 +60,7 @@
 #include "sem.h"
 #include "user_opts.h"
 #include "version.h"
+#include "work_scheduler.h"
 
 #include <cuda_profiler_api.h>
 
@@ -138,9 +140,10 @@ fl do_randomization(model& m, const vec& corner1,
   return best_clash_penalty;
 }
 
+//if evaluations is provided, the number of function evaluations is added to it
 void refine_structure(model& m, const precalculate& prec, non_cache& nc,
     output_type& out, const vec& cap, const minimization_params& minparm,
-    grid& user_grid, int verbosity, tee& log)
+    grid& user_grid, int verbosity, tee& log, sz *evaluations = NULL)
     {
   // std::cout << m.get_name() << " | pose " << m.get_pose_num() << " | refining structure\n";
   change g(m.get_size(), nc.move_receptor());
@@ -159,7 +162,7 @@ void refine_structure(model& m, const precalculate& prec, non_cache& nc,
   VINA_FOR(p, 5)
   {
     nc.setSlope(slope);
-    quasi_newton_par(m, prec, nc, out, g, cap, user_grid); //quasi_newton operator
+    quasi_newton_par(m, prec, nc, out, g, cap, user_grid, evaluations); //quasi_newton operator
     m.set(out.c); // just to be sure
     if (nc.within(m)) {
       break;
@@ -320,9 +323,16 @@ void do_search(model& m, const boost::optional<model>& ref,
       vecv origcoords = m.get_heavy_atom_movable_coords();
       output_type out(c, e);
       doing(settings.verbosity, "Performing local search", log);
+      boost::timer::cpu_timer searchtime;
+      sz evaluations = 0;
       refine_structure(m, prec, nc, out, authentic_v, par.mc.ssd_par.minparm,
-          user_grid,settings.verbosity,log);
+          user_grid,settings.verbosity,log, &evaluations);
       done(settings.verbosity, log);
+      if (settings.verbosity > 1) {
+        log << "Local search: " << evaluations << " evaluations in "
+            << std::setprecision(3) << searchtime.elapsed().wall / 1e6
+            << " ms\n";
+      }
       m.set(out.c);
 
       //be as exact as possible for final score
@@ -375,15 +385,26 @@ void do_search(model& m, const boost::optional<model>& ref,
       done(settings.verbosity, log);
       doing(settings.verbosity, "Refining results", log);
 
+      //unless rescoring recenters the receptor around each pose, refined
+      //poses are rescored together in batches
+      bool batch_cnn = cnn.initialized() && !cnn.options().moving_receptor();
+      std::vector<model> poses;
+      if (batch_cnn)
+        poses.reserve(out_cont.size());
+
       VINA_FOR_IN(i, out_cont) {
         refine_structure(m, prec, nc, out_cont[i], authentic_v,
             par.mc.ssd_par.minparm, user_grid,settings.verbosity,log);
 
-        get_cnn_info(m, cnn, log, cnnscore, cnnaffinity, cnnvariance);
+        if (batch_cnn) {
+          poses.push_back(m);
+        } else {
+          get_cnn_info(m, cnn, log, cnnscore, cnnaffinity, cnnvariance);
 
-        out_cont[i].cnnscore = cnnscore;
-        out_cont[i].cnnaffinity = cnnaffinity;
-        out_cont[i].cnnvariance = cnnvariance;
+          out_cont[i].cnnscore = cnnscore;
+          out_cont[i].cnnaffinity = cnnaffinity;
+          out_cont[i].cnnvariance = cnnvariance;
+        }
 
         if (not_max(out_cont[i].e)) {
             intramolecular_energy = m.eval_intramolecular(exact_prec, authentic_v, out_cont[i].c);
@@ -391,6 +412,27 @@ void do_search(model& m, const boost::optional<model>& ref,
         }
       }
 
+      if (batch_cnn) {
+        std::vector<model*> pose_ptrs;
+        VINA_FOR_IN(i, poses)
+          pose_ptrs.push_back(&poses[i]);
+        std::vector<float> scores, affinities, variances;
+        cnn.score_batch(pose_ptrs, false, scores, affinities, variances);
+
+        VINA_FOR_IN(i, out_cont) {
+          out_cont[i].cnnscore = scores[i];
+          out_cont[i].cnnaffinity = affinities[i];
+          out_cont[i].cnnvariance = variances[i];
+          if (cnn.options().verbose) {
+            log << "CNNscore: " << std::fixed << std::setprecision(10) << scores[i];
+            log.endl();
+            log << "CNNaffinity: " << std::fixed << std::setprecision(10)
+                << affinities[i];
+            log.endl();
+          }
+        }
+      }
+
       auto sorter = [settings](const output_type& lhs, const output_type& rhs) {
         switch(settings.sort_order) {
         case Energy:
@@ -485,7 +527,8 @@ void main_procedure(model &m, precalculate &prec,
     bool no_cache, bool compute_atominfo,
     const grid_dims &gd, minimization_params minparm,
     const weighted_terms &wt, tee &log,
-    std::vector<result_info> &results, grid &user_grid, CNNScorer &cnn)
+    std::vector<result_info> &results, grid &user_grid, CNNScorer &cnn,
+    szv_grid_cache *receptor_gridcache = NULL)
 {
   doing(settings.verbosity, "Setting up the scoring function", log);
 
@@ -515,9 +558,22 @@ void main_procedure(model &m, precalculate &prec,
   par.mc.hunt_cap = vec(10, 10, 10);
   par.num_tasks = settings.exhaustiveness;
   par.num_threads = settings.cpu;
-  par.display_progress = true;
-
-  szv_grid_cache gridcache(m, prec.cutoff_sqr());
+  par.display_progress = !log.buffered(); //progress bar writes straight to stdout
+
+  //build the spline tables this complex needs up front, in parallel
+  std::vector<smt> types;
+  m.get_movable_atom_types(types);
+  const atomv& fixed = m.get_fixed_atoms();
+  VINA_FOR_IN(i, fixed)
+    types.push_back(fixed[i].get());
+  prec.prepare(types);
+
+  //receptor cells are shared between the ligands of a local search
+  boost::scoped_ptr<szv_grid_cache> ownedcache;
+  if (!receptor_gridcache)
+    ownedcache.reset(new szv_grid_cache(m, prec.cutoff_sqr()));
+  szv_grid_cache& gridcache =
+      receptor_gridcache ? *receptor_gridcache : *ownedcache;
   const fl slope = 1e3; // FIXME: too large? used to be 100
   if (settings.randomize_only)
   {
@@ -565,6 +621,9 @@ void main_procedure(model &m, precalculate &prec,
       {
         std::vector<smt> atom_types_needed;
         m.get_movable_atom_types(atom_types_needed);
+        if (settings.grid_cache.size() > 0)
+          c->set_disk_cache(settings.grid_cache,
+              cache::disk_key(m, gd, settings.grid_cache_signature));
         c->populate(m, prec, atom_types_needed, user_grid);
         done(settings.verbosity, log);
       }
@@ -807,17 +866,19 @@ struct writer_job
 {
     unsigned int molid;
     std::vector<result_info>* results;
+    std::stringstream* logbuf; //buffered log output of this ligand, if any
 
-    writer_job(unsigned int molid, std::vector<result_info>* results)
+    writer_job(unsigned int molid, std::vector<result_info>* results,
+        std::stringstream* logbuf = NULL)
         :
-            molid(molid), results(results)
+            molid(molid), results(results), logbuf(logbuf)
     {
     }
     ;
 
     writer_job()
         :
-            molid(0), results(NULL)
+            molid(0), results(NULL), logbuf(NULL)
     {
     }
     ;
@@ -871,21 +932,20 @@ struct global_state
     tee* log;
     std::ofstream* atomoutfile;
     cnn_options cnnopts;
+    szv_grid_cache* receptor_gridcache; //shared by all ligands if not NULL
 
     global_state(user_settings* settings, boost::shared_ptr<precalculate> prec,
         minimization_params* minparms, weighted_terms* wt,
         grid* user_grid, tee* log, std::ofstream* atomoutfile, const cnn_options& co):
         settings(settings), prec(prec), minparms(minparms), wt(wt),
             user_grid(user_grid), log(log), atomoutfile(atomoutfile),
-            cnnopts(co)
+            cnnopts(co), receptor_gridcache(NULL)
     {
     }
     ;
 };
 
 //function to occupy the worker threads with individual ligands from the work queue
-//TODO: see if implementing weight sharing between CNNScorer instances results
-//in enough memory efficiency to avoid using a single one
 void threads_at_work(job_queue<worker_job> *wrkq,
     job_queue<writer_job> *writerq, global_state *gs,
     MolGetter *mols, int *nligs, CNNScorer cnn_scorer) //copy cnn_scorer so it can maintain state
@@ -907,7 +967,7 @@ void threads_at_work(job_queue<worker_job> *wrkq,
         gs->atomoutfile->is_open()
             || gs->settings->include_atom_info, j.gd,
         *gs->minparms, *gs->wt, *gs->log, *(j.results),
-        *gs->user_grid, cnn_scorer);
+        *gs->user_grid, cnn_scorer, gs->receptor_gridcache);
 
     writer_job k(j.molid, j.results);
     writerq->push(k);
@@ -915,6 +975,32 @@ void threads_at_work(job_queue<worker_job> *wrkq,
   }
 }
 
+//process a single ligand as a top-level job of the global work scheduler,
+//which interleaves its monte carlo chains and refinement with those of other
+//ligands; log output of every ligand but the first is buffered and replayed
+//by the writer thread so the log stays in input order
+void scheduled_job(worker_job j, job_queue<writer_job> *writerq,
+    global_state *gs, int *nligs, CNNScorer cnn_scorer) //copy cnn_scorer so it can maintain state
+{
+  __sync_fetch_and_add(nligs, 1);
+
+  std::stringstream *logbuf = j.molid > 0 ? new std::stringstream : NULL;
+  boost::scoped_ptr<tee> buflog(logbuf ? new tee(*logbuf) : NULL);
+  tee& log = buflog ? *buflog : *gs->log;
+
+  main_procedure(*(j.m), *gs->prec, boost::optional<model>(),
+      *gs->settings,
+      false, // no_cache == false
+      gs->atomoutfile->is_open()
+          || gs->settings->include_atom_info, j.gd,
+      *gs->minparms, *gs->wt, log, *(j.results),
+      *gs->user_grid, cnn_scorer, gs->receptor_gridcache);
+
+  writer_job k(j.molid, j.results, logbuf);
+  writerq->push(k);
+  delete j.m;
+}
+
 void write_out(std::vector<result_info> &results, ozfile &outfile,
     std::string &outext,
     user_settings &settings, const weighted_terms &wt, ozfile &outflex,
@@ -951,26 +1037,30 @@ void thread_a_writing(job_queue<writer_job>* writerq,
     int* nligs) {
   try {
     int nwritten = 0;
-    boost::unordered_map<int, std::vector<result_info>*> proc_out;
+    boost::unordered_map<int, writer_job> proc_out;
     writer_job j;
     while (!writerq->wait_and_pop(j))
     {
       if (j.molid == nwritten) {
-        write_out(*j.results, *outfile, *outext, *gs->settings, *gs->wt,
-            *outflex, *outfext, *gs->atomoutfile);
-        nwritten++;
-        delete j.results;
-        for (boost::unordered_map<int, std::vector<result_info>*>::iterator i;
-            (i = proc_out.find(nwritten)) != proc_out.end();)
-            {
-          write_out(*i->second, *outfile, *outext, *gs->settings,
-              *gs->wt, *outflex, *outfext, *gs->atomoutfile);
+        for (;;) {
+          if (j.logbuf) {
+            *gs->log << j.logbuf->str();
+            delete j.logbuf;
+          }
+          write_out(*j.results, *outfile, *outext, *gs->settings, *gs->wt,
+              *outflex, *outfext, *gs->atomoutfile);
           nwritten++;
-          delete i->second;
+          delete j.results;
+
+          boost::unordered_map<int, writer_job>::iterator i = proc_out.find(nwritten);
+          if (i == proc_out.end())
+            break;
+          j = i->second;
+          proc_out.erase(i);
         }
       }
       else {
-        proc_out[j.molid] = j.results;
+        proc_out[j.molid] = j;
       }
     }
   } catch (file_error& e)
@@ -1061,6 +1151,7 @@ Thank you!\n";
     bool print_atom_types = false;
     bool add_hydrogens = true;
     bool strip_hydrogens = false;
+    unsigned parse_threads = 0;
     bool no_lig = false;
 
     user_settings settings;
@@ -1199,10 +1290,14 @@ Thank you!\n";
         "resolution of grids, don't change unless you really know what you are doing")
     ("cnn_rotation", value<unsigned>(&cnnopts.cnn_rotations)->default_value(0),
         "evaluate multiple rotations of pose (max 24)")
+    ("cnn_batch_size", value<unsigned>(&cnnopts.cnn_batch_size)->default_value(16),
+        "maximum number of poses rescored together in one CNN evaluation; poses are rescored one at a time with cnn_rotation")
     ("cnn_update_min_frame", bool_switch(&cnnopts.move_minimize_frame)->default_value(true),
         "During minimization, recenter coordinate frame as ligand moves")
     ("cnn_freeze_receptor", bool_switch(&cnnopts.fix_receptor),
         "Don't move the receptor with respect to a fixed coordinate system")
+    ("cnn_thread_replicas", bool_switch(&cnnopts.thread_replicas),
+        "score poses concurrently with a copy of the CNN activations per thread (weights are shared)")
     ("cnn_mix_emp_force", bool_switch(&cnnopts.mix_emp_force)->default_value(false),
         "Merge CNN and empirical minus forces")
     ("cnn_mix_emp_energy", bool_switch(&cnnopts.mix_emp_energy)->default_value(false),
@@ -1242,9 +1337,13 @@ Thank you!\n";
         "automatically add hydrogens in ligands (on by default)")
     ("stripH", value<bool>(&strip_hydrogens),
         "remove hydrogens from molecule _after_ performing atom typing for efficiency (off by default)")
+    ("parse_threads", value<unsigned>(&parse_threads)->default_value(0),
+        "number of threads converting input ligands ahead of docking (0 converts them as needed)")
     ("device", value<int>(&settings.device)->default_value(0),
         "GPU device to use")
-    ("no_gpu", bool_switch(&settings.no_gpu), "Disable GPU acceleration, even if available.");
+    ("no_gpu", bool_switch(&settings.no_gpu), "Disable GPU acceleration, even if available.")
+    ("grid_cache", value<std::string>(&settings.grid_cache),
+        "directory of receptor grids saved by earlier runs with the same receptor, box and scoring function; grids that are missing are computed and added");
 
 
     options_description config("Configuration file (optional)");
@@ -1476,6 +1575,7 @@ Thank you!\n";
     FlexInfo finfo(flex_res, flex_dist, flexdist_ligand, nflex, nflex_hard_limit, log);
     // dkoes - parse in receptor once
     MolGetter mols(rigid_name, flex_name, finfo, add_hydrogens, strip_hydrogens, log);
+    mols.setParseThreads(parse_threads);
 
     if (autobox_ligand.length() > 0) {
       setup_autobox(mols.getInitModel(),autobox_ligand, autobox_add,
@@ -1591,6 +1691,17 @@ Thank you!\n";
     if (settings.verbosity <= 1) {
       OpenBabel::obErrorLog.SetOutputLevel(OpenBabel::obError);
     }
+
+    //process-wide pool used for ligands, monte carlo chains and grid setup;
+    //it has to be set up before anything (e.g. building spline tables)
+    //uses it, or it would have the wrong size and no thread initialization
+    auto thread_init = [&settings]() {
+      if (!settings.no_gpu)
+        initializeCUDA(settings.device);
+    };
+    if (!work_scheduler::configure_global(settings.cpu, thread_init))
+      throw internal_error(__FILE__, __LINE__);
+
     //dkoes, hoist precalculation outside of loop
     weighted_terms wt(&t, t.weights());
 
@@ -1610,6 +1721,23 @@ Thank you!\n";
       prec = boost::shared_ptr<precalculate>(
           new precalculate_exact(wt));
 
+    if (settings.grid_cache.size() > 0)
+    {
+      //everything other than the receptor and box that grid values depend on
+      std::stringstream sig;
+      sig << std::setprecision(17) << t << approx << " " << approx_factor
+          << "\n";
+      print_atom_info(sig);
+      settings.grid_cache_signature = sig.str();
+
+      //spline tables only depend on the scoring function
+      precalculate_splines *sprec =
+          dynamic_cast<precalculate_splines*>(prec.get());
+      if (sprec)
+        sprec->set_disk_cache(settings.grid_cache,
+            settings.grid_cache_signature);
+    }
+
     //setup single outfile
     using namespace OpenBabel;
     ozfile outfile;
@@ -1647,11 +1775,30 @@ Thank you!\n";
     size_t nthreads = settings.cpu;
     global_state gs(&settings, prec, &minparms, &wt, &user_grid,
         &log, &atomoutfile, cnnopts);
+    //local searches only look near each ligand, so ligands can share the
+    //receptor atoms found near any cell instead of each finding their own
+    //(the gpu code needs the ligand model of the cache)
+    boost::scoped_ptr<szv_grid_cache> receptor_gridcache;
+    if (settings.local_only && !settings.gpu_docking) {
+      receptor_gridcache.reset(new szv_grid_cache(mols.getInitModel(),
+          prec->cutoff_sqr(), true));
+      gs.receptor_gridcache = receptor_gridcache.get();
+    }
     boost::thread_group worker_threads;
+    work_scheduler* sched = NULL;
     boost::timer::cpu_timer time;
     CNNScorer cnn_scorer(cnnopts); //shared network
 
-    if (!settings.local_only)
+    if (!settings.gpu_docking)
+    {
+      //ligands and their monte carlo chains are interleaved on the pool;
+      //keep just enough ligands in flight to saturate every core
+      sched = &work_scheduler::global();
+      sched->set_max_jobs(settings.local_only ? 2 * settings.cpu :
+          settings.cpu / settings.exhaustiveness + 2);
+      nthreads = 0;
+    }
+    else if (!settings.local_only)
       nthreads = 1; //docking is multithreaded already, don't add additional parallelism other than pipeline
 
     //launch worker threads to process ligands in the work queue
@@ -1665,6 +1812,7 @@ Thank you!\n";
         &outext, &outflex, &outfext, &nligs);
 
     try {
+      unsigned molid = 0; //position in output across all ligand files
       //loop over input ligands, adding them to the work queue
       for (unsigned l = 0, nl = ligand_names.size(); l < nl; l++) {
         doing(settings.verbosity, "Reading input", log);
@@ -1711,17 +1859,27 @@ Thank you!\n";
           done(settings.verbosity, log);
           std::vector<result_info>* results =
               new std::vector<result_info>();
-          worker_job j(i, m, results, gdbox);
-          wrkq.push(j);
+          worker_job j(molid, m, results, gdbox);
+          if (sched)
+            sched->submit(boost::bind(scheduled_job, j, &writerq, &gs,
+                &nligs, cnn_scorer));
+          else
+            wrkq.push(j);
+          molid++;
 
           i++;
           if (no_lig)
             break;
         }
       }
+
+      if (sched)
+        sched->join(); //rethrows errors from ligand jobs
     } catch (...)
     {
       //clean up threads before passing along exception
+      if (sched)
+        sched->drain();
       wrkq.close(nthreads);
       worker_threads.join_all();
       writerq.close(1);
@@ -1736,6 +1894,18 @@ Thank you!\n";
     writerq.close(1);
     writer_thread.join();
 
+    precalculate_splines *sprec =
+        dynamic_cast<precalculate_splines*>(prec.get());
+    if (sprec)
+      sprec->store_disk_cache();
+
+    if (settings.verbosity > 1) {
+      work_scheduler::statistics st = work_scheduler::global().stats();
+      log << "Thread pool: " << st.tasks << " tasks, " << std::setprecision(3)
+          << st.queue_wait << "s total queue wait, " << st.idle
+          << "s total idle\n";
+    }
+
     sz free_byte = 0, total_byte = 0;
     if(settings.verbosity > 1 && cudaMemGetInfo( &free_byte, &total_byte ) == cudaSuccess) {
       double free_db = (double)free_byte ;
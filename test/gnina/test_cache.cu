@@ -12,6 +12,8 @@
 #include "custom_terms.h"
 #include "precalculate_gpu.h"
 #include "szv_grid.h"
+#include "non_cache.h"
+#include "curl.h"
 #include "test_cache.h"
 #include "parsed_args.h"
 #include "test_utils.h"
@@ -105,11 +107,12 @@ void test_cache_eval_deriv() {
     m->atoms[i].coords = *(vec*) &lig_atoms[i];
   }
 
+  atomv& grid_atoms = m->grid_atoms.mutate();
   for (size_t i = 0; i < rec_atoms.size(); ++i) {
-    m->grid_atoms.push_back(atom());
-    m->grid_atoms[i].sm = rec_types[i];
-    m->grid_atoms[i].charge = rec_atoms[i].charge;
-    m->grid_atoms[i].coords = *(vec*) &rec_atoms[i];
+    grid_atoms.push_back(atom());
+    grid_atoms[i].sm = rec_types[i];
+    grid_atoms[i].charge = rec_atoms[i].charge;
+    grid_atoms[i].coords = *(vec*) &rec_atoms[i];
   }
 
   szv_grid_cache gridcache(*m, cutoff_sqr);
@@ -153,3 +156,147 @@ void test_cache_eval_deriv() {
       BOOST_REQUIRE_SMALL(m->minus_forces[i][j] - g_forces[i][j], (float )0.01);
 }
 
+
+void test_non_cache_eval_deriv() {
+  p_args.log << "Non-cache Eval Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << "\n";
+  p_args.log << "Iteration " << p_args.iter_count;
+  p_args.log.endl();
+  std::mt19937 engine(p_args.seed);
+
+  custom_terms t;
+  t.add("gauss(o=0,_w=0.5,_c=8)", -0.035579);
+  t.add("gauss(o=3,_w=2,_c=8)", -0.005156);
+  t.add("repulsion(o=0,_c=8)", 0.840245);
+  t.add("hydrophobic(g=0.5,_b=1.5,_c=8)", -0.035069);
+  t.add("non_dir_h_bond(g=-0.7,_b=0,_c=8)", -0.587439);
+  t.add("electrostatic(i=1,_^=100,_c=8)", 0.1);
+  t.add("num_tors_div", 5 * 0.05846 / 0.1 - 1);
+  weighted_terms wt(&t, t.weights());
+  precalculate_splines prec(wt, 10);
+  const fl v = 10;
+
+  std::vector<atom_params> lig_atoms;
+  std::vector<smt> lig_types;
+  make_mol(lig_atoms, lig_types, engine, 0);
+
+  //box around the ligand so no atom is out of bounds
+  vec lo(HUGE_VALF, HUGE_VALF, HUGE_VALF), hi(-HUGE_VALF, -HUGE_VALF,
+      -HUGE_VALF);
+  for (auto& atom : lig_atoms) {
+    for (size_t i = 0; i < 3; ++i) {
+      lo[i] = std::min(lo[i], atom.coords[i]);
+      hi[i] = std::max(hi[i], atom.coords[i]);
+    }
+  }
+  grid_dims gd;
+  for (size_t i = 0; i < 3; ++i) {
+    gd[i].begin = lo[i] - 1;
+    gd[i].end = hi[i] + 1;
+    gd[i].n = sz(std::ceil((gd[i].end - gd[i].begin) / 0.375));
+  }
+
+  std::vector<atom_params> rec_atoms;
+  std::vector<smt> rec_types;
+  const fl cutoff = std::sqrt(prec.cutoff_sqr());
+  make_mol(rec_atoms, rec_types, engine, 0, 10, 500, hi[0] + cutoff,
+      hi[1] + cutoff, hi[2] + cutoff);
+
+  std::unique_ptr<model> m(new model);
+  m->m_num_movable_atoms = lig_atoms.size();
+  m->minus_forces = std::vector<vec>(m->m_num_movable_atoms);
+  for (size_t i = 0; i < lig_atoms.size(); ++i) {
+    m->coords.push_back(*(vec*) &lig_atoms[i]);
+    m->atoms.push_back(atom());
+    m->atoms[i].sm = lig_types[i];
+    m->atoms[i].charge = lig_atoms[i].charge;
+    m->atoms[i].coords = *(vec*) &lig_atoms[i];
+  }
+  atomv& grid_atoms = m->grid_atoms.mutate();
+  for (size_t i = 0; i < rec_atoms.size(); ++i) {
+    grid_atoms.push_back(atom());
+    grid_atoms[i].sm = rec_types[i];
+    grid_atoms[i].charge = rec_atoms[i].charge;
+    grid_atoms[i].coords = *(vec*) &rec_atoms[i];
+  }
+
+  szv_grid_cache gridcache(*m, prec.cutoff_sqr());
+  non_cache nc(gridcache, gd, &prec);
+  grid user_grid;
+  fl nc_out = nc.eval_deriv(*m, v, user_grid);
+
+  //reference: every receptor atom, one pair at a time
+  fl ref_out = 0;
+  for (size_t i = 0; i < lig_atoms.size(); ++i) {
+    const atom& a = m->atoms[i];
+    vec deriv(0, 0, 0);
+    fl e = 0;
+    if (a.get() < num_atom_types() && !a.is_hydrogen()) {
+      for (size_t j = 0; j < grid_atoms.size(); ++j) {
+        const atom& b = grid_atoms[j];
+        if (b.is_hydrogen() || !b.acceptable_type()) continue;
+        vec r_ba = m->coords[i] - b.coords;
+        fl r2 = sqr(r_ba);
+        if (r2 < prec.cutoff_sqr()) {
+          pr e_dor = prec.eval_deriv(a, b, r2);
+          e += e_dor.first;
+          deriv += e_dor.second * r_ba;
+        }
+      }
+      curl(e, deriv, v);
+    }
+    ref_out += e;
+    for (size_t j = 0; j < 3; ++j)
+      BOOST_REQUIRE_SMALL(m->minus_forces[i][j] - deriv[j], (float )0.01);
+  }
+  p_args.log << "Block energy: " << nc_out << " Pairwise energy: " << ref_out
+      << "\n\n";
+  BOOST_REQUIRE_SMALL(nc_out - ref_out, (float )0.01);
+}
+
+//the batched pair kernel agrees with per-pair evaluation, with and without
+//charge dependent terms
+void test_eval_deriv_many() {
+  p_args.log << "Pair Batch Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << "\n";
+  p_args.log << "Iteration " << p_args.iter_count;
+  p_args.log.endl();
+  std::mt19937 engine(p_args.seed);
+  std::uniform_int_distribution<int> type_dist(0, num_atom_types() - 1);
+  std::uniform_real_distribution<fl> charge_dist(-1, 1);
+
+  for (unsigned charged = 0; charged < 2; charged++) {
+    custom_terms t;
+    t.add("gauss(o=0,_w=0.5,_c=8)", -0.035579);
+    t.add("repulsion(o=0,_c=8)", 0.840245);
+    t.add("hydrophobic(g=0.5,_b=1.5,_c=8)", -0.035069);
+    t.add("non_dir_h_bond(g=-0.7,_b=0,_c=8)", -0.587439);
+    if (charged) t.add("electrostatic(i=1,_^=100,_c=8)", 0.1);
+    weighted_terms wt(&t, t.weights());
+    precalculate_splines prec(wt, 10);
+    std::uniform_real_distribution<fl> r2_dist(0.01, prec.cutoff_sqr());
+
+    const sz n = 64;
+    smt ta[n], tb[n];
+    fl qa[n], qb[n], r2[n], e[n], dor[n];
+    for (sz i = 0; i < n; i++) {
+      ta[i] = (smt) type_dist(engine);
+      tb[i] = i % 4 ? ta[i] : (smt) type_dist(engine); //runs of repeated pairs
+      qa[i] = charge_dist(engine);
+      qb[i] = charge_dist(engine);
+      r2[i] = r2_dist(engine);
+    }
+    prec.eval_deriv_many(ta, tb, qa, qb, r2, n, e, dor);
+
+    atom_base a, b;
+    for (sz i = 0; i < n; i++) {
+      a.sm = ta[i];
+      a.charge = qa[i];
+      b.sm = tb[i];
+      b.charge = qb[i];
+      pr ref = prec.eval_deriv(a, b, r2[i]);
+      BOOST_REQUIRE_SMALL(e[i] - ref.first, (float )0.0001);
+      BOOST_REQUIRE_SMALL(dor[i] - ref.second, (float )0.0001);
+    }
+  }
+}
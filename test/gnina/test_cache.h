@@ -1,3 +1,5 @@
 #pragma once
 
 void test_cache_eval_deriv();
+void test_non_cache_eval_deriv();
+void test_eval_deriv_many();
@@ -4,6 +4,7 @@
 #include "test_cnn.h"
 #include "atom_constants.h"
 #include "cnn_scorer.h"
+#include "molgetter.h"
 #include <cuda_runtime.h>
 #include "quaternion.h"
 #include "caffe/proto/caffe.pb.h"
@@ -11,6 +12,10 @@
 #include "caffe/util/rng.hpp"
 #include "caffe/util/device_alternate.hpp"
 #include <boost/multi_array/multi_array_ref.hpp>
+#include <boost/filesystem/path.hpp>
+#include <boost/filesystem/operations.hpp>
+#include <fstream>
+#include <numeric>
 #define BOOST_TEST_DYN_LINK
 #include <boost/test/unit_test.hpp>
 #include <boost/test/tools/floating_point_comparison.hpp>
@@ -22,7 +27,7 @@ using namespace caffe;
 using namespace std;
 
 template <typename atomT, typename Dtype>
-inline void set_cnn_grids(caffe::MolGridDataLayer<Dtype>* mgrid, std::vector<atom_params>& mol_atoms, std::vector<atomT>& mol_types) {
+inline void set_cnn_grids(caffe::MolGridDataLayer<Dtype>* mgrid, std::vector<atom_params>& mol_atoms, std::vector<atomT>& mol_types, unsigned mol_idx = 0) {
   //first set up mgrid
   vec center(0,0,0);
   std::vector<float3> coords;
@@ -38,11 +43,60 @@ inline void set_cnn_grids(caffe::MolGridDataLayer<Dtype>* mgrid, std::vector<ato
     a.coords = vec({coord.x, coord.y, coord.z});
     coords.push_back(coord);
   }
-  mgrid->setLigand(coords, smtypes);
+  mgrid->setLigand(coords, smtypes, true, mol_idx);
   mgrid->setLabels(1.0,0);
 }
 
 
+//log the test and iteration, use caffe in mode and return an engine seeded
+//for the iteration
+static std::mt19937 begin_test(const std::string& name, Caffe::Brew mode = Caffe::GPU) {
+  p_args.log << "CNN " << name << " Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << '\n';
+  p_args.log << "Iteration " << p_args.iter_count << '\n';
+  Caffe::set_mode(mode);
+  return std::mt19937(p_args.seed);
+}
+
+//score with the default built-in model
+static cnn_options default_cnn_options() {
+  cnn_options cnnopts;
+  cnnopts.cnn_scoring = CNNall;
+  cnnopts.cnn_model_names.push_back("crossdock_default2018");
+  return cnnopts;
+}
+
+static std::vector<float3> atom_coords(const std::vector<atom_params>& atoms) {
+  std::vector<float3> coords;
+  for (size_t i = 0; i < atoms.size(); ++i)
+    coords.push_back(float3({atoms[i].coords.x, atoms[i].coords.y, atoms[i].coords.z}));
+  return coords;
+}
+
+//blobs for the tops of an in memory grid layer, shaped for batch examples
+template <typename Dtype>
+struct grid_tops {
+  MolGridDataLayer<Dtype>* mgrid;
+  vector<Blob<Dtype> > blobs;
+  vector<Blob<Dtype>*> bottom; //not used
+  vector<Blob<Dtype>*> top;
+
+  grid_tops(MolGridDataLayer<Dtype>* m, int batch = 1): mgrid(m), blobs(m->ExactNumTopBlobs()) {
+    for (unsigned i = 0; i < blobs.size(); i++)
+      top.push_back(&blobs[i]);
+    reshape(batch);
+  }
+
+  void reshape(int batch) {
+    int ntypes = mgrid->getNumChannels();
+    int dim = mgrid->getGridDims().x;
+    blobs[0].Reshape({batch,ntypes,dim,dim,dim});
+    for (unsigned i = 1; i < blobs.size(); i++)
+      blobs[i].Reshape({batch,1});
+  }
+};
+
+
 void test_set_atom_gradients() {
   // randomly generate gridpoint gradients, accumulate for atoms, and then compare
   p_args.log << "CNN Set Atom Gradients Test \n";
@@ -167,6 +221,440 @@ void test_vanilla_grids() {
   }
 }
 
+void test_batch_grids() {
+  //grid two random mols as one in memory batch, check each example matches
+  //the grid of that mol on its own
+  std::mt19937 engine = begin_test("Batch Grids");
+  std::vector<atom_params> mol_atoms[2];
+  std::vector<smt> mol_types[2];
+  for (unsigned b = 0; b < 2; b++)
+    make_mol(mol_atoms[b], mol_types[b], engine);
+
+  CNNScorer cnn_scorer(default_cnn_options());
+  typedef CNNScorer::Dtype Dtype;
+  MolGridDataLayer<Dtype>* mgrid = cnn_scorer.get_mgrid();
+  grid_tops<Dtype> tops(mgrid);
+  unsigned example_size = tops.blobs[0].count();
+
+  //each mol alone
+  vector<Dtype> singleout[2];
+  for (unsigned b = 0; b < 2; b++) {
+    set_cnn_grids(mgrid, mol_atoms[b], mol_types[b]);
+    mgrid->forward(tops.bottom, tops.top, false);
+    singleout[b].assign(tops.blobs[0].cpu_data(), tops.blobs[0].cpu_data()+example_size);
+  }
+
+  //both in one batch
+  mgrid->setBatchSize(2);
+  BOOST_REQUIRE_EQUAL(mgrid->getBatchSize(), 2U);
+  tops.reshape(2);
+  for (unsigned b = 0; b < 2; b++)
+    set_cnn_grids(mgrid, mol_atoms[b], mol_types[b], b);
+  mgrid->forward(tops.bottom, tops.top, false);
+
+  const Dtype *batchout = tops.blobs[0].cpu_data();
+  for (unsigned b = 0; b < 2; b++) {
+    for(unsigned i = 0; i < example_size; i++) {
+      BOOST_REQUIRE_SMALL(singleout[b][i]-batchout[b*example_size+i], TOL);
+    }
+  }
+  mgrid->setBatchSize(1);
+}
+
+void test_receptor_grid_reuse() {
+  //grid a random receptor with several ligands, the receptor channels should
+  //only be computed again once the receptor moves
+  std::mt19937 engine = begin_test("Receptor Grid Reuse");
+  std::vector<atom_params> rec_atoms, mol_atoms[2];
+  std::vector<smt> rec_types, mol_types[2];
+  make_mol(rec_atoms, rec_types, engine);
+  for (unsigned b = 0; b < 2; b++)
+    make_mol(mol_atoms[b], mol_types[b], engine);
+
+  CNNScorer cnn_scorer(default_cnn_options());
+  typedef CNNScorer::Dtype Dtype;
+  MolGridDataLayer<Dtype>* mgrid = cnn_scorer.get_mgrid();
+  grid_tops<Dtype> tops(mgrid);
+  unsigned recsize = mgrid->getNumReceptorChannels()*tops.blobs[0].count(2);
+
+  std::vector<float3> rec_coords = atom_coords(rec_atoms);
+  mgrid->setReceptor(rec_coords, rec_types);
+  unsigned long hits = mgrid->getReceptorGridHits();
+  unsigned long misses = mgrid->getReceptorGridMisses();
+
+  set_cnn_grids(mgrid, mol_atoms[0], mol_types[0]);
+  mgrid->setGridCenter(vec(0,0,0)); //don't follow the ligand
+  mgrid->forward(tops.bottom, tops.top, false);
+  BOOST_REQUIRE_EQUAL(mgrid->getReceptorGridMisses(), misses+1);
+  vector<Dtype> first(tops.blobs[0].cpu_data(), tops.blobs[0].cpu_data()+tops.blobs[0].count());
+
+  //same receptor, different ligand
+  set_cnn_grids(mgrid, mol_atoms[1], mol_types[1]);
+  mgrid->setGridCenter(vec(0,0,0));
+  mgrid->forward(tops.bottom, tops.top, false);
+  BOOST_REQUIRE_EQUAL(mgrid->getReceptorGridHits(), hits+1);
+  const Dtype *out = tops.blobs[0].cpu_data();
+  for(unsigned i = 0; i < recsize; i++)
+    BOOST_REQUIRE_EQUAL(first[i], out[i]);
+
+  //back to the first ligand, the whole grid is unchanged
+  set_cnn_grids(mgrid, mol_atoms[0], mol_types[0]);
+  mgrid->setGridCenter(vec(0,0,0));
+  mgrid->forward(tops.bottom, tops.top, false);
+  BOOST_REQUIRE_EQUAL(mgrid->getReceptorGridHits(), hits+2);
+  out = tops.blobs[0].cpu_data();
+  for(unsigned i = 0, n = first.size(); i < n; i++)
+    BOOST_REQUIRE_EQUAL(first[i], out[i]);
+
+  //moving the receptor invalidates its channels
+  rec_coords[0].x += 1.0;
+  mgrid->setReceptor(rec_coords, rec_types);
+  mgrid->forward(tops.bottom, tops.top, false);
+  BOOST_REQUIRE_EQUAL(mgrid->getReceptorGridMisses(), misses+2);
+  BOOST_REQUIRE_EQUAL(mgrid->getReceptorGridHits(), hits+2);
+}
+
+void test_shared_grids() {
+  //a layer given the grids of another layer should produce exactly those
+  //grids without any atoms of its own
+  std::mt19937 engine = begin_test("Shared Grids");
+  std::vector<atom_params> mol_atoms;
+  std::vector<smt> mol_types;
+  make_mol(mol_atoms, mol_types, engine);
+
+  CNNScorer gridder(default_cnn_options()), sharer(default_cnn_options());
+  typedef CNNScorer::Dtype Dtype;
+  grid_tops<Dtype> gridtops(gridder.get_mgrid()), sharetops(sharer.get_mgrid());
+
+  set_cnn_grids(gridder.get_mgrid(), mol_atoms, mol_types);
+  sharer.get_mgrid()->setLabels(1.0,0);
+  sharer.get_mgrid()->setGridSource(&gridtops.blobs[0]);
+
+  for (unsigned gpu = 0; gpu < 2; gpu++) {
+    gridder.get_mgrid()->forward(gridtops.bottom, gridtops.top, gpu);
+    sharer.get_mgrid()->forward(sharetops.bottom, sharetops.top, gpu);
+
+    const Dtype *grid = gridtops.blobs[0].cpu_data();
+    const Dtype *shared = sharetops.blobs[0].cpu_data();
+    Dtype sum = 0;
+    for(unsigned i = 0, n = gridtops.blobs[0].count(); i < n; i++) {
+      BOOST_REQUIRE_EQUAL(grid[i], shared[i]);
+      sum += grid[i];
+    }
+    BOOST_REQUIRE_NE(sum, 0);
+  }
+}
+
+//test/gnina/data, with a trailing slash
+static std::string test_data_dir() {
+  return (boost::filesystem::path(__FILE__).parent_path() / "data").string() + "/";
+}
+
+//read the receptor and first ligand of test/gnina/data/<name>_rec.pdb and
+//<name>_lig.sdf into m
+static void read_test_model(const std::string& name, model& m) {
+  std::string data = test_data_dir();
+  tee log(true);
+  FlexInfo finfo(log);
+  MolGetter mols(data + name + "_rec.pdb", "", finfo, true, true, log);
+  mols.setInputFile(data + name + "_lig.sdf");
+  BOOST_REQUIRE(mols.readMoleculeIntoModel(m));
+}
+
+//m with its ligand moved by up to an angstrom along each axis
+static model moved_pose(const model& m, std::mt19937& engine) {
+  std::uniform_real_distribution<float> shift(-1, 1);
+  model moved = m;
+  conf c = m.get_initial_conf(false);
+  c.ligands[0].rigid.position += vec(shift(engine), shift(engine), shift(engine));
+  moved.set(c);
+  return moved;
+}
+
+//require equal values, up to the order of summation
+static void require_close(float a, float b) {
+  BOOST_REQUIRE_SMALL(a - b, TOL * std::max(1.0f, std::fabs(a)));
+}
+
+static void require_same_forces(const model& a, const model& b) {
+  BOOST_REQUIRE_EQUAL(a.minus_forces.size(), b.minus_forces.size());
+  for (unsigned i = 0, n = a.minus_forces.size(); i < n; i++)
+    for (unsigned j = 0; j < 3; j++)
+      require_close(a.minus_forces[i][j], b.minus_forces[i][j]);
+}
+
+void test_shared_grid_scores() {
+  //an ensemble of nets that grid alike should score poses the same whether
+  //the nets share the grids of the first or grid on their own
+  std::mt19937 engine = begin_test("Shared Grid Scores");
+  model m;
+  read_test_model("184l", m);
+  model moved = moved_pose(m, engine); //another pose for batches
+
+  cnn_options cnnopts = default_cnn_options();
+  cnnopts.cnn_model_names.push_back("dense");
+  CNNScorer shared(cnnopts), separate(cnnopts);
+  separate.share_grids(false);
+  CNNScorer *scorers[2] = {&shared, &separate};
+
+  model single[2] = {m, m};
+  float scores[2], affinities[2], losses[2], variances[2];
+  for (unsigned k = 0; k < 2; k++) {
+    scorers[k]->set_center_from_model(single[k]);
+    scores[k] = scorers[k]->score(single[k], true, affinities[k], losses[k], variances[k]);
+  }
+  require_close(scores[0], scores[1]);
+  require_close(affinities[0], affinities[1]);
+  require_close(losses[0], losses[1]);
+  require_close(variances[0], variances[1]);
+  require_same_forces(single[0], single[1]);
+
+  //the scores of the nets of a batch are gathered per group
+  std::vector<model> poses[2] = {{m, moved}, {m, moved}};
+  std::vector<float> bscores[2], baffinities[2], bvariances[2];
+  for (unsigned k = 0; k < 2; k++) {
+    std::vector<model*> ms{&poses[k][0], &poses[k][1]};
+    scorers[k]->score_batch(ms, true, bscores[k], baffinities[k], bvariances[k]);
+    BOOST_REQUIRE_EQUAL(bscores[k].size(), 2U);
+  }
+  for (unsigned p = 0; p < 2; p++) {
+    require_close(bscores[0][p], bscores[1][p]);
+    require_close(baffinities[0][p], baffinities[1][p]);
+    require_close(bvariances[0][p], bvariances[1][p]);
+    require_same_forces(poses[0][p], poses[1][p]);
+  }
+}
+
+void test_batch_rotation_scores() {
+  //with random rotations, poses scored as a batch should get the scores,
+  //variances and gradients they get when scored one at a time
+  std::mt19937 engine = begin_test("Batch Rotation Scores");
+  model m;
+  read_test_model("184l", m);
+  model moved = moved_pose(m, engine);
+
+  cnn_options cnnopts = default_cnn_options();
+  cnnopts.cnn_rotations = 4;
+  cnnopts.seed = p_args.seed;
+  CNNScorer cnn_scorer(cnnopts);
+  cnn_scorer.set_center_from_model(m);
+
+  std::vector<model> poses{m, moved};
+  std::vector<model*> ms{&poses[0], &poses[1]};
+  std::vector<float> bscores, baffinities, bvariances;
+  cnn_scorer.score_batch(ms, true, bscores, baffinities, bvariances);
+  BOOST_REQUIRE_EQUAL(bscores.size(), 2U);
+
+  model single[2] = {m, moved};
+  for (unsigned p = 0; p < 2; p++) {
+    float affinity = 0, loss = 0, variance = 0;
+    float score = cnn_scorer.score(single[p], true, affinity, loss, variance);
+    require_close(bscores[p], score);
+    require_close(baffinities[p], affinity);
+    require_close(bvariances[p], variance);
+    require_same_forces(poses[p], single[p]);
+  }
+}
+
+void test_model_registry() {
+  //scorers built from the same options should use the weights loaded once,
+  //and a clone should score a pose exactly like the scorer it came from
+  begin_test("Model Registry");
+  CNNScorer first(default_cnn_options()), second(default_cnn_options());
+  typedef CNNScorer::Dtype Dtype;
+  caffe::shared_ptr<Net<Dtype> > a = first.get_net(), b = second.get_net();
+  BOOST_REQUIRE(a != b);
+  const vector<Blob<Dtype>*>& aparams = a->learnable_params();
+  const vector<Blob<Dtype>*>& bparams = b->learnable_params();
+  BOOST_REQUIRE_GT(aparams.size(), 0U);
+  BOOST_REQUIRE_EQUAL(aparams.size(), bparams.size());
+  for (unsigned i = 0; i < aparams.size(); i++) {
+    BOOST_REQUIRE(aparams[i] != bparams[i]);
+    BOOST_REQUIRE_EQUAL(aparams[i]->data().get(), bparams[i]->data().get());
+  }
+
+  model m;
+  read_test_model("184l", m);
+  CNNScorer cloned = first.clone();
+  CNNScorer *scorers[2] = {&first, &cloned};
+  model poses[2] = {m, m};
+  float scores[2], affinities[2], losses[2], variances[2];
+  for (unsigned k = 0; k < 2; k++) {
+    scorers[k]->set_center_from_model(poses[k]);
+    scores[k] = scorers[k]->score(poses[k], true, affinities[k], losses[k], variances[k]);
+  }
+  BOOST_REQUIRE_EQUAL(scores[0], scores[1]);
+  BOOST_REQUIRE_EQUAL(affinities[0], affinities[1]);
+  BOOST_REQUIRE_EQUAL(losses[0], losses[1]);
+  require_same_forces(poses[0], poses[1]);
+}
+
+//every grid point with density should be in an occupied tile; the
+//receptor channels are scanned, so every occupied tile of those should hold
+//some density, while ligand tiles are marked around atoms and may be empty
+static void check_grid_tiles(const GridTiles* tiles, const Blob<CNNScorer::Dtype>& grid, int recchannels) {
+  BOOST_REQUIRE(tiles->valid());
+  int channels = grid.shape(1);
+  int dim = grid.shape(2);
+  int tile = tiles->tile();
+  const CNNScorer::Dtype *values = grid.cpu_data();
+  vector<char> density(channels*tiles->tiles(), 0);
+  for(int c = 0; c < channels; c++) {
+    for(int x = 0; x < dim; x++) {
+      for(int y = 0; y < dim; y++) {
+        for(int z = 0; z < dim; z++) {
+          if(values[((c*dim + x)*dim + y)*dim + z] != 0) {
+            BOOST_REQUIRE(tiles->occupied(0, c, x/tile, y/tile, z/tile));
+            density[((c*tiles->per_axis() + x/tile)*tiles->per_axis() + y/tile)*tiles->per_axis() + z/tile] = 1;
+          }
+        }
+      }
+    }
+  }
+  unsigned occupied = 0;
+  for(int c = 0; c < channels; c++) {
+    for(int tx = 0; tx < tiles->per_axis(); tx++) {
+      for(int ty = 0; ty < tiles->per_axis(); ty++) {
+        for(int tz = 0; tz < tiles->per_axis(); tz++) {
+          bool occ = tiles->occupied(0, c, tx, ty, tz);
+          if(c < recchannels)
+            BOOST_REQUIRE_EQUAL(occ, density[((c*tiles->per_axis() + tx)*tiles->per_axis() + ty)*tiles->per_axis() + tz] != 0);
+          occupied += occ;
+        }
+      }
+    }
+  }
+  BOOST_REQUIRE_GT(occupied, 0);
+}
+
+void test_grid_tiles() {
+  //the tiles tracked when gridding on the cpu should match the grids,
+  //including receptor channels taken from the receptor grid cache
+  std::mt19937 engine = begin_test("Grid Tiles");
+  std::vector<atom_params> rec_atoms, mol_atoms[2];
+  std::vector<smt> rec_types, mol_types[2];
+  make_mol(rec_atoms, rec_types, engine);
+  for (unsigned b = 0; b < 2; b++)
+    make_mol(mol_atoms[b], mol_types[b], engine);
+
+  CNNScorer cnn_scorer(default_cnn_options());
+  typedef CNNScorer::Dtype Dtype;
+  MolGridDataLayer<Dtype>* mgrid = cnn_scorer.get_mgrid();
+  mgrid->setTileSize(8);
+  grid_tops<Dtype> tops(mgrid);
+
+  mgrid->setReceptor(atom_coords(rec_atoms), rec_types);
+  unsigned long hits = mgrid->getReceptorGridHits();
+  for (unsigned b = 0; b < 2; b++) {
+    set_cnn_grids(mgrid, mol_atoms[b], mol_types[b]);
+    mgrid->setGridCenter(vec(0,0,0)); //keep the receptor grid
+    mgrid->forward(tops.bottom, tops.top, false);
+    check_grid_tiles(mgrid->getTiles(), tops.blobs[0], mgrid->getNumReceptorChannels());
+  }
+  BOOST_REQUIRE_EQUAL(mgrid->getReceptorGridHits(), hits+1);
+
+  //not tracked on the gpu
+  mgrid->forward(tops.bottom, tops.top, true);
+  BOOST_REQUIRE(!mgrid->getTiles()->valid());
+}
+
+void test_sparse_grid_gradients() {
+  //skipping empty tiles of the grids on the cpu should change neither the
+  //atom gradients nor the receptor transformation gradient of a pose, with
+  //the receptor fixed (when backward skips them too) or moving
+  begin_test("Sparse Grid Gradients", Caffe::CPU);
+  model m;
+  read_test_model("184l", m);
+
+  for (unsigned fixed = 0; fixed < 2; fixed++) {
+    cnn_options cnnopts = default_cnn_options();
+    cnnopts.fix_receptor = fixed;
+    CNNScorer sparse(cnnopts), dense(cnnopts);
+    dense.sparse_grids(false);
+    CNNScorer *scorers[2] = {&sparse, &dense};
+
+    model poses[2] = {m, m};
+    float scores[2], affinities[2], losses[2], variances[2];
+    for (unsigned k = 0; k < 2; k++) {
+      scorers[k]->set_center_from_model(poses[k]);
+      scores[k] = scorers[k]->score(poses[k], true, affinities[k], losses[k], variances[k]);
+    }
+    require_close(scores[0], scores[1]);
+    require_same_forces(poses[0], poses[1]);
+    for (unsigned j = 0; j < 3; j++) {
+      require_close(poses[0].rec_change.position[j], poses[1].rec_change.position[j]);
+      require_close(poses[0].rec_change.orientation[j], poses[1].rec_change.orientation[j]);
+    }
+    if (!fixed)
+      BOOST_REQUIRE_NE(poses[1].rec_change.position.norm_sqr(), 0);
+  }
+}
+
+//grid the frames of a group of identical examples, two frames per forward,
+//and return the grids of each frame
+static vector<vector<float> > grid_group_chunks(unsigned prefetch) {
+  namespace fs = boost::filesystem;
+  fs::path types = fs::temp_directory_path() / fs::unique_path("group_%%%%%%%%.types");
+  {
+    std::ofstream out(types.string().c_str());
+    for (unsigned i = 0; i < 4; i++)
+      out << "1 0 184l_rec.pdb 184l_lig.sdf\n"; //label group receptor ligand
+  }
+
+  LayerParameter lparam;
+  lparam.set_type("MolGridData");
+  MolGridDataParameter* param = lparam.mutable_molgrid_data_param();
+  param->set_source(types.string());
+  param->set_root_folder(test_data_dir());
+  param->set_batch_size(1);
+  param->set_dimension(12);
+  param->set_resolution(0.5);
+  param->set_shuffle(false);
+  param->set_balanced(false);
+  param->set_random_rotation(true);
+  param->set_random_translate(2);
+  param->set_max_group_size(4);
+  param->set_max_group_chunk_size(2);
+  param->set_prefetch(prefetch);
+
+  vector<vector<float> > frames;
+  {
+    MolGridDataLayer<float> mgrid(lparam);
+    vector<Blob<float> > topblobs(3); //grids, labels, sequence continuation
+    vector<Blob<float>*> bottom, top;
+    for (unsigned i = 0; i < topblobs.size(); i++)
+      top.push_back(&topblobs[i]);
+    mgrid.SetUp(bottom, top);
+    BOOST_REQUIRE_EQUAL(topblobs[0].shape(0), 2);
+    unsigned frame_size = topblobs[0].count(1);
+    for (unsigned chunk = 0; chunk < 2; chunk++) {
+      mgrid.Forward(bottom, top);
+      const float *grids = topblobs[0].cpu_data();
+      for (unsigned f = 0; f < 2; f++)
+        frames.push_back(vector<float>(grids + f*frame_size, grids + (f+1)*frame_size));
+    }
+  }
+  fs::remove(types);
+  return frames;
+}
+
+void test_group_chunk_transforms() {
+  //the frames of a group share one random transformation, also when the
+  //group is split into chunks that are loaded by different forwards
+  begin_test("Group Chunk Transforms", Caffe::CPU);
+  Caffe::set_random_seed(p_args.seed);
+
+  for (unsigned prefetch = 0; prefetch < 3; prefetch += 2) {
+    vector<vector<float> > frames = grid_group_chunks(prefetch);
+    BOOST_REQUIRE_EQUAL(frames.size(), 4U);
+    BOOST_REQUIRE_NE(std::accumulate(frames[0].begin(), frames[0].end(), 0.0f), 0);
+    for (unsigned f = 1; f < frames.size(); f++) {
+      p_args.log << "prefetch " << prefetch << " frame " << f << "\n";
+      BOOST_REQUIRE(frames[f] == frames[0]);
+    }
+  }
+}
+
 //TODO TODO TODO: reimplement this functionality
 #if 0
 void test_subcube_grids() {
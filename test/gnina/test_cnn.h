@@ -2,5 +2,14 @@
 
 void test_set_atom_gradients();
 void test_vanilla_grids();
+void test_batch_grids();
+void test_receptor_grid_reuse();
+void test_shared_grids();
+void test_shared_grid_scores();
+void test_batch_rotation_scores();
+void test_model_registry();
+void test_grid_tiles();
+void test_group_chunk_transforms();
+void test_sparse_grid_gradients();
 void test_subcube_grids();
 void test_strided_cube_datagetter();
@@ -81,3 +81,8 @@ assert not np.array_equal(ensembleout,singleout)
 assert 'CNNaffinity_variance' in open('testingout.sdf').read()
 
 os.remove('testingout.sdf')
+
+#per-thread network copies share the weights, so refinement must match the shared network
+replicaout = subprocess.check_output('%s  -r data/184l_rec.pdb -l data/184l_lig.sdf --autobox_ligand data/184l_lig.sdf --seed 2 --num_modes=10 --cnn=general_default2018 --cnn_scoring=refinement --cpu 4'%gnina,shell=True)
+replicaout2 = subprocess.check_output('%s  -r data/184l_rec.pdb -l data/184l_lig.sdf --autobox_ligand data/184l_lig.sdf --seed 2 --num_modes=10 --cnn=general_default2018 --cnn_scoring=refinement --cpu 4 --cnn_thread_replicas'%gnina,shell=True)
+np.testing.assert_array_almost_equal(getscores(replicaout),getscores(replicaout2),decimal=3)
@@ -0,0 +1,58 @@
+#include <random>
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include "common.h"
+#include "coords.h"
+#include "test_coords.h"
+#include "parsed_args.h"
+#include "test_utils.h"
+
+//output_heap has to keep the same poses as add_to_output_container
+void test_output_heap() {
+  p_args.log << "Output Heap Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << "\n";
+  p_args.log << "Iteration " << p_args.iter_count;
+  p_args.log.endl();
+  std::mt19937 engine(p_args.seed);
+  std::uniform_real_distribution<fl> energy_dist(-12, 0);
+  std::normal_distribution<fl> jitter(0, 0.4);
+  std::uniform_int_distribution<sz> size_dist(1, 30);
+
+  for (unsigned rep = 0; rep < 20; rep++) {
+    //poses clustered around a few sites so that many are similar
+    const sz natoms = 12;
+    std::vector<vecv> sites;
+    for (unsigned s = 0; s < 5; s++) {
+      vecv site;
+      VINA_FOR(i, natoms)
+        site.push_back(vec(3 * jitter(engine) + 4 * s, 3 * jitter(engine),
+            3 * jitter(engine)));
+      sites.push_back(site);
+    }
+
+    sz max_size = size_dist(engine);
+    fl min_rmsd = 0.5 + rep % 3;
+    output_container expected;
+    output_heap heap(min_rmsd, max_size);
+    for (unsigned p = 0; p < 500; p++) {
+      output_type t(conf(), energy_dist(engine));
+      const vecv& site = sites[p % sites.size()];
+      VINA_FOR(i, natoms)
+        t.coords.push_back(
+            site[i] + vec(jitter(engine), jitter(engine), jitter(engine)));
+      add_to_output_container(expected, t, min_rmsd, max_size);
+      heap.add(t);
+      BOOST_REQUIRE_EQUAL(heap.size(), expected.size());
+    }
+
+    output_container out;
+    heap.release(out);
+    BOOST_REQUIRE_EQUAL(heap.size(), 0);
+    BOOST_REQUIRE_EQUAL(out.size(), expected.size());
+    VINA_FOR_IN(i, out) {
+      BOOST_CHECK_EQUAL(out[i].e, expected[i].e);
+      BOOST_CHECK_EQUAL(rmsd_upper_bound(out[i].coords, expected[i].coords), 0);
+    }
+  }
+}
@@ -62,3 +62,46 @@ aff,cnn = get_scores(output)
 assert aff < -8
 assert cnn > 5
 rmout()
+
+#grids saved with --grid_cache are reused by a later run with identical results
+import tempfile, glob
+cachedir = tempfile.mkdtemp()
+cmd = '%s -r data/noelem_rec.pdb -l data/noelem.sdf --autobox_ligand data/noelem.sdf --cnn_scoring none --seed 0 --cpu 1 --exhaustiveness 1 --num_modes 1 --grid_cache %s -o %s'%(gnina,cachedir,outfile)
+subprocess.check_output(cmd,shell=True)
+firstmol = next(pybel.readfile('sdf',outfile))
+assert len(glob.glob(os.path.join(cachedir,'*.grid'))) > 0
+rmout()
+subprocess.check_output(cmd,shell=True)
+secondmol = next(pybel.readfile('sdf',outfile))
+assert firstmol.data['minimizedAffinity'] == secondmol.data['minimizedAffinity']
+rmout()
+
+#as are the spline tables of --approximation spline (the default of --minimize)
+cmd = '%s -r data/noelem_rec.pdb -l data/noelem.sdf --minimize --cnn_scoring none --grid_cache %s -o %s'%(gnina,cachedir,outfile)
+subprocess.check_output(cmd,shell=True)
+firstmol = next(pybel.readfile('sdf',outfile))
+assert len(glob.glob(os.path.join(cachedir,'*.splines'))) == 1
+rmout()
+subprocess.check_output(cmd,shell=True)
+secondmol = next(pybel.readfile('sdf',outfile))
+assert firstmol.data['minimizedAffinity'] == secondmol.data['minimizedAffinity']
+rmout()
+
+#ligands converted ahead by --parse_threads come back in input order
+ligsdf = os.path.join(tempfile.mkdtemp(),'ligs.sdf')
+with open(ligsdf,'w') as out:
+    for lig in ['noelem.sdf','10gs_lig.sdf','184l_lig.sdf','C8bent.sdf']*3:
+        out.write(open(os.path.join('data',lig)).read())
+cmd = '%s -r data/noelem_rec.pdb -l %s --score_only --cnn_scoring none'%(gnina,ligsdf)
+serial = re.findall('Affinity: (\S+)',subprocess.check_output(cmd,shell=True).decode())
+parallel = re.findall('Affinity: (\S+)',subprocess.check_output(cmd+' --parse_threads 3',shell=True).decode())
+assert len(serial) == 12
+assert serial == parallel
+
+#ligands minimized together share receptor cells, which must not change results
+cmd = '%s -r data/noelem_rec.pdb -l %s --minimize --cnn_scoring none'
+together = re.findall('Affinity: (\S+)',subprocess.check_output(cmd%(gnina,ligsdf),shell=True).decode())
+assert len(together) == 12
+for i,lig in enumerate(['noelem.sdf','10gs_lig.sdf','184l_lig.sdf','C8bent.sdf']):
+    alone = re.findall('Affinity: (\S+)',subprocess.check_output(cmd%(gnina,os.path.join('data',lig)),shell=True).decode())
+    assert alone[0] == together[i] == together[i+4]
@@ -106,11 +106,12 @@ void test_interaction_energy() {
     m->atoms[i].coords = *(vec*) &lig_atoms[i];
   }
 
+  atomv& grid_atoms = m->grid_atoms.mutate();
   for (size_t i = 0; i < rec_atoms.size(); ++i) {
-    m->grid_atoms.push_back(atom());
-    m->grid_atoms[i].sm = rec_types[i];
-    m->grid_atoms[i].charge = rec_atoms[i].charge;
-    m->grid_atoms[i].coords = *(vec*) &rec_atoms[i];
+    grid_atoms.push_back(atom());
+    grid_atoms[i].sm = rec_types[i];
+    grid_atoms[i].charge = rec_atoms[i].charge;
+    grid_atoms[i].coords = *(vec*) &rec_atoms[i];
   }
 
   szv_grid_cache gridcache(*m, cutoff_sqr);
@@ -0,0 +1,82 @@
+#include <atomic>
+#include <random>
+#define BOOST_TEST_DYN_LINK
+#include <boost/test/unit_test.hpp>
+
+#include "common.h"
+#include "parallel.h"
+#include "work_scheduler.h"
+#include "test_parallel.h"
+#include "parsed_args.h"
+#include "test_utils.h"
+
+struct square_into {
+    std::vector<sz>* out;
+    void operator()(sz i) const {
+      (*out)[i] = i * i;
+    }
+};
+
+void test_parallel_for() {
+  p_args.log << "Parallel For Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << "\n";
+  p_args.log << "Iteration " << p_args.iter_count;
+  p_args.log.endl();
+  std::mt19937 engine(p_args.seed);
+  std::uniform_int_distribution<sz> size_dist(0, 5000);
+  std::uniform_int_distribution<sz> thread_dist(1, 16);
+
+  std::atomic<unsigned> inits(0);
+  auto thread_init = [&inits]() {++inits;};
+  work_scheduler& pool = work_scheduler::global();
+
+  for (unsigned rep = 0; rep < 10; rep++) {
+    sz n = size_dist(engine);
+    std::vector<sz> out(n, 0);
+    square_into f = { &out };
+    parallel_for<square_into, decltype(thread_init), false> pf(&f,
+        thread_dist(engine), thread_init);
+    pf.run(n);
+    std::fill(out.begin(), out.end(), 0);
+    parallel_for<square_into, decltype(thread_init), true> pfs(&f,
+        thread_dist(engine), thread_init);
+    pfs.run(n);
+    for (sz i = 0; i < n; i++)
+      BOOST_REQUIRE_EQUAL(out[i], i * i);
+  }
+  //initialization is per pool thread and loop type, not per run
+  BOOST_CHECK_LE(inits, 2 * pool.num_threads());
+}
+
+void test_scheduler_nested() {
+  p_args.log << "Scheduler Nested Test \n";
+  p_args.log << "Using random seed: " << p_args.seed << "\n";
+  p_args.log << "Iteration " << p_args.iter_count;
+  p_args.log.endl();
+  std::mt19937 engine(p_args.seed);
+  std::uniform_int_distribution<unsigned> task_dist(1, 32);
+
+  work_scheduler& pool = work_scheduler::global();
+  pool.set_max_jobs(2);
+  std::atomic<unsigned> total(0);
+  unsigned expected = 0;
+  for (unsigned j = 0; j < 20; j++) {
+    unsigned ntasks = task_dist(engine);
+    expected += ntasks;
+    pool.submit([ntasks, &total]() {
+      work_scheduler* sched = work_scheduler::current();
+      BOOST_REQUIRE(sched);
+      work_scheduler::task_group g;
+      for (unsigned i = 0; i < ntasks; i++)
+        sched->spawn(g, [&total]() {++total;});
+      sched->wait(g);
+    });
+  }
+  pool.join();
+  pool.set_max_jobs(0);
+  BOOST_CHECK_EQUAL(total, expected);
+
+  //errors in jobs are reported by join
+  pool.submit([]() {throw std::runtime_error("job failure");});
+  BOOST_CHECK_THROW(pool.join(), std::runtime_error);
+}
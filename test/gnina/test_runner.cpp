@@ -6,6 +6,8 @@
 #include "test_tree.h"
 #include "test_cache.h"
 #include "test_cnn.h"
+#include "test_coords.h"
+#include "test_parallel.h"
 #include "test_utils.h"
 #define N_ITERS 5
 #define BOOST_TEST_DYN_LINK
@@ -54,6 +56,14 @@ BOOST_AUTO_TEST_CASE(eval_deriv) {
   boost_loop_test(&test_cache_eval_deriv);
 }
 
+BOOST_AUTO_TEST_CASE(non_cache_eval_deriv) {
+  boost_loop_test(&test_non_cache_eval_deriv);
+}
+
+BOOST_AUTO_TEST_CASE(eval_deriv_many) {
+  boost_loop_test(&test_eval_deriv_many);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
 
 BOOST_AUTO_TEST_SUITE(test_cnn)
@@ -66,6 +76,42 @@ BOOST_AUTO_TEST_CASE(vanilla_grids) {
   boost_loop_test(&test_vanilla_grids);
 }
 
+BOOST_AUTO_TEST_CASE(batch_grids) {
+  boost_loop_test(&test_batch_grids);
+}
+
+BOOST_AUTO_TEST_CASE(receptor_grid_reuse) {
+  boost_loop_test(&test_receptor_grid_reuse);
+}
+
+BOOST_AUTO_TEST_CASE(shared_grids) {
+  boost_loop_test(&test_shared_grids);
+}
+
+BOOST_AUTO_TEST_CASE(shared_grid_scores) {
+  boost_loop_test(&test_shared_grid_scores);
+}
+
+BOOST_AUTO_TEST_CASE(batch_rotation_scores) {
+  boost_loop_test(&test_batch_rotation_scores);
+}
+
+BOOST_AUTO_TEST_CASE(model_registry) {
+  boost_loop_test(&test_model_registry);
+}
+
+BOOST_AUTO_TEST_CASE(grid_tiles) {
+  boost_loop_test(&test_grid_tiles);
+}
+
+BOOST_AUTO_TEST_CASE(group_chunk_transforms) {
+  boost_loop_test(&test_group_chunk_transforms);
+}
+
+BOOST_AUTO_TEST_CASE(sparse_grid_gradients) {
+  boost_loop_test(&test_sparse_grid_gradients);
+}
+
 #if 0
 BOOST_AUTO_TEST_CASE(subcube_grids) {
   boost_loop_test(&test_subcube_grids);
@@ -78,6 +124,26 @@ BOOST_AUTO_TEST_CASE(strided_cube_datagetter) {
 
 BOOST_AUTO_TEST_SUITE_END()
 
+BOOST_AUTO_TEST_SUITE(coords)
+
+BOOST_AUTO_TEST_CASE(output_heap) {
+  boost_loop_test(&test_output_heap);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_SUITE(parallel)
+
+BOOST_AUTO_TEST_CASE(parallel_for) {
+  boost_loop_test(&test_parallel_for);
+}
+
+BOOST_AUTO_TEST_CASE(scheduler_nested) {
+  boost_loop_test(&test_scheduler_nested);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
+
 bool init_unit_test() {
   // initializeCUDA(0);
   // TODO: multithread running tests
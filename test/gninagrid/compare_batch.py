@@ -0,0 +1,34 @@
+#!/usr/bin/env python3
+
+'''Compare the first grid of a gninagrid --batch file to a binmap file'''
+
+import sys,struct
+import pytest
+
+from pytest import approx
+
+buf = open(sys.argv[1],'rb').read()
+magic,version,encoding,channels,points,resolution,count = struct.unpack('=8s4IfI',buf[:32])
+assert magic == b'GNINAGRD'
+assert count >= 1
+
+size = struct.unpack('=Q',buf[32:40])[0]
+payload = buf[52:52+size]
+n = channels*points**3
+vtype = 'e' if encoding & 1 else 'f'
+if encoding & 2: #sparse
+    nnz = struct.unpack('=I',payload[:4])[0]
+    idx = struct.unpack('=%dI'%nnz,payload[4:4+4*nnz])
+    nzvals = struct.unpack('=%d%s'%(nnz,vtype),payload[4+4*nnz:])
+    vals1 = [0.0]*n
+    for i,v in zip(idx,nzvals):
+        vals1[i] = v
+else:
+    vals1 = struct.unpack('=%d%s'%(n,vtype),payload)
+
+buf2 = open(sys.argv[2],'rb').read()
+assert len(buf2) == 4*n
+vals2 = struct.unpack('f'*n,buf2)
+
+tol = 1e-3 if encoding & 1 else 1e-4
+assert list(vals1) == approx(vals2,abs=tol)